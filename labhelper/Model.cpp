@@ -9,13 +9,22 @@
 #include <iomanip>
 #include <GL/glew.h>
 #include <stb_image.h>
+#include "jobs.h"
 
 namespace labhelper
 {
 bool Texture::load(const std::string& _directory, const std::string& _filename, int _components)
+{
+	decode(_directory, _filename, _components);
+	upload();
+	return true;
+}
+
+bool Texture::decode(const std::string& _directory, const std::string& _filename, int _components)
 {
 	filename = _filename;
 	directory = _directory;
+	nof_components = _components;
 	valid = true;
 	int components;
 	data = stbi_load((directory + filename).c_str(), &width, &height, &components, _components);
@@ -25,6 +34,12 @@ bool Texture::load(const std::string& _directory, const std::string& _filename,
 		          << "\n";
 		exit(1);
 	}
+	return true;
+}
+
+void Texture::upload()
+{
+	const int _components = nof_components;
 	glGenTextures(1, &gl_id);
 	glBindTexture(GL_TEXTURE_2D, gl_id);
 	GLenum format, internal_format;
@@ -57,7 +72,6 @@ bool Texture::load(const std::string& _directory, const std::string& _filename,
 	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 16);
 
 	glBindTexture( GL_TEXTURE_2D, 0 );
-	return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -137,45 +151,66 @@ Model* loadModelFromOBJ(std::string path)
 	model->m_filename = path;
 
 	///////////////////////////////////////////////////////////////////////
-	// Transform all materials into our datastructure
+	// Transform all materials into our datastructure. Their textures are
+	// only noted down here, and decoded together on the job system below.
 	///////////////////////////////////////////////////////////////////////
+	struct TextureRequest
+	{
+		size_t material;
+		Texture Material::*texture;
+		std::string name;
+		int components;
+	};
+	std::vector<TextureRequest> texture_requests;
 	for(const auto& m : materials)
 	{
+		const size_t material_idx = model->m_materials.size();
 		Material material;
 		material.m_name = m.name;
 		material.m_color = glm::vec3(m.diffuse[0], m.diffuse[1], m.diffuse[2]);
 		if(m.diffuse_texname != "")
 		{
-			material.m_color_texture.load(directory, m.diffuse_texname, 4);
+			texture_requests.push_back({ material_idx, &Material::m_color_texture, m.diffuse_texname, 4 });
 		}
 		material.m_reflectivity = m.specular[0];
 		if(m.specular_texname != "")
 		{
-			material.m_reflectivity_texture.load(directory, m.specular_texname, 1);
+			texture_requests.push_back({ material_idx, &Material::m_reflectivity_texture, m.specular_texname, 1 });
 		}
 		material.m_metalness = m.metallic;
 		if(m.metallic_texname != "")
 		{
-			material.m_metalness_texture.load(directory, m.metallic_texname, 1);
+			texture_requests.push_back({ material_idx, &Material::m_metalness_texture, m.metallic_texname, 1 });
 		}
 		material.m_fresnel = m.sheen;
 		if(m.sheen_texname != "")
 		{
-			material.m_fresnel_texture.load(directory, m.sheen_texname, 1);
+			texture_requests.push_back({ material_idx, &Material::m_fresnel_texture, m.sheen_texname, 1 });
 		}
 		material.m_shininess = m.roughness;
 		if(m.roughness_texname != "")
 		{
-			material.m_shininess_texture.load(directory, m.roughness_texname, 1);
+			texture_requests.push_back({ material_idx, &Material::m_shininess_texture, m.roughness_texname, 1 });
 		}
 		material.m_emission = m.emission[0];
 		if(m.emissive_texname != "")
 		{
-			material.m_emission_texture.load(directory, m.emissive_texname, 4);
+			texture_requests.push_back({ material_idx, &Material::m_emission_texture, m.emissive_texname, 4 });
 		}
 		material.m_transparency = m.transmittance[0];
 		model->m_materials.push_back(material);
 	}
+	jobs::parallelFor("Decode textures", int(texture_requests.size()), 1, [&](int begin, int end) {
+		for(int i = begin; i < end; i++)
+		{
+			const TextureRequest& request = texture_requests[i];
+			(model->m_materials[request.material].*request.texture).decode(directory, request.name, request.components);
+		}
+	});
+	for(const auto& request : texture_requests)
+	{
+		(model->m_materials[request.material].*request.texture).upload();
+	}
 
 	///////////////////////////////////////////////////////////////////////
 	// A vertex in the OBJ file may have different indices for position,
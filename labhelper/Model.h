@@ -13,7 +13,12 @@ struct Texture
 	std::string directory;
 	int width, height;
 	uint8_t* data = nullptr;
+	int nof_components = 0;
 	bool load(const std::string& directory, const std::string& filename, int nof_components);
+	// load() in two halves: decode() only touches memory, so it can run on any
+	// thread, upload() creates the GL texture and must run on the GL thread
+	bool decode(const std::string& directory, const std::string& filename, int nof_components);
+	void upload();
 };
 //////////////////////////////////////////////////////////////////////////////
 // This material class implements a subset of the suggested PBR extension
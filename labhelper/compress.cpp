@@ -0,0 +1,237 @@
+#include "compress.h"
+
+#include <cstring>
+#include <vector>
+
+namespace labhelper
+{
+namespace
+{
+const int HASH_BITS = 16;
+const size_t MIN_MATCH = 4;
+const size_t LAST_LITERALS = 5; // The block must end with at least this many literals
+const size_t MF_LIMIT = 12;     // and the last match must start this far from the end
+const size_t MAX_OFFSET = 65535;
+const int SKIP_TRIGGER = 6; // Step further ahead the longer no match has been found
+
+uint32_t read32(const uint8_t* p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+uint64_t read64(const uint8_t* p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+uint32_t hashSequence(uint32_t sequence)
+{
+	return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+uint8_t* writeLength(uint8_t* op, size_t length)
+{
+	while(length >= 255)
+	{
+		*op++ = 255;
+		length -= 255;
+	}
+	*op++ = uint8_t(length);
+	return op;
+}
+
+uint8_t* writeLiterals(uint8_t* op, uint8_t* token, const uint8_t* literals, size_t length)
+{
+	*token = uint8_t((length >= 15 ? 15 : length) << 4);
+	if(length >= 15)
+	{
+		op = writeLength(op, length - 15);
+	}
+	memcpy(op, literals, length);
+	return op + length;
+}
+
+bool readLength(const uint8_t*& ip, const uint8_t* iend, size_t& length)
+{
+	uint8_t b;
+	do
+	{
+		if(ip >= iend)
+		{
+			return false;
+		}
+		b = *ip++;
+		length += b;
+	} while(b == 255);
+	return true;
+}
+} // namespace
+
+size_t lz4CompressBound(size_t size)
+{
+	return size + size / 255 + 16;
+}
+
+size_t lz4Compress(const uint8_t* src, size_t size, uint8_t* dst)
+{
+	uint8_t* op = dst;
+	const uint8_t* anchor = src;
+
+	if(size > MF_LIMIT)
+	{
+		std::vector<uint32_t> table(size_t(1) << HASH_BITS, 0);
+		const uint8_t* ip = src;
+		const uint8_t* matchLimit = src + size - LAST_LITERALS;
+		const uint8_t* mfLimit = src + size - MF_LIMIT;
+		uint32_t misses = 0;
+
+		while(ip <= mfLimit)
+		{
+			uint32_t sequence = read32(ip);
+			uint32_t h = hashSequence(sequence);
+			const uint8_t* ref = src + table[h];
+			table[h] = uint32_t(ip - src);
+
+			if(ref >= ip || size_t(ip - ref) > MAX_OFFSET || read32(ref) != sequence)
+			{
+				ip += 1 + (misses++ >> SKIP_TRIGGER);
+				continue;
+			}
+			misses = 0;
+
+			// Extend the match eight bytes at a time, then byte by byte
+			const uint8_t* matchEnd = ip + MIN_MATCH;
+			ref += MIN_MATCH;
+			while(matchEnd + 8 <= matchLimit && read64(matchEnd) == read64(ref))
+			{
+				matchEnd += 8;
+				ref += 8;
+			}
+			while(matchEnd < matchLimit && *matchEnd == *ref)
+			{
+				matchEnd++;
+				ref++;
+			}
+
+			size_t offset = size_t(matchEnd - ref);
+			size_t matchLength = size_t(matchEnd - ip) - MIN_MATCH;
+
+			uint8_t* token = op++;
+			op = writeLiterals(op, token, anchor, size_t(ip - anchor));
+			*op++ = uint8_t(offset & 0xFF);
+			*op++ = uint8_t(offset >> 8);
+			*token |= uint8_t(matchLength >= 15 ? 15 : matchLength);
+			if(matchLength >= 15)
+			{
+				op = writeLength(op, matchLength - 15);
+			}
+
+			ip = matchEnd;
+			anchor = ip;
+		}
+	}
+
+	uint8_t* token = op++;
+	op = writeLiterals(op, token, anchor, size_t(src + size - anchor));
+	return size_t(op - dst);
+}
+
+size_t lz4Decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t dstCapacity)
+{
+	const uint8_t* ip = src;
+	const uint8_t* iend = src + size;
+	uint8_t* op = dst;
+	uint8_t* oend = dst + dstCapacity;
+
+	while(ip < iend)
+	{
+		uint8_t token = *ip++;
+
+		size_t literalLength = token >> 4;
+		if(literalLength == 15 && !readLength(ip, iend, literalLength))
+		{
+			return 0;
+		}
+		if(literalLength > size_t(iend - ip) || literalLength > size_t(oend - op))
+		{
+			return 0;
+		}
+		memcpy(op, ip, literalLength);
+		ip += literalLength;
+		op += literalLength;
+
+		// The last sequence has no match
+		if(ip == iend)
+		{
+			break;
+		}
+
+		if(iend - ip < 2)
+		{
+			return 0;
+		}
+		size_t offset = size_t(ip[0]) | (size_t(ip[1]) << 8);
+		ip += 2;
+		if(offset == 0 || offset > size_t(op - dst))
+		{
+			return 0;
+		}
+
+		size_t matchLength = token & 15;
+		if(matchLength == 15 && !readLength(ip, iend, matchLength))
+		{
+			return 0;
+		}
+		matchLength += MIN_MATCH;
+		if(matchLength > size_t(oend - op))
+		{
+			return 0;
+		}
+
+		const uint8_t* ref = op - offset;
+		if(offset >= matchLength)
+		{
+			memcpy(op, ref, matchLength);
+			op += matchLength;
+		}
+		else
+		{
+			// Overlapping copy repeats the last 'offset' bytes
+			for(size_t i = 0; i < matchLength; i++)
+			{
+				*op++ = *ref++;
+			}
+		}
+	}
+
+	return size_t(op - dst);
+}
+
+void byteShuffle(const uint8_t* src, size_t count, size_t elementSize, uint8_t* dst)
+{
+	for(size_t b = 0; b < elementSize; b++)
+	{
+		uint8_t* plane = dst + b * count;
+		for(size_t i = 0; i < count; i++)
+		{
+			plane[i] = src[i * elementSize + b];
+		}
+	}
+}
+
+void byteUnshuffle(const uint8_t* src, size_t count, size_t elementSize, uint8_t* dst)
+{
+	for(size_t b = 0; b < elementSize; b++)
+	{
+		const uint8_t* plane = src + b * count;
+		for(size_t i = 0; i < count; i++)
+		{
+			dst[i * elementSize + b] = plane[i];
+		}
+	}
+}
+} // namespace labhelper
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace labhelper
+{
+/**
+	* Fast LZ compression producing the LZ4 block format (greedy matching with a
+	* single-entry hash table, no frame header or checksum). Meant for bulk
+	* simulation data that has been made compressible first, e.g. by delta
+	* coding and byte shuffling.
+	*/
+
+/**
+	* Upper bound on the compressed size of 'size' input bytes.
+	*/
+size_t lz4CompressBound(size_t size);
+
+/**
+	* Compresses 'size' bytes into 'dst', which must hold lz4CompressBound(size)
+	* bytes. Returns the compressed size.
+	*/
+size_t lz4Compress(const uint8_t* src, size_t size, uint8_t* dst);
+
+/**
+	* Decompresses a block into 'dst', which has room for 'dstCapacity' bytes.
+	* Returns the decompressed size, or 0 if the block is malformed or doesn't
+	* fit.
+	*/
+size_t lz4Decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t dstCapacity);
+
+/**
+	* Byte shuffle: splits 'count' elements of 'elementSize' bytes into
+	* 'elementSize' planes, so that the n-th bytes of all elements are
+	* contiguous. Slowly varying data compresses much better shuffled.
+	*/
+void byteShuffle(const uint8_t* src, size_t count, size_t elementSize, uint8_t* dst);
+
+/**
+	* Inverse of byteShuffle().
+	*/
+void byteUnshuffle(const uint8_t* src, size_t count, size_t elementSize, uint8_t* dst);
+} // namespace labhelper
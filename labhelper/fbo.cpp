@@ -2,87 +2,244 @@
 #include <cstdint>
 #include <labhelper.h>
 
-FboInfo::FboInfo(int numberOfColorBuffers)
-    : isComplete(false), framebufferId(UINT32_MAX), depthBuffer(UINT32_MAX), width(0), height(0)
+int FboInfo::allocationGranularity = 64;
+
+namespace
+{
+///////////////////////////////////////////////////////////////////////////////
+// Textures released by resizes, shared by all FboInfos. Oldest first, the
+// oldest is deleted once the pool is full.
+///////////////////////////////////////////////////////////////////////////////
+struct PooledTexture
 {
-	colorTextureTargets.resize(numberOfColorBuffers, UINT32_MAX);
+	GLuint id;
+	GLenum format;
+	int width;
+	int height;
+	GLsizei samples;
+};
+
+const size_t MAX_POOLED_TEXTURES = 8;
+std::vector<PooledTexture> texturePool;
+
+bool isIntegerFormat(GLenum format)
+{
+	switch(format)
+	{
+	case GL_R8UI: case GL_R16UI: case GL_R32UI: case GL_RG8UI: case GL_RG16UI: case GL_RG32UI:
+	case GL_RGBA8UI: case GL_RGBA16UI: case GL_RGBA32UI:
+	case GL_R8I: case GL_R16I: case GL_R32I: case GL_RG8I: case GL_RG16I: case GL_RG32I:
+	case GL_RGBA8I: case GL_RGBA16I: case GL_RGBA32I:
+		return true;
+	default:
+		return false;
+	}
+}
+
+GLenum textureTarget(GLsizei samples)
+{
+	return samples > 1 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D;
+}
+
+GLuint acquireTexture(GLenum format, int width, int height, GLsizei samples, bool isDepth)
+{
+	for(auto it = texturePool.begin(); it != texturePool.end(); ++it)
+	{
+		if(it->format == format && it->width == width && it->height == height && it->samples == samples)
+		{
+			GLuint id = it->id;
+			texturePool.erase(it);
+			return id;
+		}
+	}
+
+	GLenum target = textureTarget(samples);
+	GLuint id;
+	glGenTextures(1, &id);
+	glBindTexture(target, id);
+	if(samples > 1)
+	{
+		glTexStorage2DMultisample(target, samples, format, width, height, GL_TRUE);
+	}
+	else
+	{
+		glTexStorage2D(target, 1, format, width, height);
+		// Integer textures are incomplete with linear filtering
+		GLint filter = isIntegerFormat(format) ? GL_NEAREST : GL_LINEAR;
+		glTexParameteri(target, GL_TEXTURE_MIN_FILTER, filter);
+		glTexParameteri(target, GL_TEXTURE_MAG_FILTER, filter);
+		if(isDepth)
+		{
+			glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		}
+	}
+	glBindTexture(target, 0);
+	return id;
+}
+
+void releaseTexture(GLuint id, GLenum format, int width, int height, GLsizei samples)
+{
+	if(id == UINT32_MAX)
+	{
+		return;
+	}
+	PooledTexture texture = { id, format, width, height, samples };
+	texturePool.push_back(texture);
+	if(texturePool.size() > MAX_POOLED_TEXTURES)
+	{
+		glDeleteTextures(1, &texturePool.front().id);
+		texturePool.erase(texturePool.begin());
+	}
+}
+
+int roundUp(int size, int granularity)
+{
+	return granularity > 1 ? (size + granularity - 1) / granularity * granularity : size;
+}
+} // namespace
+
+FboInfo::FboInfo(int numberOfColorBuffers) : FboInfo(FboAttachments(numberOfColorBuffers))
+{
+}
+
+FboInfo::FboInfo(const FboAttachments& attachments)
+    : framebufferId(UINT32_MAX)
+    , depthBuffer(UINT32_MAX)
+    , width(0)
+    , height(0)
+    , allocatedWidth(0)
+    , allocatedHeight(0)
+    , isComplete(false)
+    , attachments(attachments)
+{
+	colorTextureTargets.resize(attachments.colorFormats.size(), UINT32_MAX);
 };
 
 void FboInfo::resize(int w, int h)
 {
+	if(isComplete && w == width && h == height)
+	{
+		return;
+	}
 	width = w;
 	height = h;
+	if(w <= 0 || h <= 0)
+	{
+		// Minimized, keep the old storage around until there is a real size
+		return;
+	}
 
 	///////////////////////////////////////////////////////////////////////
-	// if no texture indices yet, allocate
+	// Still fits the current storage, only the used area changes
 	///////////////////////////////////////////////////////////////////////
-	for(auto& colorTextureTarget : colorTextureTargets)
+	int newAllocatedWidth = roundUp(w, allocationGranularity);
+	int newAllocatedHeight = roundUp(h, allocationGranularity);
+	if(isComplete && newAllocatedWidth == allocatedWidth && newAllocatedHeight == allocatedHeight)
 	{
-		if(colorTextureTarget == UINT32_MAX)
-		{
-			glGenTextures(1, &colorTextureTarget);
-			glBindTexture(GL_TEXTURE_2D, colorTextureTarget);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		}
+		return;
 	}
 
-	if(depthBuffer == UINT32_MAX)
+	///////////////////////////////////////////////////////////////////////
+	// Swap the old storage for pooled or new textures of the new size
+	///////////////////////////////////////////////////////////////////////
+	const GLsizei samples = attachments.samples;
+	for(size_t i = 0; i < colorTextureTargets.size(); i++)
 	{
-		glGenTextures(1, &depthBuffer);
-		glBindTexture(GL_TEXTURE_2D, depthBuffer);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		GLenum format = attachments.colorFormats[i];
+		releaseTexture(colorTextureTargets[i], format, allocatedWidth, allocatedHeight, samples);
+		colorTextureTargets[i] = acquireTexture(format, newAllocatedWidth, newAllocatedHeight, samples, false);
 	}
 
-	///////////////////////////////////////////////////////////////////////
-	// Allocate / Resize textures
-	///////////////////////////////////////////////////////////////////////
-	for(auto& colorTextureTarget : colorTextureTargets)
+	if(attachments.depthFormat != GL_NONE)
 	{
-		glBindTexture(GL_TEXTURE_2D, colorTextureTarget);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		releaseTexture(depthBuffer, attachments.depthFormat, allocatedWidth, allocatedHeight, samples);
+		depthBuffer = acquireTexture(attachments.depthFormat, newAllocatedWidth, newAllocatedHeight, samples, true);
 	}
 
-	glBindTexture(GL_TEXTURE_2D, depthBuffer);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT,
-	             nullptr);
+	allocatedWidth = newAllocatedWidth;
+	allocatedHeight = newAllocatedHeight;
 
 	///////////////////////////////////////////////////////////////////////
-	// Bind textures to framebuffer (if not already done)
+	// (Re)attach the textures
 	///////////////////////////////////////////////////////////////////////
-	if(!isComplete)
+	if(framebufferId == UINT32_MAX)
 	{
-		///////////////////////////////////////////////////////////////////////
-		// Generate and bind framebuffer
-		///////////////////////////////////////////////////////////////////////
 		glGenFramebuffers(1, &framebufferId);
-		glBindFramebuffer(GL_FRAMEBUFFER, framebufferId);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, framebufferId);
+
+	const GLenum target = textureTarget(samples);
+	for(int i = 0; i < int(colorTextureTargets.size()); i++)
+	{
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, target, colorTextureTargets[i], 0);
+	}
+	GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2,
+		                     GL_COLOR_ATTACHMENT3, GL_COLOR_ATTACHMENT4, GL_COLOR_ATTACHMENT5,
+		                     GL_COLOR_ATTACHMENT6, GL_COLOR_ATTACHMENT7 };
+	glDrawBuffers(int(colorTextureTargets.size()), drawBuffers);
+
+	if(attachments.depthFormat != GL_NONE)
+	{
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, target, depthBuffer, 0);
+	}
+
+	// check if framebuffer is complete
+	isComplete = checkFramebufferComplete();
+
+	// bind default framebuffer, just in case.
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-		// Bind the color textures as color attachments
+void FboInfo::invalidate(bool color, bool depth)
+{
+	if(!isComplete)
+	{
+		return;
+	}
+
+	GLenum invalidAttachments[9];
+	GLsizei count = 0;
+	if(color)
+	{
 		for(int i = 0; i < int(colorTextureTargets.size()); i++)
 		{
-			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D,
-			                       colorTextureTargets[i], 0);
+			invalidAttachments[count++] = GL_COLOR_ATTACHMENT0 + i;
 		}
-		GLenum attachments[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2,
-			                     GL_COLOR_ATTACHMENT3, GL_COLOR_ATTACHMENT4, GL_COLOR_ATTACHMENT5,
-			                     GL_COLOR_ATTACHMENT6, GL_COLOR_ATTACHMENT7 };
-		glDrawBuffers(int(colorTextureTargets.size()), attachments);
-
-		// bind the texture as depth attachment (to the currently bound framebuffer)
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthBuffer, 0);
-
-		// check if framebuffer is complete
-		isComplete = checkFramebufferComplete();
+	}
+	if(depth && attachments.depthFormat != GL_NONE)
+	{
+		invalidAttachments[count++] = GL_DEPTH_ATTACHMENT;
 	}
 
-	// bind default framebuffer, just in case.
+	glBindFramebuffer(GL_FRAMEBUFFER, framebufferId);
+	glInvalidateFramebuffer(GL_FRAMEBUFFER, count, invalidAttachments);
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
+void FboInfo::release()
+{
+	const GLsizei samples = attachments.samples;
+	for(size_t i = 0; i < colorTextureTargets.size(); i++)
+	{
+		releaseTexture(colorTextureTargets[i], attachments.colorFormats[i], allocatedWidth, allocatedHeight, samples);
+		colorTextureTargets[i] = UINT32_MAX;
+	}
+	if(attachments.depthFormat != GL_NONE)
+	{
+		releaseTexture(depthBuffer, attachments.depthFormat, allocatedWidth, allocatedHeight, samples);
+		depthBuffer = UINT32_MAX;
+	}
+	if(framebufferId != UINT32_MAX)
+	{
+		glDeleteFramebuffers(1, &framebufferId);
+		framebufferId = UINT32_MAX;
+	}
+	width = height = 0;
+	allocatedWidth = allocatedHeight = 0;
+	isComplete = false;
+}
+
 bool FboInfo::checkFramebufferComplete(void)
 {
 	// Check that our FBO is correctly set up, this can fail if we have
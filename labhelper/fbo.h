@@ -1,17 +1,59 @@
+#pragma once
+
 #include <GL/glew.h>
 #include <vector>
 
+/**
+	* What an FboInfo is made of. A depthFormat of GL_NONE leaves out the depth
+	* attachment; samples > 1 gives multisampled textures.
+	*/
+struct FboAttachments {
+	std::vector<GLenum> colorFormats;
+	GLenum depthFormat;
+	GLsizei samples;
+
+	FboAttachments(int numberOfColorBuffers = 1,
+	               GLenum colorFormat = GL_RGBA16F,
+	               GLenum depthFormat = GL_DEPTH_COMPONENT32,
+	               GLsizei samples = 0)
+	    : colorFormats(numberOfColorBuffers, colorFormat), depthFormat(depthFormat), samples(samples)
+	{
+	}
+};
+
+/**
+	* Textures use immutable storage and are allocated rounded up to
+	* allocationGranularity, so small size changes only move the viewport.
+	* width/height is the size in use; the textures may be larger, which
+	* texelFetch and pixel-coordinate / textureSize() lookups don't notice.
+	* Storage dropped by a resize goes to a small shared pool that later
+	* resizes (e.g. dragging the window back) take from before allocating.
+	*/
 class FboInfo {
 public:
 	GLuint framebufferId;
-	std::vector<GLuint> colorTextureTargets; 
+	std::vector<GLuint> colorTextureTargets;
 	GLuint depthBuffer;
 	int width;
 	int height;
+	int allocatedWidth;
+	int allocatedHeight;
 	bool isComplete;
+	FboAttachments attachments;
+
+	static int allocationGranularity;
 
 	FboInfo(int numberOfColorBuffers = 1);
-		
+	FboInfo(const FboAttachments& attachments);
+
+	// Does nothing if the size is unchanged
 	void resize(int w, int h);
 	bool checkFramebufferComplete(void);
+
+	// Tells the driver the contents are no longer needed, so tiled and
+	// software renderers can skip storing them (or loading them next time)
+	void invalidate(bool color = true, bool depth = true);
+
+	// Returns the textures to the pool and deletes the framebuffer
+	void release();
 };
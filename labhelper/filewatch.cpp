@@ -0,0 +1,130 @@
+#include "filewatch.h"
+
+#include <chrono>
+#include <filesystem>
+#include <system_error>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace labhelper
+{
+namespace
+{
+double now()
+{
+	using namespace std::chrono;
+	return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+long long modificationTime(const std::string& path)
+{
+	std::error_code error;
+	auto time = std::filesystem::last_write_time(path, error);
+	return error ? -1 : (long long)time.time_since_epoch().count();
+}
+} // namespace
+
+FileWatcher::FileWatcher() : inotifyFd(-1), lastPollTime(0.0)
+{
+#ifdef __linux__
+	inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+}
+
+FileWatcher::~FileWatcher()
+{
+#ifdef __linux__
+	if(inotifyFd >= 0)
+	{
+		close(inotifyFd);
+	}
+#endif
+}
+
+void FileWatcher::add(const std::string& path)
+{
+	for(const WatchedFile& file : files)
+	{
+		if(file.path == path)
+		{
+			return;
+		}
+	}
+
+	std::filesystem::path p(path);
+	WatchedFile file;
+	file.path = path;
+	file.name = p.filename().string();
+	file.watch = -1;
+	file.modified = modificationTime(path);
+
+#ifdef __linux__
+	if(inotifyFd >= 0)
+	{
+		// Watching the directory rather than the file survives the file being replaced.
+		// inotify hands back the same descriptor for a directory that is already watched.
+		std::string directory = p.has_parent_path() ? p.parent_path().string() : ".";
+		file.watch = inotify_add_watch(inotifyFd, directory.c_str(),
+		                               IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+	}
+#endif
+	files.push_back(file);
+}
+
+bool FileWatcher::poll()
+{
+	bool changed = false;
+
+#ifdef __linux__
+	if(inotifyFd >= 0)
+	{
+		alignas(inotify_event) char buffer[4096];
+		for(;;)
+		{
+			ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+			if(length <= 0)
+			{
+				break;
+			}
+			for(char* p = buffer; p < buffer + length;)
+			{
+				const inotify_event* event = (const inotify_event*)p;
+				for(const WatchedFile& file : files)
+				{
+					if(event->len > 0 && file.watch == event->wd && file.name == event->name)
+					{
+						changed = true;
+					}
+				}
+				p += sizeof(inotify_event) + event->len;
+			}
+		}
+	}
+#endif
+
+	// Files inotify couldn't take are polled
+	double time = now();
+	if(time - lastPollTime < pollInterval)
+	{
+		return changed;
+	}
+	lastPollTime = time;
+	for(WatchedFile& file : files)
+	{
+		if(file.watch >= 0)
+		{
+			continue;
+		}
+		long long modified = modificationTime(file.path);
+		if(modified != file.modified)
+		{
+			file.modified = modified;
+			changed = true;
+		}
+	}
+	return changed;
+}
+} // namespace labhelper
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace labhelper
+{
+/**
+	* Reports changes to a set of files. On Linux the directories holding the
+	* files are watched with inotify, so editors that save by writing a new
+	* file and renaming it over the old one are caught too. Elsewhere the
+	* modification times are polled, at most every pollInterval seconds.
+	*/
+class FileWatcher
+{
+public:
+	FileWatcher();
+	~FileWatcher();
+	FileWatcher(const FileWatcher&) = delete;
+	FileWatcher& operator=(const FileWatcher&) = delete;
+
+	// Adding the same file twice is harmless
+	void add(const std::string& path);
+
+	// True if any of the files changed since the last call
+	bool poll();
+
+	float pollInterval = 0.25f;
+
+private:
+	struct WatchedFile
+	{
+		std::string path;
+		std::string name;      // Without the directory
+		int watch;             // inotify watch of the directory, -1 if polled
+		long long modified;    // Last seen modification time, if polled
+	};
+	std::vector<WatchedFile> files;
+	int inotifyFd;
+	double lastPollTime;
+};
+} // namespace labhelper
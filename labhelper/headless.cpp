@@ -0,0 +1,229 @@
+#include <GL/glew.h>
+
+#include "labhelper.h"
+#include "jobs.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <stb_image.h>
+
+#ifdef LABHELPER_HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+#ifdef LABHELPER_HAVE_OSMESA
+#include <GL/osmesa.h>
+#endif
+
+namespace labhelper
+{
+namespace
+{
+#ifdef LABHELPER_HAVE_EGL
+EGLDisplay s_egl_display = EGL_NO_DISPLAY;
+EGLContext s_egl_context = EGL_NO_CONTEXT;
+
+bool hasExtension(const char* extensions, const char* name)
+{
+	if(extensions == nullptr)
+	{
+		return false;
+	}
+	size_t length = strlen(name);
+	for(const char* p = strstr(extensions, name); p != nullptr; p = strstr(p + length, name))
+	{
+		if((p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0'))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool initEGL()
+{
+	// Mesa's surfaceless platform needs neither a window system nor a GPU,
+	// anything else falls back to the default display
+	const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	if(hasExtension(clientExtensions, "EGL_MESA_platform_surfaceless"))
+	{
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		    (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if(getPlatformDisplay != nullptr)
+		{
+			s_egl_display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+		}
+	}
+	if(s_egl_display == EGL_NO_DISPLAY)
+	{
+		s_egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+	if(s_egl_display == EGL_NO_DISPLAY || !eglInitialize(s_egl_display, nullptr, nullptr))
+	{
+		fprintf(stderr, "EGL: no display\n");
+		s_egl_display = EGL_NO_DISPLAY;
+		return false;
+	}
+
+	const char* extensions = eglQueryString(s_egl_display, EGL_EXTENSIONS);
+	if(!hasExtension(extensions, "EGL_KHR_surfaceless_context") || !eglBindAPI(EGL_OPENGL_API))
+	{
+		fprintf(stderr, "EGL: no surfaceless desktop OpenGL\n");
+		eglTerminate(s_egl_display);
+		s_egl_display = EGL_NO_DISPLAY;
+		return false;
+	}
+
+	// Nothing is ever drawn to an EGL surface, so any config will do
+	EGLConfig config = nullptr;
+	if(!hasExtension(extensions, "EGL_KHR_no_config_context"))
+	{
+		const EGLint configAttributes[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+		EGLint numConfigs = 0;
+		eglChooseConfig(s_egl_display, configAttributes, &config, 1, &numConfigs);
+	}
+
+	const EGLint contextAttributes[] = { EGL_CONTEXT_MAJOR_VERSION, 4,
+		                                 EGL_CONTEXT_MINOR_VERSION, 3,
+		                                 EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		                                 EGL_CONTEXT_OPENGL_DEBUG, getGLDebugLevel() != GLDebugLevel::Off,
+		                                 EGL_NONE };
+	s_egl_context = eglCreateContext(s_egl_display, config, EGL_NO_CONTEXT, contextAttributes);
+	if(s_egl_context == EGL_NO_CONTEXT
+	   || !eglMakeCurrent(s_egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, s_egl_context))
+	{
+		fprintf(stderr, "EGL: failed to create an OpenGL 4.3 context (0x%x)\n", eglGetError());
+		if(s_egl_context != EGL_NO_CONTEXT)
+		{
+			eglDestroyContext(s_egl_display, s_egl_context);
+			s_egl_context = EGL_NO_CONTEXT;
+		}
+		eglTerminate(s_egl_display);
+		s_egl_display = EGL_NO_DISPLAY;
+		return false;
+	}
+	return true;
+}
+#endif // LABHELPER_HAVE_EGL
+
+#ifdef LABHELPER_HAVE_OSMESA
+OSMesaContext s_osmesa_context = nullptr;
+// OSMesa insists on a colour buffer to make a context current, nothing is drawn to it
+std::vector<unsigned char> s_osmesa_buffer(4);
+
+bool initOSMesa()
+{
+	const int attributes[] = { OSMESA_FORMAT, OSMESA_RGBA,
+		                       OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+		                       OSMESA_CONTEXT_MAJOR_VERSION, 4,
+		                       OSMESA_CONTEXT_MINOR_VERSION, 3,
+		                       0 };
+	s_osmesa_context = OSMesaCreateContextAttribs(attributes, nullptr);
+	if(s_osmesa_context == nullptr
+	   || !OSMesaMakeCurrent(s_osmesa_context, s_osmesa_buffer.data(), GL_UNSIGNED_BYTE, 1, 1))
+	{
+		fprintf(stderr, "OSMesa: failed to create an OpenGL 4.3 context\n");
+		if(s_osmesa_context != nullptr)
+		{
+			OSMesaDestroyContext(s_osmesa_context);
+			s_osmesa_context = nullptr;
+		}
+		return false;
+	}
+	return true;
+}
+#endif // LABHELPER_HAVE_OSMESA
+
+const char* s_headless_backend = nullptr;
+} // namespace
+
+bool init_headless_context(HeadlessBackend backend)
+{
+	bool created = false;
+#if !defined(LABHELPER_HAVE_EGL) && !defined(LABHELPER_HAVE_OSMESA)
+	(void)backend; // Nothing to choose from, this build can't go headless
+#endif
+#ifdef LABHELPER_HAVE_EGL
+	if(!created && (backend == HeadlessBackend::Auto || backend == HeadlessBackend::EGL) && initEGL())
+	{
+		s_headless_backend = "EGL";
+		created = true;
+	}
+#endif
+#ifdef LABHELPER_HAVE_OSMESA
+	if(!created && (backend == HeadlessBackend::Auto || backend == HeadlessBackend::OSMesa) && initOSMesa())
+	{
+		s_headless_backend = "OSMesa";
+		created = true;
+	}
+#endif
+	if(!created)
+	{
+		fprintf(stderr, "Couldn't create a headless OpenGL context\n");
+		return false;
+	}
+
+	// GLEW finds the entry points through the window system's loader, which
+	// works for EGL under Mesa and GLVND. OSMesa wants a GLEW built with GLEW_OSMESA.
+	// A GLX build of GLEW loads the core entry points, then reports that there
+	// is no X display to load GLX from, which doesn't matter under EGL.
+	glewExperimental = GL_TRUE;
+	GLenum glewStatus = glewInit();
+	const bool onlyMissingGLX =
+	    glewStatus == GLEW_ERROR_NO_GLX_DISPLAY && strcmp(s_headless_backend, "EGL") == 0;
+	if(glewStatus != GLEW_OK && !onlyMissingGLX)
+	{
+		fprintf(stderr, "%s: GLEW failed to initialize: %s\n", s_headless_backend,
+		        reinterpret_cast<const char*>(glewGetErrorString(glewStatus)));
+		shutDownHeadless();
+		return false;
+	}
+	if(!GLEW_VERSION_4_3)
+	{
+		fprintf(stderr, "%s: OpenGL 4.3 not supported\n", s_headless_backend);
+		shutDownHeadless();
+		return false;
+	}
+
+	startupGLDiagnostics();
+	setupGLDebugMessages();
+
+	// Same as init_window_SDL(), so loaded images match the windowed runs
+	stbi_set_flip_vertically_on_load(true);
+
+	// No GUI to draw, and no swap interval: there is nothing to present to
+	hideGUI();
+	return true;
+}
+
+const char* headlessBackendName()
+{
+	return s_headless_backend;
+}
+
+void shutDownHeadless()
+{
+	jobs::shutDown();
+
+#ifdef LABHELPER_HAVE_EGL
+	if(s_egl_display != EGL_NO_DISPLAY)
+	{
+		eglMakeCurrent(s_egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		eglDestroyContext(s_egl_display, s_egl_context);
+		eglTerminate(s_egl_display);
+		s_egl_context = EGL_NO_CONTEXT;
+		s_egl_display = EGL_NO_DISPLAY;
+	}
+#endif
+#ifdef LABHELPER_HAVE_OSMESA
+	if(s_osmesa_context != nullptr)
+	{
+		OSMesaDestroyContext(s_osmesa_context);
+		s_osmesa_context = nullptr;
+	}
+#endif
+	s_headless_backend = nullptr;
+}
+} // namespace labhelper
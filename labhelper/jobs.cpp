@@ -0,0 +1,353 @@
+#include "jobs.h"
+
+#include "perf.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#endif
+
+namespace labhelper
+{
+namespace jobs
+{
+struct Job
+{
+	std::string name;
+	std::function<void()> work;
+	// Plus one while submit() is still registering them, so it can't start early
+	std::atomic<int> unfinishedDependencies;
+
+	std::mutex mutex; // Guards the rest
+	std::condition_variable finished;
+	bool done;
+	std::vector<JobHandle> continuations; // Jobs that depend on this one
+};
+
+namespace
+{
+struct WorkQueue
+{
+	std::mutex mutex;
+	std::deque<JobHandle> jobs;
+};
+
+struct Scheduler
+{
+	std::vector<std::thread> workers;
+	// One per worker, then the one shared by all other threads
+	std::unique_ptr<WorkQueue[]> queues;
+	int workerCount;
+	std::atomic<int> queued;
+
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	bool stopping;
+};
+
+std::mutex schedulerMutex; // Guards starting and stopping
+std::atomic<Scheduler*> scheduler(nullptr);
+
+// Index of the calling thread's queue if it is a worker, -1 otherwise
+thread_local int workerIndex = -1;
+
+Scheduler& getScheduler()
+{
+	Scheduler* s = scheduler.load(std::memory_order_acquire);
+	if(s == nullptr)
+	{
+		init();
+		s = scheduler.load(std::memory_order_acquire);
+	}
+	return *s;
+}
+
+int ownQueue(const Scheduler& s)
+{
+	return workerIndex >= 0 ? workerIndex : s.workerCount;
+}
+
+void pinToCore(std::thread& thread, int core)
+{
+#if defined(_WIN32)
+	SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << core);
+#elif defined(__linux__)
+	cpu_set_t cores;
+	CPU_ZERO(&cores);
+	CPU_SET(core, &cores);
+	pthread_setaffinity_np(thread.native_handle(), sizeof(cores), &cores);
+#else
+	(void)thread;
+	(void)core;
+#endif
+}
+
+void schedule(Scheduler& s, const JobHandle& job)
+{
+	WorkQueue& queue = s.queues[ownQueue(s)];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back(job);
+	}
+	s.queued++;
+	{
+		// Taken so a worker can't miss this between checking and going to sleep
+		std::lock_guard<std::mutex> lock(s.sleepMutex);
+	}
+	s.wake.notify_one();
+}
+
+// The newest job on our own deque, or the oldest one on anybody else's
+JobHandle findJob(Scheduler& s)
+{
+	const int own = ownQueue(s);
+	const int queueCount = s.workerCount + 1;
+	for(int i = 0; i < queueCount; i++)
+	{
+		int index = (own + i) % queueCount;
+		WorkQueue& queue = s.queues[index];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if(queue.jobs.empty())
+		{
+			continue;
+		}
+		JobHandle job;
+		if(index == own && workerIndex >= 0)
+		{
+			job = std::move(queue.jobs.back());
+			queue.jobs.pop_back();
+		}
+		else
+		{
+			job = std::move(queue.jobs.front());
+			queue.jobs.pop_front();
+		}
+		s.queued--;
+		return job;
+	}
+	return JobHandle();
+}
+
+void run(Scheduler& s, const JobHandle& job)
+{
+	{
+		perf::ThreadScope scope(job->name);
+		job->work();
+	}
+	// Let go of whatever the work captured
+	job->work = nullptr;
+
+	std::vector<JobHandle> continuations;
+	{
+		std::lock_guard<std::mutex> lock(job->mutex);
+		job->done = true;
+		continuations.swap(job->continuations);
+	}
+	job->finished.notify_all();
+
+	for(const JobHandle& continuation : continuations)
+	{
+		if(--continuation->unfinishedDependencies == 0)
+		{
+			schedule(s, continuation);
+		}
+	}
+}
+
+void workerLoop(Scheduler* s, int index)
+{
+	workerIndex = index;
+	perf::setThreadName("Worker " + std::to_string(index));
+	for(;;)
+	{
+		JobHandle job = findJob(*s);
+		if(job)
+		{
+			run(*s, job);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(s->sleepMutex);
+		s->wake.wait(lock, [s]() { return s->stopping || s->queued > 0; });
+		if(s->stopping && s->queued <= 0)
+		{
+			return;
+		}
+	}
+}
+} // namespace
+
+void init(int count, bool pinThreads)
+{
+	std::lock_guard<std::mutex> lock(schedulerMutex);
+	if(scheduler.load() != nullptr)
+	{
+		return;
+	}
+
+	const int hardwareThreads = std::max(1, int(std::thread::hardware_concurrency()));
+	if(count < 0)
+	{
+		count = hardwareThreads - 1;
+	}
+	// Without a worker, jobs would only ever run inside wait()
+	count = std::max(1, count);
+
+	Scheduler* s = new Scheduler;
+	s->queues.reset(new WorkQueue[count + 1]);
+	s->workerCount = count;
+	s->queued = 0;
+	s->stopping = false;
+	for(int i = 0; i < count; i++)
+	{
+		s->workers.push_back(std::thread(workerLoop, s, i));
+		if(pinThreads)
+		{
+			pinToCore(s->workers.back(), (i + 1) % hardwareThreads);
+		}
+	}
+	scheduler.store(s, std::memory_order_release);
+}
+
+void shutDown()
+{
+	std::lock_guard<std::mutex> lock(schedulerMutex);
+	Scheduler* s = scheduler.load();
+	if(s == nullptr)
+	{
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> sleepLock(s->sleepMutex);
+		s->stopping = true;
+	}
+	s->wake.notify_all();
+	for(auto& worker : s->workers)
+	{
+		worker.join();
+	}
+	scheduler.store(nullptr);
+	delete s;
+}
+
+int workerCount()
+{
+	return getScheduler().workerCount;
+}
+
+JobHandle submit(const std::string& name, std::function<void()> work, const std::vector<JobHandle>& dependencies)
+{
+	Scheduler& s = getScheduler();
+
+	JobHandle job = std::make_shared<Job>();
+	job->name = name;
+	job->work = std::move(work);
+	job->unfinishedDependencies = 1;
+	job->done = false;
+
+	for(const JobHandle& dependency : dependencies)
+	{
+		if(!dependency)
+		{
+			continue;
+		}
+		std::lock_guard<std::mutex> lock(dependency->mutex);
+		if(!dependency->done)
+		{
+			job->unfinishedDependencies++;
+			dependency->continuations.push_back(job);
+		}
+	}
+
+	if(--job->unfinishedDependencies == 0)
+	{
+		schedule(s, job);
+	}
+	return job;
+}
+
+JobHandle then(const JobHandle& job, const std::string& name, std::function<void()> work)
+{
+	return submit(name, std::move(work), std::vector<JobHandle>(1, job));
+}
+
+bool isDone(const JobHandle& job)
+{
+	std::lock_guard<std::mutex> lock(job->mutex);
+	return job->done;
+}
+
+void wait(const JobHandle& job)
+{
+	Scheduler& s = getScheduler();
+	while(!isDone(job))
+	{
+		JobHandle other = findJob(s);
+		if(other)
+		{
+			run(s, other);
+			continue;
+		}
+		// Nothing to help with, so it's running somewhere. Check back for new work now and then.
+		std::unique_lock<std::mutex> lock(job->mutex);
+		job->finished.wait_for(lock, std::chrono::milliseconds(1), [&job]() { return job->done; });
+	}
+}
+
+void wait(const std::vector<JobHandle>& jobs)
+{
+	for(const JobHandle& job : jobs)
+	{
+		wait(job);
+	}
+}
+
+void parallelFor(const std::string& name, int count, int grainSize, const std::function<void(int, int)>& body)
+{
+	if(count <= 0)
+	{
+		return;
+	}
+	Scheduler& s = getScheduler();
+	if(grainSize <= 0)
+	{
+		// A few chunks per thread, so a slow one doesn't hold up the rest
+		grainSize = std::max(1, count / ((s.workerCount + 1) * 4));
+	}
+	const int chunks = (count + grainSize - 1) / grainSize;
+
+	// Everyone takes chunks off the counter until there are none left. The
+	// locals outlive the helpers, they are all waited for below.
+	std::atomic<int> nextChunk(0);
+	auto runChunks = [&nextChunk, &body, count, grainSize, chunks]() {
+		for(int chunk = nextChunk++; chunk < chunks; chunk = nextChunk++)
+		{
+			int begin = chunk * grainSize;
+			body(begin, std::min(count, begin + grainSize));
+		}
+	};
+
+	std::vector<JobHandle> helpers;
+	const int helperCount = std::min(chunks - 1, s.workerCount);
+	for(int i = 0; i < helperCount; i++)
+	{
+		helpers.push_back(submit(name, runChunks));
+	}
+	{
+		perf::ThreadScope scope(name);
+		runChunks();
+	}
+	wait(helpers);
+}
+} // namespace jobs
+} // namespace labhelper
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+/** Work-stealing job system.
+ *
+ * A fixed pool of workers, each with its own deque: a worker pushes the jobs
+ * it submits onto its own deque and pops from the same end, so related work
+ * stays hot in its cache, while idle workers steal from the other end of
+ * everyone else's. Jobs submitted from other threads go to a shared queue.
+ * A job may depend on others and only becomes runnable once they are all
+ * done, which is also how continuations are expressed. Every job is timed
+ * with a perf::ThreadScope under its name, so it shows up in the events
+ * window on the thread that ran it.
+ *
+ * Threads that wait for a job run other jobs in the meantime, so waiting
+ * from inside a job (e.g. a nested parallelFor) can't deadlock the pool.
+ */
+namespace labhelper
+{
+namespace jobs
+{
+struct Job;
+typedef std::shared_ptr<Job> JobHandle;
+
+/**
+	* Starts 'workerCount' workers, one per hardware thread but the calling
+	* one if negative. Optional: the first job starts the default pool. With
+	* 'pinThreads', worker i is kept on core i + 1, leaving core 0 to the
+	* thread that owns the GL context.
+	*/
+void init(int workerCount = -1, bool pinThreads = false);
+
+/**
+	* Runs what is still queued, then stops the workers.
+	*/
+void shutDown();
+
+int workerCount();
+
+/**
+	* Queues 'work' to run once every job in 'dependencies' is done. Empty
+	* handles in 'dependencies' are ignored.
+	*/
+JobHandle submit(const std::string& name,
+                 std::function<void()> work,
+                 const std::vector<JobHandle>& dependencies = std::vector<JobHandle>());
+
+/**
+	* Continuation, short for submit() with 'job' as the only dependency.
+	*/
+JobHandle then(const JobHandle& job, const std::string& name, std::function<void()> work);
+
+bool isDone(const JobHandle& job);
+
+/**
+	* Blocks until 'job' is done, running other jobs while it waits.
+	*/
+void wait(const JobHandle& job);
+void wait(const std::vector<JobHandle>& jobs);
+
+/**
+	* Calls body(begin, end) over [0, count) in chunks of 'grainSize' (picked
+	* from the pool size if <= 0), on the workers and the calling thread, and
+	* returns when all chunks are done. Chunks are handed out dynamically, so
+	* uneven work balances itself.
+	*/
+void parallelFor(const std::string& name, int count, int grainSize, const std::function<void(int, int)>& body);
+} // namespace jobs
+} // namespace labhelper
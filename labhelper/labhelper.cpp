@@ -18,6 +18,9 @@
 #include <stb_image_write.h>
 
 #include "labhelper.h"
+#include "filewatch.h"
+#include "programcache.h"
+#include "jobs.h"
 
 #include <cmath>
 #include <cstring>
@@ -27,10 +30,12 @@
 #include <sstream>
 #include <iostream>
 #include <algorithm>
+#include <atomic>
 
 #include <string>
 #include <fstream>
 #include <streambuf>
+#include <filesystem>
 #include <glm/gtx/transform.hpp>
 #include <glm/glm.hpp>
 #include <imgui.h>
@@ -45,6 +50,7 @@ namespace labhelper
 {
 
 static bool s_show_gui = true;
+static FileWatcher s_shader_watcher;
 
 
 SDL_Window* init_window_SDL(std::string caption, int width, int height)
@@ -58,11 +64,14 @@ SDL_Window* init_window_SDL(std::string caption, int width, int height)
 	atexit(SDL_Quit);
 	SDL_GL_LoadLibrary(nullptr); // Default OpenGL is fine.
 
-	// Request an OpenGL 4.1 context (should be core)
+	// Request an OpenGL 4.3 context (should be core), the compute shaders need it
 	SDL_GL_SetAttribute(SDL_GL_ACCELERATED_VISUAL, 1);
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
-	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 1);
-	SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_DEBUG_FLAG);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+	if(getGLDebugLevel() != GLDebugLevel::Off)
+	{
+		SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_DEBUG_FLAG);
+	}
 
 #ifdef HDR_FRAMEBUFFER
 	SDL_GL_SetAttribute(SDL_GL_RED_SIZE, 16);
@@ -131,6 +140,7 @@ void newFrame( SDL_Window* window )
 
 void finishFrame()
 {
+	drainGLDebugMessages();
 	glBindFramebuffer( GL_FRAMEBUFFER, 0 );
 	if ( s_show_gui )
 	{
@@ -168,6 +178,8 @@ void processEvent( const SDL_Event* event )
 
 void shutDown(SDL_Window* window)
 {
+	jobs::shutDown();
+
 	// If newframe is not ever run before shut down we crash
 	ImGui_ImplSDL2_NewFrame( window );
 
@@ -305,16 +317,103 @@ namespace
 #define CALLBACK_
 #endif // ~ platform
 
-	/* Callback function. This function is called by GL whenever it generates
-		 * a debug message.
+	// A debug message as the callback got it, until drainGLDebugMessages() prints it
+	struct DebugMessage
+	{
+		GLenum source;
+		GLenum type;
+		GLuint id;
+		GLenum severity;
+		char text[512];
+	};
+
+	/* Bounded multi-producer, single-consumer queue. Drivers may call back
+		 * from their own threads, several at once, and must never block on
+		 * the GL thread. Each slot's sequence number says whether it is free
+		 * to write (== write position) or ready to read (== read position + 1).
 		 */
-	GLvoid CALLBACK_ handle_debug_message_(GLenum aSource,
-	                                       GLenum aType,
-	                                       GLuint aId,
-	                                       GLenum aSeverity,
-	                                       GLsizei /*aLength*/,
-	                                       GLchar const* aMessage,
-	                                       GLvoid* /*aUser*/)
+	class DebugMessageRing
+	{
+	public:
+		DebugMessageRing() : head(0), tail(0)
+		{
+			for(size_t i = 0; i < CAPACITY; i++)
+			{
+				slots[i].sequence.store(i, std::memory_order_relaxed);
+			}
+		}
+
+		// False if the queue is full
+		bool push(const DebugMessage& message)
+		{
+			size_t position = head.load(std::memory_order_relaxed);
+			for(;;)
+			{
+				Slot& slot = slots[position % CAPACITY];
+				size_t sequence = slot.sequence.load(std::memory_order_acquire);
+				if(sequence == position)
+				{
+					if(head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					{
+						slot.message = message;
+						slot.sequence.store(position + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if(sequence < position)
+				{
+					return false;
+				}
+				else
+				{
+					position = head.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		// Only ever called from one thread
+		bool pop(DebugMessage& message)
+		{
+			size_t position = tail.load(std::memory_order_relaxed);
+			Slot& slot = slots[position % CAPACITY];
+			if(slot.sequence.load(std::memory_order_acquire) != position + 1)
+			{
+				return false;
+			}
+			message = slot.message;
+			slot.sequence.store(position + CAPACITY, std::memory_order_release);
+			tail.store(position + 1, std::memory_order_relaxed);
+			return true;
+		}
+
+	private:
+		static const size_t CAPACITY = 256;
+		struct Slot
+		{
+			std::atomic<size_t> sequence;
+			DebugMessage message;
+		};
+		Slot slots[CAPACITY];
+		std::atomic<size_t> head;
+		std::atomic<size_t> tail;
+	};
+
+#ifdef NDEBUG
+	std::atomic<GLDebugLevel> s_debug_level(GLDebugLevel::Off);
+#else
+	std::atomic<GLDebugLevel> s_debug_level(GLDebugLevel::Async);
+#endif
+	bool s_debug_output_supported = false; // Set up by setupGLDebugMessages()
+	DebugMessageRing s_debug_messages;
+	std::atomic<uint64_t> s_debug_errors(0);
+	std::atomic<uint64_t> s_debug_performance(0);
+	std::atomic<uint64_t> s_debug_other(0);
+	std::atomic<uint64_t> s_debug_dropped(0);
+
+	/* Prints a debug message, and breaks if it's a bad one. Called inside the
+		 * GL call in synchronous mode, from drainGLDebugMessages() otherwise.
+		 */
+	void report_debug_message_(GLenum aSource, GLenum aType, GLuint aId, GLenum aSeverity, GLchar const* aMessage)
 	{
 		// source string
 		const char* srcStr = nullptr;
@@ -390,28 +489,24 @@ namespace
 			sevStr = "UNKNOWN";
 		}
 
-		// output message, if not just notification
-		if(aSeverity != GL_DEBUG_SEVERITY_NOTIFICATION)
-		{
-			std::stringstream szs;
-			szs << "\n"
-			    << "--\n"
-			    << "-- GL DEBUG MESSAGE:\n"
-			    << "--   severity = '" << sevStr << "'\n"
-			    << "--   type     = '" << typeStr << "'\n"
-			    << "--   source   = '" << srcStr << "'\n"
-			    << "--   id       = " << std::hex << aId << "\n"
-			    << "-- message:\n"
-			    << aMessage << "\n"
-			    << "--\n"
-			    << "\n";
-
-			fprintf(stderr, "%s", szs.str().c_str());
-			fflush(stderr);
+		std::stringstream szs;
+		szs << "\n"
+		    << "--\n"
+		    << "-- GL DEBUG MESSAGE:\n"
+		    << "--   severity = '" << sevStr << "'\n"
+		    << "--   type     = '" << typeStr << "'\n"
+		    << "--   source   = '" << srcStr << "'\n"
+		    << "--   id       = " << std::hex << aId << "\n"
+		    << "-- message:\n"
+		    << aMessage << "\n"
+		    << "--\n"
+		    << "\n";
+
+		fprintf(stderr, "%s", szs.str().c_str());
+		fflush(stderr);
 #if defined(_WIN32)
-			OutputDebugStringA(szs.str().c_str());
+		OutputDebugStringA(szs.str().c_str());
 #endif
-		}
 
 		// Additionally: if it's (really) bad -> break!
 		if(aSeverity == GL_DEBUG_SEVERITY_HIGH)
@@ -425,6 +520,81 @@ namespace
 		}
 	}
 
+	/* Callback function. This function is called by GL whenever it generates
+		 * a debug message, possibly from another thread unless the output is
+		 * synchronous.
+		 */
+	GLvoid CALLBACK_ handle_debug_message_(GLenum aSource,
+	                                       GLenum aType,
+	                                       GLuint aId,
+	                                       GLenum aSeverity,
+	                                       GLsizei /*aLength*/,
+	                                       GLchar const* aMessage,
+	                                       GLvoid* /*aUser*/)
+	{
+		// Performance warnings are too many to print, they're counted for the GUI
+		if(aType == GL_DEBUG_TYPE_PERFORMANCE)
+		{
+			s_debug_performance++;
+			return;
+		}
+		if(aSeverity == GL_DEBUG_SEVERITY_NOTIFICATION)
+		{
+			return;
+		}
+		if(aType == GL_DEBUG_TYPE_ERROR)
+		{
+			s_debug_errors++;
+		}
+		else
+		{
+			s_debug_other++;
+		}
+
+		if(s_debug_level.load(std::memory_order_relaxed) == GLDebugLevel::Synchronous)
+		{
+			report_debug_message_(aSource, aType, aId, aSeverity, aMessage);
+			return;
+		}
+
+		DebugMessage message;
+		message.source = aSource;
+		message.type = aType;
+		message.id = aId;
+		message.severity = aSeverity;
+		strncpy(message.text, aMessage, sizeof(message.text) - 1);
+		message.text[sizeof(message.text) - 1] = '\0';
+		if(!s_debug_messages.push(message))
+		{
+			s_debug_dropped++;
+		}
+	}
+
+	void apply_debug_level_()
+	{
+		if(!s_debug_output_supported)
+		{
+			return;
+		}
+		GLDebugLevel level = s_debug_level.load();
+		if(level == GLDebugLevel::Off)
+		{
+			glDisable(GL_DEBUG_OUTPUT);
+		}
+		else
+		{
+			glEnable(GL_DEBUG_OUTPUT);
+		}
+		if(level == GLDebugLevel::Synchronous)
+		{
+			glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+		}
+		else
+		{
+			glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+		}
+	}
+
 	// cleanup macros
 #undef CALLBACK_
 } // namespace
@@ -453,24 +623,22 @@ void setupGLDebugMessages()
 		 */
 	glDebugMessageCallback((GLDEBUGPROC)handle_debug_message_, 0);
 	glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, 0, true);
-	glDebugMessageControl(GL_DONT_CARE, GL_DEBUG_TYPE_PERFORMANCE, GL_DONT_CARE, 0, 0, false);
-
-	/* Enable synchronous debug output; this causes the callback to be called
-		 * immediately on error, usually in the actual gl-function where the error
-		 * occurred. (So, your stack trace is actually useful).
-		 *
-		 * This comes at a performance cost, so for performance sensitive stuff,
-		 * it might not be a good idea to unconditionally enable this. For the
-		 * labs, we just enable it, however.
-		 */
-	glEnable(GL_DEBUG_OUTPUT);
-	glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
 
 	/* Debug output can be somewhat spammy, especially if all messages are
 		 * enabled. For now, disable the lowest level of messages, which mostly
-		 * contain performance-related information and other random notes.
+		 * contain random notes. Performance warnings are kept at every level,
+		 * the callback only counts them.
 		 */
 	glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_LOW, 0, 0, false);
+	glDebugMessageControl(GL_DONT_CARE, GL_DEBUG_TYPE_PERFORMANCE, GL_DONT_CARE, 0, 0, true);
+
+	/* Synchronous debug output calls the callback immediately on error,
+		 * usually in the actual gl-function where the error occurred (so your
+		 * stack trace is actually useful), but it serializes the driver. See
+		 * setGLDebugLevel().
+		 */
+	s_debug_output_supported = true;
+	apply_debug_level_();
 
 	/* Now, check if enabling debug messages caused a GL error. If so, that
 		 * error might not be reported by the debug message mechanism (after all,
@@ -480,6 +648,36 @@ void setupGLDebugMessages()
 	CHECK_GL_ERROR();
 }
 
+void setGLDebugLevel(GLDebugLevel level)
+{
+	s_debug_level.store(level);
+	apply_debug_level_();
+}
+
+GLDebugLevel getGLDebugLevel()
+{
+	return s_debug_level.load();
+}
+
+void drainGLDebugMessages()
+{
+	DebugMessage message;
+	while(s_debug_messages.pop(message))
+	{
+		report_debug_message_(message.source, message.type, message.id, message.severity, message.text);
+	}
+}
+
+GLDebugMessageCounts getGLDebugMessageCounts()
+{
+	GLDebugMessageCounts counts;
+	counts.errors = s_debug_errors.load();
+	counts.performance = s_debug_performance.load();
+	counts.other = s_debug_other.load();
+	counts.dropped = s_debug_dropped.load();
+	return counts;
+}
+
 // Error reporting
 void fatal_error(std::string errorString, std::string title)
 {
@@ -560,16 +758,117 @@ std::string GetShaderProgramInfoLog(GLuint obj)
 
 
 
+// Appends a shader source file to 'source', expanding #include "file" (relative
+// to the including file, each file included once) and watching every file read.
+// #line directives number the files by their position in 'files'.
+static void expandShaderSource(const std::string& path,
+                               const ShaderDefines& defines,
+                               std::vector<std::string>& files,
+                               std::string& source)
+{
+	const int fileIndex = int(files.size());
+	files.push_back(path);
+	s_shader_watcher.add(path);
+
+	std::ifstream file(path);
+	std::string line;
+	int lineNumber = 0;
+	while(std::getline(file, line))
+	{
+		lineNumber++;
+		size_t start = line.find_first_not_of(" \t");
+		if(start != std::string::npos && line.compare(start, 8, "#include") == 0)
+		{
+			size_t open = line.find('"', start);
+			size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+			if(close == std::string::npos)
+			{
+				source += "#error malformed #include\n";
+				continue;
+			}
+			std::filesystem::path includePath = std::filesystem::path(path).parent_path()
+			                                    / line.substr(open + 1, close - open - 1);
+			std::string name = includePath.lexically_normal().string();
+			if(std::find(files.begin(), files.end(), name) != files.end())
+			{
+				source += "\n";
+				continue;
+			}
+			if(!std::ifstream(name))
+			{
+				source += "#error cannot open include " + line.substr(open) + "\n";
+				continue;
+			}
+			source += "#line 1 " + std::to_string(files.size()) + "\n";
+			expandShaderSource(name, ShaderDefines(), files, source);
+			source += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(fileIndex) + "\n";
+			continue;
+		}
+
+		source += line;
+		source += '\n';
+
+		// Injected defines have to come after #version, which must come first
+		if(start != std::string::npos && line.compare(start, 8, "#version") == 0 && !defines.empty())
+		{
+			for(const auto& define : defines)
+			{
+				source += "#define " + define.first + " " + define.second + "\n";
+			}
+			source += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(fileIndex) + "\n";
+		}
+	}
+}
+
+// Lists what the source string numbers in compiler messages refer to
+static std::string shaderFileTable(const std::vector<std::string>& files)
+{
+	std::string table;
+	if(files.size() > 1)
+	{
+		table = "Source files:\n";
+		for(size_t i = 0; i < files.size(); i++)
+		{
+			table += "  " + std::to_string(i) + ": " + files[i] + "\n";
+		}
+	}
+	return table;
+}
+
+bool shaderSourcesChanged()
+{
+	return s_shader_watcher.poll();
+}
+
+void setShaderCacheDirectory(const std::string& directory)
+{
+	programcache::setDirectory(directory);
+}
+
 GLuint loadShaderProgram(const std::string& vertexShader, const std::string& fragmentShader, bool allow_errors)
 {
-	GLuint vShader = glCreateShader(GL_VERTEX_SHADER);
-	GLuint fShader = glCreateShader(GL_FRAGMENT_SHADER);
+	return loadShaderProgram(vertexShader, fragmentShader, ShaderDefines(), allow_errors);
+}
 
-	std::ifstream vs_file(vertexShader);
-	std::string vs_src((std::istreambuf_iterator<char>(vs_file)), std::istreambuf_iterator<char>());
+GLuint loadShaderProgram(const std::string& vertexShader,
+                         const std::string& fragmentShader,
+                         const ShaderDefines& defines,
+                         bool allow_errors)
+{
+	std::vector<std::string> vs_files, fs_files;
+	std::string vs_src, fs_src;
+	expandShaderSource(vertexShader, defines, vs_files, vs_src);
+	expandShaderSource(fragmentShader, defines, fs_files, fs_src);
+
+	std::string cacheKey = programcache::key({ { GL_VERTEX_SHADER, vs_src }, { GL_FRAGMENT_SHADER, fs_src } });
+	GLuint cachedProgram = programcache::load(cacheKey);
+	if(cachedProgram != 0)
+	{
+		return cachedProgram;
+	}
 
-	std::ifstream fs_file(fragmentShader);
-	std::string fs_src((std::istreambuf_iterator<char>(fs_file)), std::istreambuf_iterator<char>());
+	GLuint vShader = glCreateShader(GL_VERTEX_SHADER);
+	GLuint fShader = glCreateShader(GL_FRAGMENT_SHADER);
 
 	const char* vs = vs_src.c_str();
 	const char* fs = fs_src.c_str();
@@ -583,7 +882,7 @@ GLuint loadShaderProgram(const std::string& vertexShader, const std::string& fra
 	glGetShaderiv(vShader, GL_COMPILE_STATUS, &compileOk);
 	if(!compileOk)
 	{
-		std::string err = GetShaderInfoLog(vShader);
+		std::string err = GetShaderInfoLog(vShader) + shaderFileTable(vs_files);
 		if(allow_errors)
 		{
 			non_fatal_error(err, "Vertex Shader");
@@ -599,7 +898,7 @@ GLuint loadShaderProgram(const std::string& vertexShader, const std::string& fra
 	glGetShaderiv(fShader, GL_COMPILE_STATUS, &compileOk);
 	if(!compileOk)
 	{
-		std::string err = GetShaderInfoLog(fShader);
+		std::string err = GetShaderInfoLog(fShader) + shaderFileTable(fs_files);
 		if(allow_errors)
 		{
 			non_fatal_error(err, "Fragment Shader");
@@ -619,17 +918,31 @@ GLuint loadShaderProgram(const std::string& vertexShader, const std::string& fra
 	if(!allow_errors)
 		CHECK_GL_ERROR();
 
+	glProgramParameteri(shaderProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	if(!linkShaderProgram(shaderProgram, allow_errors))
 		return 0;
 
+	programcache::store(shaderProgram, cacheKey);
 	return shaderProgram;
 }
 
 GLuint loadComputeShaderProgram(const std::string& computeShader, bool allowErrors) {
-	GLuint cShader = glCreateShader(GL_COMPUTE_SHADER);
+	return loadComputeShaderProgram(computeShader, ShaderDefines(), allowErrors);
+}
 
-	std::ifstream cs_file(computeShader);
-	std::string cs_src((std::istreambuf_iterator<char>(cs_file)), std::istreambuf_iterator<char>());
+GLuint loadComputeShaderProgram(const std::string& computeShader, const ShaderDefines& defines, bool allowErrors) {
+	std::vector<std::string> cs_files;
+	std::string cs_src;
+	expandShaderSource(computeShader, defines, cs_files, cs_src);
+
+	std::string cacheKey = programcache::key({ { GL_COMPUTE_SHADER, cs_src } });
+	GLuint cachedProgram = programcache::load(cacheKey);
+	if(cachedProgram != 0)
+	{
+		return cachedProgram;
+	}
+
+	GLuint cShader = glCreateShader(GL_COMPUTE_SHADER);
 
 	const char* cs = cs_src.c_str();
 
@@ -641,7 +954,7 @@ GLuint loadComputeShaderProgram(const std::string& computeShader, bool allowErro
 	glGetShaderiv(cShader, GL_COMPILE_STATUS, &compileOk);
 	if(!compileOk)
 	{
-		std::string err = GetShaderInfoLog(cShader);
+		std::string err = GetShaderInfoLog(cShader) + shaderFileTable(cs_files);
 		if(allowErrors)
 		{
 			non_fatal_error(err, "Compute Shader");
@@ -659,9 +972,11 @@ GLuint loadComputeShaderProgram(const std::string& computeShader, bool allowErro
 	if(!allowErrors)
 		CHECK_GL_ERROR();
 
+	glProgramParameteri(computeShaderProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	if(!linkShaderProgram(computeShaderProgram, allowErrors))
 		return 0;
 
+	programcache::store(computeShaderProgram, cacheKey);
 	return computeShaderProgram;
 }
 
@@ -724,6 +1039,10 @@ void setUniformSlow(GLuint shaderProgram, const char* name, const GLint value)
 	int loc = glGetUniformLocation(shaderProgram, name);
 	glUniform1i(loc, value);
 }
+void setUniformSlow(GLuint shaderProgram, const char* name, const GLuint value)
+{
+	glUniform1ui(glGetUniformLocation(shaderProgram, name), value);
+}
 void setUniformSlow( GLuint shaderProgram, const char* name, const bool value )
 {
 	int loc = glGetUniformLocation(shaderProgram, name);
@@ -733,14 +1052,26 @@ void setUniformSlow(GLuint shaderProgram, const char* name, const glm::vec3& val
 {
 	glUniform3fv(glGetUniformLocation(shaderProgram, name), 1, &value.x);
 }
+void setUniformSlow(GLuint shaderProgram, const char* name, const glm::vec4& value)
+{
+	glUniform4fv(glGetUniformLocation(shaderProgram, name), 1, &value.x);
+}
 void setUniformSlow(GLuint shaderProgram, const char* name, const glm::vec2& value)
 {
     glUniform2fv(glGetUniformLocation(shaderProgram, name), 1, &value.x);
 }
+void setUniformSlow(GLuint shaderProgram, const char* name, const glm::ivec2& value)
+{
+	glUniform2iv(glGetUniformLocation(shaderProgram, name), 1, &value.x);
+}
 void setUniformSlow(GLuint shaderProgram, const char* name, const uint32_t nof_values, const glm::vec3* values)
 {
 	glUniform3fv(glGetUniformLocation(shaderProgram, name), nof_values, (float*)values);
 }
+void setUniformSlow(GLuint shaderProgram, const char* name, const uint32_t nof_values, const glm::vec4* values)
+{
+	glUniform4fv(glGetUniformLocation(shaderProgram, name), nof_values, (float*)values);
+}
 
 void debugDrawLine(const glm::mat4& viewMatrix,
                    const glm::mat4& projectionMatrix,
@@ -8,7 +8,10 @@
 #include <glm/glm.hpp>
 
 #include <string>
+#include <vector>
+#include <utility>
 #include <cassert>
+#include <cstdint>
 
 #include <SDL.h>
 #undef main
@@ -47,12 +50,19 @@
  *	CHECK_GL_ERROR(); // see if glClearColor() generated an error
  *	glClear(GL_COLOR_BUFFER_BIT);
  *	CHECK_GL_ERROR(); // see if glClear() generated an error
+ *
+ * glGetError() waits for the driver, so with NDEBUG (Release builds) the
+ * check compiles to nothing. Rely on the debug output there instead.
  */
 
+#ifdef NDEBUG
+#define CHECK_GL_ERROR() {}
+#else
 #define CHECK_GL_ERROR()                                                                                     \
 	{                                                                                                        \
 		labhelper::checkGLError(__FILE__, __LINE__) && (__debugbreak(), 1);                                  \
 	}
+#endif
 
 namespace labhelper
 {
@@ -72,10 +82,45 @@ bool checkGLError(const char* file, int line);
 void startupGLDiagnostics();
 
 /**
-	 * Initialize OpenGL debug messages.
+	 * Initialize OpenGL debug messages at the current debug level.
 	 */
 void setupGLDebugMessages();
 
+enum class GLDebugLevel
+{
+	Off,         // No debug output; the context is created without the debug flag
+	Async,       // Queued from the driver's threads, printed by drainGLDebugMessages()
+	Synchronous, // Reported inside the offending GL call, for a useful stack trace
+};
+
+/**
+	 * The debug level can be changed at any time. The level in effect when the
+	 * context is created decides whether it is a debug context; one that
+	 * starts Off may report little once output is turned on. Defaults to Off
+	 * with NDEBUG and Async otherwise.
+	 */
+void setGLDebugLevel(GLDebugLevel level);
+GLDebugLevel getGLDebugLevel();
+
+/**
+	 * Prints the messages queued at GLDebugLevel::Async, once per frame from
+	 * the GL thread. finishFrame() calls it.
+	 */
+void drainGLDebugMessages();
+
+/**
+	 * Messages seen since startup, at any level but Off. Performance warnings
+	 * are only counted, not printed.
+	 */
+struct GLDebugMessageCounts
+{
+	uint64_t errors;
+	uint64_t performance;
+	uint64_t other;
+	uint64_t dropped; // Lost to a full queue
+};
+GLDebugMessageCounts getGLDebugMessageCounts();
+
 /**
 	 * Error reporting function
 	 */
@@ -87,6 +132,27 @@ void non_fatal_error(std::string errorString, std::string title = std::string())
 	*/
 SDL_Window* init_window_SDL(std::string caption, int width = 1280, int height = 720);
 
+enum class HeadlessBackend
+{
+	Auto, // EGL, then OSMesa
+	EGL,
+	OSMesa
+};
+
+/**
+	* Initialize an OpenGL 4.3 core context without a window, for CI and batch
+	* runs. EGL gives a surfaceless context (on llvmpipe where there is no GPU),
+	* OSMesa one on software Mesa. There is no default framebuffer and no vsync;
+	* render into FboInfo targets. The backends are the ones found at build
+	* time. Returns false if none of them made a context.
+	*/
+bool init_headless_context(HeadlessBackend backend = HeadlessBackend::Auto);
+
+// The backend init_headless_context() settled on, nullptr without one
+const char* headlessBackendName();
+
+void shutDownHeadless();
+
 /**
 	* Updates things for the new frame to begin
 	*/
@@ -129,14 +195,31 @@ GLuint loadCubeMap(const char* facePosX,
 	 */
 std::string GetShaderInfoLog(GLuint obj);
 
+/**
+	 * (name, value) pairs injected as #defines right after a shader's #version line
+	 */
+typedef std::vector<std::pair<std::string, std::string>> ShaderDefines;
+
 /**
 	 * Loads and compiles a fragment and vertex shader. Then creates a shader program
 	 * and attaches the shaders. Does NOT link the program, this is done with  linkShaderProgram()
 	 * The reason for this is that before linking we need to bind attribute locations, using
 	 * glBindAttribLocation and fragment data lications, using glBindFragDataLocation.
+	 *
+	 * Sources may #include "file" relative to the including file, each file is
+	 * included at most once. Compiler messages refer to files by number, the
+	 * error report lists which is which. The same goes for compute shaders.
+	 */
+GLuint loadShaderProgram(const std::string& vertexShader,
+                         const std::string& fragmentShader,
+                         bool allow_errors = false);
+
+/**
+	 * As above, with 'defines' injected into both stages
 	 */
 GLuint loadShaderProgram(const std::string& vertexShader,
                          const std::string& fragmentShader,
+                         const ShaderDefines& defines,
                          bool allow_errors = false);
 
 /**
@@ -144,6 +227,29 @@ GLuint loadShaderProgram(const std::string& vertexShader,
 	 * and attaches the shader. Does NOT link the program, this is done with  linkShaderProgram()
 	 */
 GLuint loadComputeShaderProgram(const std::string& computeShader, bool allowErrors = false);
+
+/**
+	 * As above, compiling the permutation selected by 'defines', e.g. a kernel
+	 * type or workgroup size. See also ShaderPermutations.
+	 */
+GLuint loadComputeShaderProgram(const std::string& computeShader,
+                                const ShaderDefines& defines,
+                                bool allowErrors = false);
+
+/**
+	 * Every source file read by the shader loaders is watched. Returns true
+	 * once after any of them changed on disk, e.g. to call the loaders again
+	 * with allow_errors set.
+	 */
+bool shaderSourcesChanged();
+
+/**
+	 * Linked programs are cached as binaries in this directory and loaded from
+	 * there when the sources and driver are unchanged. Empty (the default)
+	 * disables the cache.
+	 */
+void setShaderCacheDirectory(const std::string& directory);
+
 /**
 	 * Call to link a shader program prevoiusly loaded using loadShaderProgram.
 	 */
@@ -172,9 +278,14 @@ GLuint createAddAttribBuffer(GLuint vertexArrayObject,
 void setUniformSlow(GLuint shaderProgram, const char* name, const glm::mat4& matrix);
 void setUniformSlow(GLuint shaderProgram, const char* name, const float value);
 void setUniformSlow(GLuint shaderProgram, const char* name, const GLint value);
+void setUniformSlow(GLuint shaderProgram, const char* name, const GLuint value);
 void setUniformSlow(GLuint shaderProgram, const char* name, const bool value);
 void setUniformSlow(GLuint shaderProgram, const char* name, const glm::vec3& value);
+void setUniformSlow(GLuint shaderProgram, const char* name, const glm::vec4& value);
+void setUniformSlow(GLuint shaderProgram, const char* name, const glm::vec2& value);
+void setUniformSlow(GLuint shaderProgram, const char* name, const glm::ivec2& value);
 void setUniformSlow(GLuint shaderProgram, const char* name, const uint32_t nof_values, const glm::vec3* values);
+void setUniformSlow(GLuint shaderProgram, const char* name, const uint32_t nof_values, const glm::vec4* values);
 
 /**
 	* Helper to draw a single quad (two triangles) that cover the entire screen
@@ -12,6 +12,7 @@
 #include <algorithm>
 
 #include <any>
+#include <mutex>
 
 #include <GL/glew.h>
 
@@ -80,6 +81,21 @@ std::unordered_map<std::string, std::vector<time_event_durations_t>> time_record
 
 timestamp_t last_frame_time = {};
 
+// Recorded by ThreadScope, from any thread
+struct thread_event_t
+{
+	std::string thread;
+	std::string name;
+	timestamp_t start;
+	duration_t duration;
+};
+
+std::mutex thread_events_mutex;
+std::vector<thread_event_t> thread_events;
+// Nobody collects them without the events window, don't grow forever then
+const size_t max_thread_events = 1 << 16;
+thread_local std::string thread_name = "Thread";
+
 
 timestamp_t getTimestamp() { return std::chrono::high_resolution_clock::now(); }
 
@@ -158,6 +174,26 @@ Scope::~Scope()
 	popTimer();
 }
 
+void setThreadName( const std::string& name )
+{
+	thread_name = name;
+}
+
+ThreadScope::ThreadScope( const std::string& name ) : name( name ), start( getTimestamp() )
+{
+}
+
+ThreadScope::~ThreadScope()
+{
+	timestamp_t start_time = std::chrono::time_point_cast<duration_t>( start );
+	duration_t duration = getTimestamp() - start_time;
+	std::lock_guard<std::mutex> lock( thread_events_mutex );
+	if ( thread_events.size() < max_thread_events )
+	{
+		thread_events.push_back( thread_event_t{ thread_name, name, start_time, duration } );
+	}
+}
+
 namespace
 {
 struct
@@ -290,6 +326,49 @@ std::string printf_events()
 }
 #endif
 
+// Adds the ThreadScope events since the last frame as one "Threads" event,
+// with a child per thread and a grandchild per event name
+void collect_thread_events()
+{
+	std::vector<thread_event_t> collected;
+	{
+		std::lock_guard<std::mutex> lock( thread_events_mutex );
+		collected.swap( thread_events );
+	}
+	if ( collected.empty() )
+	{
+		return;
+	}
+
+	const auto find_child = []( time_event_t& parent, const std::string& name, timestamp_t start ) -> time_event_t& {
+		for ( auto& c : parent.children )
+		{
+			if ( c.name == name )
+			{
+				c.start = std::min( c.start, start );
+				return c;
+			}
+		}
+		parent.children.push_back( time_event_t{} );
+		parent.children.back().name = name;
+		parent.children.back().start = start;
+		return parent.children.back();
+	};
+
+	time_event_t threads{};
+	threads.name = "Threads";
+	threads.start = collected[0].start;
+	for ( const auto& te : collected )
+	{
+		threads.start = std::min( threads.start, te.start );
+		threads.duration.cpu += te.duration;
+		time_event_t& thread = find_child( threads, te.thread, te.start );
+		thread.duration.cpu += te.duration;
+		find_child( thread, te.name, te.start ).duration.cpu += te.duration;
+	}
+	events.push_back( std::move( threads ) );
+}
+
 void record_events()
 {
 	const auto record_rec = [&]( const time_event_t& e )
@@ -330,6 +409,8 @@ void drawEventsWindow()
 	cuda::sync();
 	gl::sync();
 	cpu::sync();
+	// After the syncs, these have no GPU timings to resolve
+	collect_thread_events();
 
 	std::sort( events.begin(), events.end(), []( const time_event_t& a, const time_event_t& b ) -> bool {
 		return a.start < b.start;
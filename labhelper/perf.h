@@ -28,6 +28,30 @@ private:
 	Scope& operator=( Scope&& ) = delete;
 };
 
+/**
+	* Names the calling thread in the events window, see ThreadScope.
+	*/
+void setThreadName( const std::string& name );
+
+/**
+	* CPU-only timer that may be used from any thread, e.g. for jobs. Each
+	* thread gets a row under "Threads" in the events window, with the time of
+	* all its events of the same name summed over the frame.
+	*/
+struct ThreadScope
+{
+public:
+	ThreadScope( const std::string& name );
+	~ThreadScope();
+
+private:
+	std::string name;
+	std::chrono::high_resolution_clock::time_point start;
+
+	ThreadScope( const ThreadScope& ) = delete;
+	ThreadScope& operator=( const ThreadScope& ) = delete;
+};
+
 }
 }   // namespace chag::perf
 
@@ -0,0 +1,155 @@
+#include "programcache.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <system_error>
+
+namespace labhelper
+{
+namespace programcache
+{
+namespace
+{
+std::string cacheDirectory;
+
+const char MAGIC[4] = { 'L', 'H', 'P', 'B' };
+
+uint64_t fnv1a(uint64_t hash, const void* data, size_t size)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+	for(size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+uint64_t fnv1a(uint64_t hash, const std::string& s)
+{
+	// The terminator separates consecutive strings
+	return fnv1a(hash, s.c_str(), s.size() + 1);
+}
+
+std::string glString(GLenum name)
+{
+	const GLubyte* s = glGetString(name);
+	return s ? std::string((const char*)s) : std::string();
+}
+
+std::string entryPath(const std::string& key)
+{
+	return (std::filesystem::path(cacheDirectory) / (key + ".bin")).string();
+}
+} // namespace
+
+void setDirectory(const std::string& directory)
+{
+	cacheDirectory = directory;
+}
+
+bool isEnabled()
+{
+	if(cacheDirectory.empty())
+	{
+		return false;
+	}
+	// Some drivers support the API but no formats
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	return formats > 0;
+}
+
+std::string key(const std::vector<std::pair<GLenum, std::string>>& sources)
+{
+	uint64_t hash = 14695981039346656037ull;
+	hash = fnv1a(hash, glString(GL_VENDOR));
+	hash = fnv1a(hash, glString(GL_RENDERER));
+	hash = fnv1a(hash, glString(GL_VERSION));
+	for(const auto& source : sources)
+	{
+		hash = fnv1a(hash, &source.first, sizeof(source.first));
+		hash = fnv1a(hash, source.second);
+	}
+	char name[17];
+	snprintf(name, sizeof(name), "%016llx", (unsigned long long)hash);
+	return name;
+}
+
+GLuint load(const std::string& key)
+{
+	if(!isEnabled())
+	{
+		return 0;
+	}
+	std::ifstream file(entryPath(key), std::ios::binary);
+	if(!file)
+	{
+		return 0;
+	}
+	std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	const size_t headerSize = sizeof(MAGIC) + sizeof(GLenum);
+	if(data.size() <= headerSize || !std::equal(MAGIC, MAGIC + sizeof(MAGIC), data.begin()))
+	{
+		return 0;
+	}
+	GLenum format;
+	memcpy(&format, data.data() + sizeof(MAGIC), sizeof(format));
+
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, format, data.data() + headerSize, GLsizei(data.size() - headerSize));
+	GLint linkOk = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &linkOk);
+	if(!linkOk)
+	{
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+void store(GLuint program, const std::string& key)
+{
+	if(!isEnabled())
+	{
+		return;
+	}
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if(length <= 0)
+	{
+		return;
+	}
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, &length, &format, binary.data());
+
+	std::error_code error;
+	std::filesystem::create_directories(cacheDirectory, error);
+
+	// Written aside and renamed, so another instance never reads half an entry
+	std::string path = entryPath(key);
+	std::string temporaryPath = path + ".tmp";
+	{
+		std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+		if(!file)
+		{
+			return;
+		}
+		file.write(MAGIC, sizeof(MAGIC));
+		file.write((const char*)&format, sizeof(format));
+		file.write(binary.data(), length);
+		if(!file)
+		{
+			return;
+		}
+	}
+	std::filesystem::rename(temporaryPath, path, error);
+}
+} // namespace programcache
+} // namespace labhelper
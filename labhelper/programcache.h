@@ -0,0 +1,33 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+
+namespace labhelper
+{
+/**
+	* On-disk cache of linked program binaries (glGetProgramBinary), so a
+	* warm start skips GLSL compilation. Entries are keyed by a hash of the
+	* shader sources together with the GL vendor, renderer and version
+	* strings; a driver update changes the key, and a binary the driver
+	* rejects anyway is recompiled and overwritten. Used by the labhelper
+	* shader loaders, disabled until a directory is set.
+	*/
+namespace programcache
+{
+// An empty directory disables the cache. Created on first store.
+void setDirectory(const std::string& directory);
+bool isEnabled();
+
+// One (stage, source) pair per shader in the program
+std::string key(const std::vector<std::pair<GLenum, std::string>>& sources);
+
+// Returns a linked program, or 0 on a miss
+GLuint load(const std::string& key);
+
+// Call glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE)
+// before linking a program that is going to be stored
+void store(GLuint program, const std::string& key);
+} // namespace programcache
+} // namespace labhelper
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+
+/** Counter-based random numbers (Philox4x32-10, Salmon et al. 2011).
+ *
+ * Every value is a pure function of a key and a counter, so there is no
+ * generator state to carry around: particle i at step n can draw its numbers
+ * from any thread, in any order, and get the same result every run. The
+ * shaders contain a line-by-line port, and since both sides only use 32-bit
+ * integer math and exact int-to-float conversions the CPU and GPU produce
+ * bit-identical values for the same (seed, id, step, stream).
+ */
+namespace labhelper
+{
+namespace random
+{
+inline void mulhilo32(uint32_t a, uint32_t b, uint32_t& hi, uint32_t& lo)
+{
+	uint64_t product = uint64_t(a) * uint64_t(b);
+	hi = uint32_t(product >> 32);
+	lo = uint32_t(product);
+}
+
+inline glm::uvec4 philox4x32(glm::uvec4 counter, glm::uvec2 key)
+{
+	for(int round = 0; round < 10; round++)
+	{
+		uint32_t hi0, lo0, hi1, lo1;
+		mulhilo32(0xD2511F53u, counter.x, hi0, lo0);
+		mulhilo32(0xCD9E8D57u, counter.z, hi1, lo1);
+		counter = glm::uvec4(hi1 ^ counter.y ^ key.x, lo1, hi0 ^ counter.w ^ key.y, lo0);
+		key += glm::uvec2(0x9E3779B9u, 0xBB67AE85u);
+	}
+	return counter;
+}
+
+/**
+	* Maps the top 24 bits to [0, 1). Exact in single precision, so it gives
+	* the same float on every device.
+	*/
+inline float toUnitFloat(uint32_t x)
+{
+	return float(x >> 8) * (1.0f / 16777216.0f);
+}
+
+/**
+	* Four uniform numbers in [0, 1) for the given particle and step. The
+	* stream separates independent uses (initialization, jitter, ...) so they
+	* never draw correlated values.
+	*/
+inline glm::vec4 uniform4(uint32_t seed, uint32_t id, uint32_t step, uint32_t stream = 0)
+{
+	glm::uvec4 bits = philox4x32(glm::uvec4(id, step, stream, 0u), glm::uvec2(seed, 0x5EED5EEDu));
+	return glm::vec4(toUnitFloat(bits.x), toUnitFloat(bits.y), toUnitFloat(bits.z), toUnitFloat(bits.w));
+}
+} // namespace random
+} // namespace labhelper
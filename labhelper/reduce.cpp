@@ -0,0 +1,302 @@
+#include "reduce.h"
+#include "labhelper.h"
+
+#include <map>
+#include <string>
+#include <cstring>
+
+namespace labhelper
+{
+namespace
+{
+const GLuint REDUCE_GROUP_SIZE = 256;
+const GLuint REDUCE_MAX_GROUPS = 256; // Partials must fit in a single group for the final pass
+
+// The field layout and operation are baked in with #defines, so each variant
+// is its own program. Elements are read as raw 32-bit words.
+const char* reduceShaderSource = R"(
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
+layout(std430, binding = 0) readonly buffer SourceBuffer {
+	uint sourceWords[];
+};
+
+layout(std430, binding = 1) writeonly buffer OutputBuffer {
+	float outputValues[];
+};
+
+#if COUNT_FROM_BUFFER
+layout(std430, binding = 2) readonly buffer CountBuffer {
+	uint countWords[];
+};
+uniform int countIndex;
+#endif
+
+#if WEIGHTED
+uniform int weightIndexWords;
+uniform int weightCount;
+uniform float weights[MAX_WEIGHTS];
+#endif
+
+uniform int count; // With COUNT_FROM_BUFFER, the most there can be
+uniform int strideWords;
+uniform int offsetWords;
+uniform int outputIndex;
+
+#if REDUCE_OP == 0
+#define IDENTITY 0.0
+#define COMBINE(a, b) ((a) + (b))
+#define SUBGROUP_COMBINE subgroupAdd
+#elif REDUCE_OP == 1
+#define IDENTITY uintBitsToFloat(0x7F800000u)
+#define COMBINE(a, b) min(a, b)
+#define SUBGROUP_COMBINE subgroupMin
+#else
+#define IDENTITY uintBitsToFloat(0xFF800000u)
+#define COMBINE(a, b) max(a, b)
+#define SUBGROUP_COMBINE subgroupMax
+#endif
+
+float loadComponent(uint word) {
+#if SOURCE_UNSIGNED
+	return float(word);
+#else
+	return uintBitsToFloat(word);
+#endif
+}
+
+float loadValue(int base) {
+#if COMPONENTS == 1 && TRANSFORM == 0
+	return loadComponent(sourceWords[base]);
+#else
+	vec4 v = vec4(0.0);
+	for (int c = 0; c < COMPONENTS; c++) {
+		v[c] = loadComponent(sourceWords[base + c]);
+	}
+#if TRANSFORM == 1
+	return length(v);
+#elif TRANSFORM == 2
+	return dot(v, v);
+#elif TRANSFORM == 3
+	return v.x + v.y + v.z + v.w;
+#else
+	return v.x;
+#endif
+#endif
+}
+
+float loadElement(int i) {
+	float value = loadValue(i * strideWords + offsetWords);
+#if WEIGHTED
+	uint index = min(sourceWords[i * strideWords + weightIndexWords], uint(weightCount - 1));
+	value *= weights[index];
+#endif
+	return value;
+}
+
+shared float partial[gl_WorkGroupSize.x];
+
+void main() {
+	uint lid = gl_LocalInvocationID.x;
+
+	// Grid-stride loop, each invocation folds several elements first
+	float value = IDENTITY;
+	int elements = count;
+#if COUNT_FROM_BUFFER
+	elements = min(elements, int(countWords[countIndex]));
+#endif
+	int step = int(gl_NumWorkGroups.x * gl_WorkGroupSize.x);
+	for (int i = int(gl_GlobalInvocationID.x); i < elements; i += step) {
+		value = COMBINE(value, loadElement(i));
+	}
+
+#ifdef USE_SUBGROUPS
+	value = SUBGROUP_COMBINE(value);
+	if (subgroupElect()) {
+		partial[gl_SubgroupID] = value;
+	}
+	barrier();
+	if (gl_SubgroupID == 0) {
+		value = IDENTITY;
+		for (uint i = gl_SubgroupInvocationID; i < gl_NumSubgroups; i += gl_SubgroupSize) {
+			value = COMBINE(value, partial[i]);
+		}
+		value = SUBGROUP_COMBINE(value);
+		if (subgroupElect()) {
+			outputValues[outputIndex + int(gl_WorkGroupID.x)] = value;
+		}
+	}
+#else
+	partial[lid] = value;
+	barrier();
+	for (uint stride = gl_WorkGroupSize.x / 2; stride > 0; stride >>= 1) {
+		if (lid < stride) {
+			partial[lid] = COMBINE(partial[lid], partial[lid + stride]);
+		}
+		barrier();
+	}
+	if (lid == 0) {
+		outputValues[outputIndex + int(gl_WorkGroupID.x)] = partial[0];
+	}
+#endif
+}
+)";
+
+std::map<std::string, GLuint> s_programs;
+GLuint s_partialsBuffer = 0;
+
+GLuint getReduceProgram(ReduceOp op,
+                        GLuint components,
+                        ReduceTransform transform,
+                        bool isUnsigned,
+                        bool countFromBuffer,
+                        bool weighted)
+{
+	std::string defines = "#define REDUCE_OP " + std::to_string(int(op)) + "\n"
+	                      + "#define COMPONENTS " + std::to_string(components) + "\n"
+	                      + "#define TRANSFORM " + std::to_string(int(transform)) + "\n"
+	                      + "#define SOURCE_UNSIGNED " + std::to_string(isUnsigned ? 1 : 0) + "\n"
+	                      + "#define COUNT_FROM_BUFFER " + std::to_string(countFromBuffer ? 1 : 0) + "\n"
+	                      + "#define WEIGHTED " + std::to_string(weighted ? 1 : 0) + "\n"
+	                      + "#define MAX_WEIGHTS " + std::to_string(REDUCE_MAX_WEIGHTS) + "\n";
+
+	auto it = s_programs.find(defines);
+	if(it != s_programs.end())
+	{
+		return it->second;
+	}
+
+	std::string source = "#version 430\n";
+	if(hasSubgroupReductions())
+	{
+		source += "#extension GL_KHR_shader_subgroup_basic : require\n"
+		          "#extension GL_KHR_shader_subgroup_arithmetic : require\n"
+		          "#define USE_SUBGROUPS\n";
+	}
+	source += defines + reduceShaderSource;
+
+	GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+	const char* src = source.c_str();
+	glShaderSource(shader, 1, &src, nullptr);
+	glCompileShader(shader);
+	int compileOk = 0;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compileOk);
+	if(!compileOk)
+	{
+		fatal_error(GetShaderInfoLog(shader), "Reduction Shader");
+		return 0;
+	}
+
+	GLuint program = glCreateProgram();
+	glAttachShader(program, shader);
+	glDeleteShader(shader);
+	linkShaderProgram(program);
+
+	s_programs[defines] = program;
+	return program;
+}
+
+void dispatchReduce(GLuint program, GLuint count, GLuint strideWords, GLuint offsetWords, GLuint outputIndex, GLuint groups)
+{
+	glUseProgram(program);
+	setUniformSlow(program, "count", GLint(count));
+	setUniformSlow(program, "strideWords", GLint(strideWords));
+	setUniformSlow(program, "offsetWords", GLint(offsetWords));
+	setUniformSlow(program, "outputIndex", GLint(outputIndex));
+	glDispatchCompute(groups, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+// countBuffer is 0 when the count is known up front
+void reduce(GLuint buffer,
+            GLuint count,
+            GLuint countBuffer,
+            GLuint countIndex,
+            const ReduceField& field,
+            ReduceOp op,
+            GLuint resultBuffer,
+            GLuint resultIndex)
+{
+	if(s_partialsBuffer == 0)
+	{
+		glGenBuffers(1, &s_partialsBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, s_partialsBuffer);
+		glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(float) * REDUCE_MAX_GROUPS, nullptr, 0);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	GLuint groups = (count + REDUCE_GROUP_SIZE - 1) / REDUCE_GROUP_SIZE;
+	groups = groups < 1 ? 1 : (groups > REDUCE_MAX_GROUPS ? REDUCE_MAX_GROUPS : groups);
+
+	// First pass: one partial result per workgroup
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, s_partialsBuffer);
+	const bool weighted = field.weights != nullptr && field.weightCount > 0;
+	GLuint program =
+	    getReduceProgram(op, field.components, field.transform, field.isUnsigned, countBuffer != 0, weighted);
+	glUseProgram(program);
+	if(countBuffer != 0)
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, countBuffer);
+		setUniformSlow(program, "countIndex", GLint(countIndex));
+	}
+	if(weighted)
+	{
+		setUniformSlow(program, "weightIndexWords", GLint(field.weightIndexOffset / 4));
+		setUniformSlow(program, "weightCount", GLint(field.weightCount));
+		glUniform1fv(glGetUniformLocation(program, "weights"), field.weightCount, field.weights);
+	}
+	dispatchReduce(program, count, field.stride / 4, field.offset / 4, 0, groups);
+
+	// Second pass: fold the partials into the result slot. Partials of a sum
+	// are summed, partials of a min/max are min/max'ed.
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, s_partialsBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, resultBuffer);
+	program = getReduceProgram(op, 1, ReduceTransform::None, false, false, false);
+	dispatchReduce(program, groups, 1, 0, resultIndex, 1);
+}
+} // namespace
+
+bool hasSubgroupReductions()
+{
+	static int supported = -1;
+	if(supported < 0)
+	{
+		supported = 0;
+		GLint numExtensions = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+		for(GLint i = 0; i < numExtensions; i++)
+		{
+			const char* ext = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+			if(ext != nullptr && strcmp(ext, "GL_KHR_shader_subgroup") == 0)
+			{
+				supported = 1;
+				break;
+			}
+		}
+	}
+	return supported == 1;
+}
+
+void reduceBuffer(GLuint buffer,
+                  GLuint count,
+                  const ReduceField& field,
+                  ReduceOp op,
+                  GLuint resultBuffer,
+                  GLuint resultIndex)
+{
+	reduce(buffer, count, 0, 0, field, op, resultBuffer, resultIndex);
+}
+
+void reduceBuffer(GLuint buffer,
+                  GLuint countBuffer,
+                  GLuint countIndex,
+                  GLuint maxCount,
+                  const ReduceField& field,
+                  ReduceOp op,
+                  GLuint resultBuffer,
+                  GLuint resultIndex)
+{
+	reduce(buffer, maxCount, countBuffer, countIndex, field, op, resultBuffer, resultIndex);
+}
+} // namespace labhelper
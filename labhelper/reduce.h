@@ -0,0 +1,104 @@
+#pragma once
+
+#include <GL/glew.h>
+
+namespace labhelper
+{
+enum class ReduceOp
+{
+	Sum,
+	Min,
+	Max
+};
+
+/**
+	* What is reduced for each element: the raw value (one component), the
+	* length / squared length of a vector with up to four components, or the
+	* sum of up to four components.
+	*/
+enum class ReduceTransform
+{
+	None,
+	Length,
+	LengthSquared,
+	ComponentSum
+};
+
+const GLuint REDUCE_MAX_WEIGHTS = 16;
+
+/**
+	* Describes where a field lives inside the elements of a buffer. Offset and
+	* stride are in bytes and must be multiples of four. Unsigned fields are
+	* converted to float before being reduced.
+	*/
+struct ReduceField
+{
+	GLuint offset;
+	GLuint stride;
+	GLuint components;
+	ReduceTransform transform;
+	bool isUnsigned;
+	const float* weights;
+	GLuint weightCount;
+	GLuint weightIndexOffset;
+
+	ReduceField(GLuint offset,
+	            GLuint stride,
+	            GLuint components = 1,
+	            ReduceTransform transform = ReduceTransform::None,
+	            bool isUnsigned = false)
+	    : offset(offset), stride(stride), components(components), transform(transform), isUnsigned(isUnsigned),
+	      weights(nullptr), weightCount(0), weightIndexOffset(0)
+	{
+	}
+
+	/**
+		* Scales each element by weights[i], where i is a uint at byte offset
+		* 'indexOffset' of the same element, e.g. a per-type mass. Indices past
+		* the table use its last entry. The table (at most REDUCE_MAX_WEIGHTS)
+		* is only read during reduceBuffer().
+		*/
+	ReduceField& weightedBy(GLuint indexOffset, const float* table, GLuint tableSize)
+	{
+		weightIndexOffset = indexOffset;
+		weights = table;
+		weightCount = tableSize < REDUCE_MAX_WEIGHTS ? tableSize : REDUCE_MAX_WEIGHTS;
+		return *this;
+	}
+};
+
+/**
+	* Reduces a field over the first 'count' elements of 'buffer' on the GPU
+	* and writes the result as a float to resultBuffer[resultIndex]. Nothing is
+	* read back; several reductions can target one small result buffer which
+	* the caller then reads asynchronously.
+	*
+	* Uses SSBO bindings 0-2 and leaves a shader storage barrier behind.
+	*/
+void reduceBuffer(GLuint buffer,
+                  GLuint count,
+                  const ReduceField& field,
+                  ReduceOp op,
+                  GLuint resultBuffer,
+                  GLuint resultIndex);
+
+/**
+	* As above, but the count is read from countBuffer[countIndex] (a uint) on
+	* the GPU, for buffers whose fill level never comes back to the CPU. The
+	* work is sized for 'maxCount' elements and the count is clamped to it.
+	*/
+void reduceBuffer(GLuint buffer,
+                  GLuint countBuffer,
+                  GLuint countIndex,
+                  GLuint maxCount,
+                  const ReduceField& field,
+                  ReduceOp op,
+                  GLuint resultBuffer,
+                  GLuint resultIndex);
+
+/**
+	* True if the driver exposes GL_KHR_shader_subgroup, in which case the
+	* reductions use subgroup arithmetic instead of a shared-memory tree.
+	*/
+bool hasSubgroupReductions();
+} // namespace labhelper
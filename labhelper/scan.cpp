@@ -0,0 +1,175 @@
+#include "scan.h"
+#include "labhelper.h"
+
+#include <vector>
+
+namespace labhelper
+{
+namespace
+{
+const GLuint SCAN_BLOCK_SIZE = 256;
+
+const char* scanShaderSource = R"(
+#version 430
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
+layout(std430, binding = 0) readonly buffer InputBuffer {
+	uint inputValues[];
+};
+
+layout(std430, binding = 1) buffer OutputBuffer {
+	uint outputValues[];
+};
+
+layout(std430, binding = 2) buffer BlockSumBuffer {
+	uint blockSums[];
+};
+
+#define SCAN_BLOCKS 0
+#define SCAN_ADD_BLOCK_OFFSETS 1
+
+uniform int scanPass;
+uniform uint inputCount;  // Read from the input, the rest count as zero
+uniform uint outputCount; // Written to the output
+
+// Double buffered, so a step never reads what it is overwriting
+shared uint partial[2][gl_WorkGroupSize.x];
+
+// Scans each block on its own and leaves its total in blockSums
+void scanBlocks() {
+	uint i = gl_GlobalInvocationID.x;
+	uint lid = gl_LocalInvocationID.x;
+	// Every invocation reads its element before any writes it, so in place is fine
+	uint value = i < inputCount ? inputValues[i] : 0u;
+
+	uint source = 0u;
+	partial[source][lid] = value;
+	barrier();
+	for (uint offset = 1u; offset < gl_WorkGroupSize.x; offset <<= 1) {
+		uint sum = partial[source][lid];
+		if (lid >= offset) {
+			sum += partial[source][lid - offset];
+		}
+		partial[1u - source][lid] = sum;
+		source = 1u - source;
+		barrier();
+	}
+
+	uint inclusive = partial[source][lid];
+	if (i < outputCount) {
+		outputValues[i] = inclusive - value;
+	}
+	if (lid == gl_WorkGroupSize.x - 1u) {
+		blockSums[gl_WorkGroupID.x] = inclusive;
+	}
+}
+
+// blockSums now holds the scanned totals, i.e. where each block starts
+void addBlockOffsets() {
+	uint i = gl_GlobalInvocationID.x;
+	if (i < outputCount && gl_WorkGroupID.x > 0u) {
+		outputValues[i] += blockSums[gl_WorkGroupID.x];
+	}
+}
+
+void main() {
+	if (scanPass == SCAN_BLOCKS) {
+		scanBlocks();
+	} else {
+		addBlockOffsets();
+	}
+}
+)";
+
+GLuint s_program = 0;
+// The block totals of each level of the recursion, grown as needed
+std::vector<GLuint> s_blockSumBuffers;
+std::vector<GLuint> s_blockSumCapacities;
+
+GLuint getScanProgram()
+{
+	if(s_program != 0)
+	{
+		return s_program;
+	}
+
+	GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+	glShaderSource(shader, 1, &scanShaderSource, nullptr);
+	glCompileShader(shader);
+	int compileOk = 0;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compileOk);
+	if(!compileOk)
+	{
+		fatal_error(GetShaderInfoLog(shader), "Scan Shader");
+		return 0;
+	}
+
+	s_program = glCreateProgram();
+	glAttachShader(s_program, shader);
+	glDeleteShader(shader);
+	linkShaderProgram(s_program);
+	return s_program;
+}
+
+GLuint getBlockSumBuffer(size_t level, GLuint blocks)
+{
+	if(level >= s_blockSumBuffers.size())
+	{
+		s_blockSumBuffers.resize(level + 1, 0);
+		s_blockSumCapacities.resize(level + 1, 0);
+	}
+	if(s_blockSumCapacities[level] < blocks)
+	{
+		glDeleteBuffers(1, &s_blockSumBuffers[level]);
+		glGenBuffers(1, &s_blockSumBuffers[level]);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, s_blockSumBuffers[level]);
+		glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * blocks, nullptr, 0);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		s_blockSumCapacities[level] = blocks;
+	}
+	return s_blockSumBuffers[level];
+}
+
+void scanLevel(GLuint program, GLuint input, GLuint output, GLuint inputCount, GLuint outputCount, size_t level)
+{
+	const GLuint blocks = (outputCount + SCAN_BLOCK_SIZE - 1) / SCAN_BLOCK_SIZE;
+	GLuint blockSums = getBlockSumBuffer(level, blocks);
+
+	glUseProgram(program);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, input);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, output);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, blockSums);
+	setUniformSlow(program, "scanPass", 0);
+	setUniformSlow(program, "inputCount", inputCount);
+	setUniformSlow(program, "outputCount", outputCount);
+	glDispatchCompute(blocks, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	if(blocks == 1)
+	{
+		return;
+	}
+
+	// Where each block starts, then add that to everything in it
+	scanLevel(program, blockSums, blockSums, blocks, blocks, level + 1);
+
+	glUseProgram(program);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, output);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, blockSums);
+	setUniformSlow(program, "scanPass", 1);
+	setUniformSlow(program, "outputCount", outputCount);
+	glDispatchCompute(blocks, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+} // namespace
+
+void scanBuffer(GLuint input, GLuint output, GLuint count, bool writeTotal)
+{
+	// The total is the exclusive sum one past the end, where the input reads as zero
+	const GLuint outputCount = count + (writeTotal ? 1 : 0);
+	if(outputCount == 0)
+	{
+		return;
+	}
+	scanLevel(getScanProgram(), input, output, count, outputCount, 0);
+}
+} // namespace labhelper
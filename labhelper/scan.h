@@ -0,0 +1,19 @@
+#pragma once
+
+#include <GL/glew.h>
+
+namespace labhelper
+{
+/**
+	* Exclusive prefix sum of the first 'count' uints of 'input' on the GPU,
+	* written to 'output', which may be the same buffer. With 'writeTotal',
+	* output[count] also receives the sum of all of them, so it needs room for
+	* count + 1 elements. Nothing is read back.
+	*
+	* Blocks of 256 are scanned in shared memory, their totals are scanned
+	* the same way (recursively, for large counts) and added back on.
+	*
+	* Uses SSBO bindings 0-2 and leaves a shader storage barrier behind.
+	*/
+void scanBuffer(GLuint input, GLuint output, GLuint count, bool writeTotal = false);
+} // namespace labhelper
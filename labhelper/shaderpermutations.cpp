@@ -0,0 +1,33 @@
+#include "shaderpermutations.h"
+
+namespace labhelper
+{
+ShaderPermutations::ShaderPermutations(const std::string& computeShader) : computeShader(computeShader)
+{
+}
+
+GLuint ShaderPermutations::get(const ShaderDefines& defines)
+{
+	auto it = programs.find(defines);
+	if(it != programs.end())
+	{
+		return it->second;
+	}
+	GLuint program = loadComputeShaderProgram(computeShader, defines, false);
+	programs[defines] = program;
+	return program;
+}
+
+void ShaderPermutations::reload()
+{
+	for(auto& permutation : programs)
+	{
+		GLuint program = loadComputeShaderProgram(computeShader, permutation.first, true);
+		if(program != 0)
+		{
+			glDeleteProgram(permutation.second);
+			permutation.second = program;
+		}
+	}
+}
+} // namespace labhelper
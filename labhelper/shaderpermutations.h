@@ -0,0 +1,35 @@
+#pragma once
+
+#include "labhelper.h"
+
+#include <map>
+#include <string>
+
+namespace labhelper
+{
+/**
+	* Compute programs built from one source file with different #defines.
+	* Each permutation is compiled the first time it is asked for and kept, so
+	* switching between specialized variants at runtime is a map lookup, and
+	* the variants themselves need no runtime branches. Programs also go
+	* through the binary cache, so only new permutations pay for compilation.
+	*/
+class ShaderPermutations
+{
+public:
+	explicit ShaderPermutations(const std::string& computeShader);
+	ShaderPermutations(const ShaderPermutations&) = delete;
+	ShaderPermutations& operator=(const ShaderPermutations&) = delete;
+
+	// Compile errors in a new permutation are fatal, as for the first load
+	GLuint get(const ShaderDefines& defines);
+
+	// Recompiles every permutation built so far. One that fails to compile
+	// reports the error and keeps its previous program.
+	void reload();
+
+private:
+	std::string computeShader;
+	std::map<ShaderDefines, GLuint> programs;
+};
+} // namespace labhelper
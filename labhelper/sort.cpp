@@ -0,0 +1,182 @@
+#include "sort.h"
+#include "labhelper.h"
+#include "scan.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace labhelper
+{
+namespace
+{
+const GLuint SORT_BLOCK_SIZE = 256;
+const GLuint RADIX_BITS = 4;
+const GLuint RADIX = 1 << RADIX_BITS;
+
+const char* sortShaderSource = R"(
+#version 430
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
+layout(std430, binding = 0) readonly buffer InputBuffer {
+	uvec2 inputPairs[];
+};
+
+layout(std430, binding = 1) writeonly buffer OutputBuffer {
+	uvec2 outputPairs[];
+};
+
+// [digit * blocks + block], so that once scanned it holds where the pairs of
+// each digit from each block start
+layout(std430, binding = 2) buffer DigitCountBuffer {
+	uint digitCounts[];
+};
+
+#define SORT_COUNT 0
+#define SORT_SCATTER 1
+
+#define RADIX 16u
+#define MASK_WORDS (gl_WorkGroupSize.x / 32u)
+
+uniform int sortPass;
+uniform uint pairCount;
+uniform uint shift; // Of the digit sorted on in this pass
+
+// Bit i of digitMasks[d] is set when pair i of the block has digit d. ORs
+// commute, so unlike a counter the result doesn't depend on who came first.
+shared uint digitMasks[RADIX][MASK_WORDS];
+
+void main() {
+	uint i = gl_GlobalInvocationID.x;
+	uint lid = gl_LocalInvocationID.x;
+	uint block = gl_WorkGroupID.x;
+	uint blocks = gl_NumWorkGroups.x;
+
+	for (uint k = lid; k < RADIX * MASK_WORDS; k += gl_WorkGroupSize.x) {
+		digitMasks[k / MASK_WORDS][k % MASK_WORDS] = 0u;
+	}
+	barrier();
+
+	bool inRange = i < pairCount;
+	uvec2 pair = uvec2(0u);
+	uint digit = 0u;
+	if (inRange) {
+		pair = inputPairs[i];
+		digit = (pair.x >> shift) & (RADIX - 1u);
+		atomicOr(digitMasks[digit][lid / 32u], 1u << (lid % 32u));
+	}
+	barrier();
+
+	if (sortPass == SORT_COUNT) {
+		if (lid < RADIX) {
+			uint count = 0u;
+			for (uint w = 0u; w < MASK_WORDS; w++) {
+				count += uint(bitCount(digitMasks[lid][w]));
+			}
+			digitCounts[lid * blocks + block] = count;
+		}
+	} else if (inRange) {
+		// Pairs of the same digit before this one in the block
+		uint word = lid / 32u;
+		uint rank = uint(bitCount(digitMasks[digit][word] & ((1u << (lid % 32u)) - 1u)));
+		for (uint w = 0u; w < word; w++) {
+			rank += uint(bitCount(digitMasks[digit][w]));
+		}
+		outputPairs[digitCounts[digit * blocks + block] + rank] = pair;
+	}
+}
+)";
+
+GLuint s_program = 0;
+// Ping-pong partner of the pairs being sorted and the digit counts, grown as needed
+GLuint s_tempPairs = 0;
+GLuint s_tempPairsCapacity = 0;
+GLuint s_digitCounts = 0;
+GLuint s_digitCountsCapacity = 0;
+
+GLuint getSortProgram()
+{
+	if(s_program != 0)
+	{
+		return s_program;
+	}
+
+	GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+	glShaderSource(shader, 1, &sortShaderSource, nullptr);
+	glCompileShader(shader);
+	int compileOk = 0;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compileOk);
+	if(!compileOk)
+	{
+		fatal_error(GetShaderInfoLog(shader), "Sort Shader");
+		return 0;
+	}
+
+	s_program = glCreateProgram();
+	glAttachShader(s_program, shader);
+	glDeleteShader(shader);
+	linkShaderProgram(s_program);
+	return s_program;
+}
+
+GLuint ensureBuffer(GLuint& buffer, GLuint& capacity, GLuint size)
+{
+	if(capacity < size)
+	{
+		glDeleteBuffers(1, &buffer);
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+		glBufferStorage(GL_SHADER_STORAGE_BUFFER, size, nullptr, 0);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		capacity = size;
+	}
+	return buffer;
+}
+} // namespace
+
+void radixSortPairs(GLuint pairs, GLuint count, GLuint keyBits)
+{
+	const GLuint passes = (std::min(keyBits, 32u) + RADIX_BITS - 1) / RADIX_BITS;
+	if(count <= 1 || passes == 0)
+	{
+		return;
+	}
+
+	const GLuint blocks = (count + SORT_BLOCK_SIZE - 1) / SORT_BLOCK_SIZE;
+	GLuint temp = ensureBuffer(s_tempPairs, s_tempPairsCapacity, sizeof(GLuint) * 2 * count);
+	GLuint digitCounts = ensureBuffer(s_digitCounts, s_digitCountsCapacity, sizeof(GLuint) * RADIX * blocks);
+	GLuint program = getSortProgram();
+
+	GLuint source = pairs;
+	GLuint destination = temp;
+	for(GLuint pass = 0; pass < passes; pass++)
+	{
+		glUseProgram(program);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, source);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, digitCounts);
+		setUniformSlow(program, "sortPass", 0);
+		setUniformSlow(program, "pairCount", count);
+		setUniformSlow(program, "shift", pass * RADIX_BITS);
+		glDispatchCompute(blocks, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		scanBuffer(digitCounts, digitCounts, RADIX * blocks);
+
+		glUseProgram(program);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, source);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, destination);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, digitCounts);
+		setUniformSlow(program, "sortPass", 1);
+		glDispatchCompute(blocks, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+		std::swap(source, destination);
+	}
+
+	// An odd number of passes leaves the result in the temporary
+	if(source != pairs)
+	{
+		glCopyNamedBufferSubData(source, pairs, 0, 0, sizeof(GLuint) * 2 * count);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+}
+} // namespace labhelper
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <GL/glew.h>
+
+namespace labhelper
+{
+/**
+	* Stable ascending sort of the first 'count' (key, value) pairs of 'pairs',
+	* a buffer of uvec2 with the key first, on the GPU. Only the low 'keyBits'
+	* bits of the keys are looked at, so narrow keys take fewer passes.
+	*
+	* LSD radix sort with 4-bit digits, one pass per digit: every block of 256
+	* pairs counts its digits, scanBuffer() turns the counts of all blocks into
+	* where each block's pairs of each digit go, and the pairs are scattered
+	* there in their old order. Nothing depends on the order the invocations
+	* happen to run in, so the same input always gives the same output.
+	*
+	* Uses SSBO bindings 0-2 and leaves a shader storage barrier behind.
+	*/
+void radixSortPairs(GLuint pairs, GLuint count, GLuint keyBits = 32);
+} // namespace labhelper
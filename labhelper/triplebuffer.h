@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+
+/** Lock-free single producer, single consumer triple buffer.
+ *
+ * The producer fills back() and publishes it; the consumer picks up the most
+ * recently published slot with update() and reads front(). Neither side ever
+ * waits for the other: the producer always has a slot to write, and slots
+ * the consumer didn't get to in time are simply overwritten. The third slot
+ * sits between the two and is handed over by swapping its index atomically.
+ */
+namespace labhelper
+{
+template <typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() : middle(1), backIndex(0), frontIndex(2) {}
+
+	/// Producer side: the slot to fill before calling publish()
+	T& back()
+	{
+		return slots[backIndex];
+	}
+
+	void publish()
+	{
+		backIndex = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+	}
+
+	/**
+		* Consumer side: takes the latest published slot, if there is one newer
+		* than front(). Returns false, leaving front() alone, otherwise.
+		*/
+	bool update()
+	{
+		if((middle.load(std::memory_order_relaxed) & FRESH) == 0)
+		{
+			return false;
+		}
+		frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX_MASK;
+		return true;
+	}
+
+	const T& front() const
+	{
+		return slots[frontIndex];
+	}
+
+private:
+	static const unsigned INDEX_MASK = 3;
+	static const unsigned FRESH = 4; // Set while the middle slot hasn't been taken by the consumer
+
+	T slots[3];
+	std::atomic<unsigned> middle;
+	unsigned backIndex;  // Producer only
+	unsigned frontIndex; // Consumer only
+
+	TripleBuffer(const TripleBuffer&) = delete;
+	TripleBuffer& operator=(const TripleBuffer&) = delete;
+};
+} // namespace labhelper
@@ -0,0 +1,145 @@
+// Shared by the particle shaders, pulled in with #include "common.glsl"
+
+// 2D unless the loader injects SIMULATION_3D 1, as project3d does. simvec
+// (and simivec, for cell coordinates) is whatever a position is.
+#ifndef SIMULATION_3D
+#define SIMULATION_3D 0
+#endif
+
+#if SIMULATION_3D
+#define DIMENSIONS 3
+#define simvec vec3
+#define simivec ivec3
+#else
+#define DIMENSIONS 2
+#define simvec vec2
+#define simivec ivec2
+#endif
+
+// Must match struct particle in particle.h
+struct ParticleData {
+#if SIMULATION_3D
+    vec3 pos;
+    uint bucketIndex;
+    vec3 vel;
+    uint gridIndex;
+    vec3 grad;
+    float density;
+    uint species;
+    uint id;
+#else
+    vec2 pos;
+    vec2 vel;
+    uint bucketIndex;
+    uint gridIndex;
+    float density;
+    uint species;
+    vec2 grad;
+    uint id;
+#endif
+};
+
+// Must match MAX_SPECIES, SpeciesParams and SpeciesBlock in particle.h
+#define MAX_SPECIES 4
+
+struct SpeciesParams {
+    vec4 color;
+    float mass;
+    float gravityScale;
+    vec2 padding;
+};
+
+layout( std430, binding=8 ) readonly buffer SpeciesBuffer
+{
+    SpeciesParams speciesParams[MAX_SPECIES];
+    float interaction[MAX_SPECIES * MAX_SPECIES]; // [self * MAX_SPECIES + other]
+};
+
+// Must match PopulationBlock in particle.h. How many particles are alive is
+// only known on the GPU: population.comp keeps it, and the indirect commands
+// derived from it, up to date. Everything else only reads it.
+#ifndef POPULATION_ACCESS
+#define POPULATION_ACCESS readonly
+#endif
+
+layout( std430, binding=9 ) POPULATION_ACCESS buffer PopulationBuffer
+{
+    uint aliveCount;
+    uint indirectCommands[];
+};
+
+// Width of the per-particle passes, the indirect dispatches are sized for it
+#define PARTICLE_GROUP_SIZE 256
+// Glyphs drawn by each instance in glyph.vert
+#define GLYPHS_PER_INSTANCE 64
+
+// Smoothing kernel of the density, (r - d)^2. In 3D it is normalized to
+// integrate to 1 over the ball of radius r, 15 / (2 pi r^5). The 2D factor is
+// the one the 2D scenes and the CPU engine were tuned with, kept as it is.
+float SpikyKernel(float distance, float radius) {
+    if (distance >= radius) return 0.0;
+
+#if SIMULATION_3D
+    float normalizationFactor = 15.0 / (2.0 * 3.14159 * pow(radius, 5.0));
+#else
+    float normalizationFactor = 10.0 / (7.0 * 3.14159 * radius * radius);
+#endif
+
+    float q = radius - distance;
+    return q * q * normalizationFactor;
+}
+
+// Monaghan's cubic spline with support 'radius' (h = radius / 2), normalized
+// by 10 / (7 pi h^2) in 2D and 1 / (pi h^3) in 3D
+float CubicSplineKernel(float distance, float radius) {
+    if (distance >= radius) return 0.0;
+
+    float h = 0.5 * radius;
+#if SIMULATION_3D
+    float normalizationFactor = 1.0 / (3.14159 * h * h * h);
+#else
+    float normalizationFactor = 10.0 / (7.0 * 3.14159 * h * h);
+#endif
+
+    float q = distance / h;
+    float t = 2.0 - q;
+    float w = q < 1.0 ? 1.0 - 1.5 * q * q + 0.75 * q * q * q : 0.25 * t * t * t;
+    return w * normalizationFactor;
+}
+
+// The kernel every density sum uses, picked by the loader's KERNEL_TYPE
+#define KERNEL_SPIKY 0
+#define KERNEL_CUBIC_SPLINE 1
+#ifndef KERNEL_TYPE
+#define KERNEL_TYPE KERNEL_SPIKY
+#endif
+
+float SmoothingKernel(float distance, float radius) {
+#if KERNEL_TYPE == KERNEL_CUBIC_SPLINE
+    return CubicSplineKernel(distance, radius);
+#else
+    return SpikyKernel(distance, radius);
+#endif
+}
+
+// Counter-based random numbers (Philox4x32-10), a port of labhelper/random.h.
+// Keep the two in sync, the CPU and GPU are expected to match bit for bit.
+uvec4 philox4x32(uvec4 counter, uvec2 key) {
+    for (int round = 0; round < 10; round++) {
+        uint hi0, lo0, hi1, lo1;
+        umulExtended(0xD2511F53u, counter.x, hi0, lo0);
+        umulExtended(0xCD9E8D57u, counter.z, hi1, lo1);
+        counter = uvec4(hi1 ^ counter.y ^ key.x, lo1, hi0 ^ counter.w ^ key.y, lo0);
+        key += uvec2(0x9E3779B9u, 0xBB67AE85u);
+    }
+    return counter;
+}
+
+// Top 24 bits mapped to [0, 1), exact in single precision
+float toUnitFloat(uint x) { return float(x >> 8) * (1.0 / 16777216.0); }
+
+// Same as labhelper::random::uniform4
+vec4 uniform4(uint seed, uint id, uint step, uint stream) {
+    uvec4 bits = philox4x32(uvec4(id, step, stream, 0u), uvec2(seed, 0x5EED5EEDu));
+    return vec4(toUnitFloat(bits.x), toUnitFloat(bits.y), toUnitFloat(bits.z), toUnitFloat(bits.w));
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <triplebuffer.h>
+
+#include "particle.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// The CPU engine: a port of grid.comp, reindex.comp and particle.comp that
+// runs on its own thread, stepping in real time independently of the frame
+// rate. Completed steps are published through a triple buffer and uploaded by
+// the render thread; everything the render thread wants changed goes the
+// other way through a command queue, applied between steps.
+//
+// The mouse stir and the obstacle need the GPU density and obstacle fields,
+// so they only act on the GPU engine.
+///////////////////////////////////////////////////////////////////////////////
+struct CpuSimParams
+{
+	float timestep;       // Fixed step, or the upper bound with the adaptive step
+	float minTimestep;
+	int maxSubSteps;      // Steps per wake-up before sim time is dropped
+	bool adaptiveTimestep;
+	float cflNumber;
+	float smoothingRadius;
+	bool gravityEnabled;
+	float gravityStrength;
+	int gridSize;
+	int bucketsPerCell;   // One per species when sorting by species, see neighbors.glsl
+	bool incrementalGrid; // Patch the last sort instead of redoing it, see patchBuckets()
+	float rebuildChurn;   // Fraction of them above which the grid is rebuilt instead
+	SpeciesBlock species;
+};
+
+struct CpuSimFrame
+{
+	std::vector<particle> previous;     // Start of the last step, same order as 'particles'
+	std::vector<particle> particles;    // Sorted by bucket, like after reindex.comp
+	std::vector<uint32_t> bucketSizes;
+	unsigned long long step;
+	float simTime;
+	float timestep;                     // Of the last step
+	uint32_t movedParticles;            // Changed bucket before the last step, if the grid was patched
+	bool gridRebuilt;                   // Rather than patched, before the last step
+	unsigned generation;                // See CpuSimulation::reset()
+};
+
+class CpuSimulation
+{
+public:
+	CpuSimulation();
+	~CpuSimulation();
+
+	void start(const std::vector<particle>& particles, unsigned long long step, float simTime,
+	           const CpuSimParams& params, bool paused);
+	void stop();
+	bool isRunning() const;
+
+	// Commands, applied by the sim thread before its next step
+	void setParams(const CpuSimParams& params);
+	void setPaused(bool paused);
+	/**
+		* Replaces the particles. Frames published before the reset is applied
+		* are no longer returned by latestFrame().
+		*/
+	void reset(const std::vector<particle>& particles, unsigned long long step, float simTime);
+
+	/**
+		* The most recent frame if one was published since the last call,
+		* nullptr otherwise. Valid until the next call.
+		*/
+	const CpuSimFrame* latestFrame();
+
+private:
+	enum CommandType
+	{
+		COMMAND_SET_PARAMS,
+		COMMAND_SET_PAUSED,
+		COMMAND_RESET,
+		COMMAND_STOP
+	};
+
+	struct Command
+	{
+		CommandType type;
+		CpuSimParams params;
+		bool paused;
+		std::vector<particle> particles;
+		unsigned long long step;
+		float simTime;
+		unsigned generation;
+	};
+
+	// A particle that changed bucket since the last step, by index into 'current'
+	struct Mover
+	{
+		uint32_t index;
+		uint32_t bucket; // The new one
+	};
+
+	void push(const Command& command);
+	void run();
+	float nextTimestep() const;
+	void updateBuckets();
+	void sortIntoBuckets();
+	bool patchBuckets();
+	glm::vec2 densityAt(int id, glm::vec2 position) const;
+	void integrate(int id, float deltaTime);
+	void simulateStep(float deltaTime);
+	void publish();
+
+	std::thread thread;
+	std::mutex commandMutex;
+	std::condition_variable commandSignal;
+	std::vector<Command> commands;
+	unsigned requestedGeneration; // Render thread only
+
+	// Sim thread only, once started
+	CpuSimParams params;
+	bool paused;
+	std::vector<particle> current;
+	std::vector<particle> sorted;
+	std::vector<uint32_t> bucketSizes;
+	std::vector<uint32_t> prefixSums; // With the total at the end, like the GPU's
+	bool bucketsValid;                // 'current' is laid out as prefixSums says
+	std::vector<Mover> movers;
+	std::vector<Mover> arrivals;      // The same, ordered by their new bucket
+	uint32_t movedParticles;
+	bool gridRebuilt;
+	unsigned long long step;
+	float simTime;
+	float lastTimestep;
+	float maxSpeed;
+	unsigned generation;
+
+	labhelper::TripleBuffer<CpuSimFrame> frames;
+
+	CpuSimulation(const CpuSimulation&) = delete;
+	CpuSimulation& operator=(const CpuSimulation&) = delete;
+};
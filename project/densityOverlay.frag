@@ -0,0 +1,33 @@
+#version 430
+
+precision highp float;
+
+// Draws the density field from density.comp as a colormap over the scene.
+// The field covers the same [-1, 1] square the particles are drawn in.
+layout(binding = 0) uniform sampler2D densityField;
+layout(location = 0) out vec4 fragmentColor;
+
+uniform ivec2 viewportSize;
+uniform float maxDensity;
+uniform float opacity;
+
+// Polynomial fit of matplotlib's viridis
+vec3 viridis(float t) {
+    const vec3 c0 = vec3(0.2777273272234177, 0.005407344544966578, 0.3340998053353061);
+    const vec3 c1 = vec3(0.1050930431085774, 1.404613529898575, 1.384590162594685);
+    const vec3 c2 = vec3(-0.3308618287255563, 0.214847559468213, 0.09509516302823659);
+    const vec3 c3 = vec3(-4.634230498983486, -5.799100973351585, -19.33244095627987);
+    const vec3 c4 = vec3(6.228269936347081, 14.17993336680509, 56.69055260068105);
+    const vec3 c5 = vec3(4.776384997670288, -13.74514537774601, -65.35303263337234);
+    const vec3 c6 = vec3(-5.435455855934631, 4.645852612178535, 26.3124352495832);
+    return c0 + t * (c1 + t * (c2 + t * (c3 + t * (c4 + t * (c5 + t * c6)))));
+}
+
+void main() {
+    vec2 uv = gl_FragCoord.xy / vec2(viewportSize);
+    float density = texture(densityField, uv).x;
+    float t = clamp(density / maxDensity, 0.0, 1.0);
+
+    // Empty space stays see-through
+    fragmentColor = vec4(viridis(t), opacity * smoothstep(0.0, 0.05, t));
+}
@@ -0,0 +1,24 @@
+#version 430
+
+// required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
+precision highp float;
+
+// Drawn with glyph.vert as disks. Each particle is a sphere seen from above:
+// attachment 0 keeps the highest surface (GL_MAX blending), attachment 1
+// sums the thickness (additive blending). Both are in pixels.
+uniform float glyphSize;
+
+layout(location = 0) out float surfaceHeight;
+layout(location = 1) out float thickness;
+
+in vec2 localPosition;
+
+void main()
+{
+	float r2 = dot(localPosition, localPosition);
+	if (r2 > 1.0) discard;
+
+	float height = sqrt(1.0 - r2) * glyphSize;
+	surfaceHeight = height;
+	thickness = 2.0 * height;
+}
@@ -0,0 +1,72 @@
+#version 430
+
+precision highp float;
+
+// Shades the smoothed fluid height field. The view looks straight down on
+// the simulation plane: screen x is world x, screen y is world -z and the
+// height points up along world y, which is how the env maps are oriented.
+layout(binding = 0) uniform sampler2D heightTexture;
+layout(binding = 1) uniform sampler2D thicknessTexture;
+layout(binding = 2) uniform sampler2D reflectionMap;
+layout(binding = 3) uniform sampler2D irradianceMap;
+layout(location = 0) out vec4 fragmentColor;
+
+uniform vec3 fluidColor;
+uniform float absorption;
+uniform float environmentMultiplier;
+uniform float roughness;
+uniform float reflectionLevels; // Pre-filtered levels in reflectionMap, minus one
+uniform vec3 backgroundColor;
+
+#define PI 3.14159265359
+
+vec2 latLong(vec3 direction) {
+    float theta = acos(clamp(direction.y, -1.0, 1.0));
+    float phi = atan(direction.z, direction.x);
+    if (phi < 0.0) phi += 2.0 * PI;
+    return vec2(phi / (2.0 * PI), 1.0 - theta / PI);
+}
+
+float heightAt(ivec2 pixel) {
+    return texelFetch(heightTexture, max(pixel, ivec2(0)), 0).x;
+}
+
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float height = heightAt(pixel);
+    if (height <= 0.0) {
+        fragmentColor = vec4(backgroundColor, 1.0);
+        return;
+    }
+
+    // One-sided differences towards the neighbour closer in height, so
+    // silhouettes don't pull in the background
+    float left = heightAt(pixel - ivec2(1, 0));
+    float right = heightAt(pixel + ivec2(1, 0));
+    float down = heightAt(pixel - ivec2(0, 1));
+    float up = heightAt(pixel + ivec2(0, 1));
+    float dx = abs(right - height) < abs(height - left) ? right - height : height - left;
+    float dy = abs(up - height) < abs(height - down) ? up - height : height - down;
+    if (left <= 0.0) dx = right - height;
+    if (right <= 0.0) dx = height - left;
+    if (down <= 0.0) dy = up - height;
+    if (up <= 0.0) dy = height - down;
+
+    vec3 screenNormal = normalize(vec3(-dx, -dy, 1.0));
+    vec3 n = vec3(screenNormal.x, screenNormal.z, -screenNormal.y);
+    vec3 wo = vec3(0.0, 1.0, 0.0); // Towards the viewer
+
+    // Refraction: the floor seen through the fluid, tinted by Beer-Lambert absorption
+    float thickness = texelFetch(thicknessTexture, pixel, 0).x;
+    vec3 transmittance = exp(-absorption * thickness * (vec3(1.0) - fluidColor));
+    vec3 refracted = backgroundColor * transmittance
+                   + fluidColor * (vec3(1.0) - transmittance) * environmentMultiplier
+                     * texture(irradianceMap, latLong(n)).rgb;
+
+    // Reflection of the environment, weighted by Schlick's Fresnel (water, F0 = 0.02)
+    vec3 wi = reflect(-wo, n);
+    vec3 reflected = environmentMultiplier * textureLod(reflectionMap, latLong(wi), roughness * reflectionLevels).rgb;
+    float fresnel = 0.02 + 0.98 * pow(1.0 - max(dot(n, wo), 0.0), 5.0);
+
+    fragmentColor = vec4(mix(refracted, reflected, fresnel), 1.0);
+}
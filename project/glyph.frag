@@ -0,0 +1,35 @@
+#version 430
+
+// required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
+precision highp float;
+
+#define GLYPH_ARROW 1
+#define GLYPH_DISK 2
+
+uniform int glyphType;
+uniform float minSpeed;
+uniform float maxSpeed;
+uniform bool colorBySpecies;
+
+layout(location = 0) out vec4 fragmentColor;
+
+in vec2 localPosition;
+flat in vec2 boidSpeed;
+flat in vec3 speciesColor;
+
+void main()
+{
+	// Same speed colouring as shader.frag
+	float speed = length(boidSpeed);
+	float t = clamp((speed - minSpeed) / (maxSpeed - minSpeed), 0.0, 1.0);
+	vec3 color = colorBySpecies ? speciesColor : vec3(t, 1.0 - t, 0.0);
+
+	float alpha = 1.0;
+	if (glyphType == GLYPH_DISK) {
+		// Soft disk, fading out towards the rim
+		float r2 = dot(localPosition, localPosition);
+		if (r2 > 1.0) discard;
+		alpha = (1.0 - r2) * (1.0 - r2);
+	}
+	fragmentColor = vec4(color, alpha);
+}
@@ -0,0 +1,73 @@
+#version 430
+
+// Expands particles into glyphs straight from the particle buffers, no
+// vertex attributes. Each instance draws GLYPHS_PER_INSTANCE glyphs, which
+// keeps the instance count (and its per-instance overhead) low.
+#include "common.glsl"
+
+layout( std430, binding=3 ) readonly buffer ParticleBuffer
+{
+    ParticleData particles[];
+};
+
+layout( std430, binding=7 ) readonly buffer PreviousParticleBuffer
+{
+    ParticleData previousParticles[];
+};
+
+// Must match ParticleGlyph in main.cpp
+#define GLYPH_ARROW 1
+#define GLYPH_DISK 2
+
+uniform int glyphType;
+uniform int verticesPerGlyph;
+uniform float interpolationAlpha = 1.0;
+uniform float glyphSize;   // Radius in pixels
+uniform ivec2 viewportSize;
+
+out vec2 localPosition;
+flat out vec2 boidSpeed;
+flat out vec3 speciesColor;
+
+// Arrow along +x: a shaft and a head, two triangles + one
+const vec2 arrowVertices[9] = vec2[](
+    vec2(-1.0, -0.15), vec2(0.2, -0.15), vec2(0.2, 0.15),
+    vec2(-1.0, -0.15), vec2(0.2, 0.15), vec2(-1.0, 0.15),
+    vec2(0.2, -0.5), vec2(1.0, 0.0), vec2(0.2, 0.5)
+);
+
+const vec2 quadVertices[6] = vec2[](
+    vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(1.0, 1.0),
+    vec2(-1.0, -1.0), vec2(1.0, 1.0), vec2(-1.0, 1.0)
+);
+
+void main()
+{
+    int id = gl_InstanceID * GLYPHS_PER_INSTANCE + gl_VertexID / verticesPerGlyph;
+    int corner = gl_VertexID % verticesPerGlyph;
+    if (uint(id) >= aliveCount) {
+        // Tail of the last instance, collapse to nothing
+        gl_Position = vec4(0.0, 0.0, 0.0, 0.0);
+        return;
+    }
+
+    ParticleData particle = particles[id];
+    vec2 position = mix(previousParticles[id].pos, particle.pos, interpolationAlpha);
+
+    vec2 local;
+    vec2 offset;
+    if (glyphType == GLYPH_ARROW) {
+        local = arrowVertices[corner];
+        float speed = length(particle.vel);
+        vec2 direction = speed > 1e-6 ? particle.vel / speed : vec2(1.0, 0.0);
+        offset = vec2(local.x * direction.x - local.y * direction.y, local.x * direction.y + local.y * direction.x);
+    } else {
+        local = quadVertices[corner];
+        offset = local;
+    }
+
+    localPosition = local;
+    boidSpeed = particle.vel;
+    speciesColor = speciesParams[min(particle.species, uint(MAX_SPECIES - 1))].color.rgb;
+    gl_Position = vec4(position + offset * glyphSize * 2.0 / vec2(viewportSize), 0.0, 1.0);
+}
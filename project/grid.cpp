@@ -0,0 +1,155 @@
+#include "grid.h"
+
+#include <labhelper.h>
+#include <perf.h>
+#include <scan.h>
+#include <sort.h>
+
+#include <cstddef>
+#include <vector>
+
+const char* gridBuilderNames[GRID_BUILDER_COUNT] = { "Atomic counters", "Radix sort (deterministic)" };
+
+namespace
+{
+const GLuint PARTICLE_GROUP_SIZE = 256; // As in common.glsl
+
+// Morton code bits below the bucket in the sort keys, see gridSort.comp
+#if SIMULATION_3D
+const GLuint SUBCELL_BITS = 9; // 8x8x8 positions within a cell
+#else
+const GLuint SUBCELL_BITS = 8; // 16x16 positions within a cell
+#endif
+
+GLuint groupsFor(GLuint count)
+{
+	return (count + PARTICLE_GROUP_SIZE - 1) / PARTICLE_GROUP_SIZE;
+}
+
+// Over the alive particles, with the group count the population pass left on the GPU
+void dispatchParticleGroups(const ParticlePopulation& population)
+{
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, population.buffer());
+	glDispatchComputeIndirect(offsetof(PopulationBlock, particleGroups));
+}
+
+// Bits of the sort keys in gridSort.comp
+GLuint sortKeyBits(const GridSettings& settings, GLuint bucketCount)
+{
+	GLuint bucketBits = 1;
+	while((1u << bucketBits) < bucketCount)
+	{
+		bucketBits++;
+	}
+	return bucketBits + (settings.mortonWithinCells ? SUBCELL_BITS : 0);
+}
+} // namespace
+
+int gridCellCount(int gridSize)
+{
+	int cells = 1;
+	for(int axis = 0; axis < SIMULATION_DIMENSIONS; axis++)
+	{
+		cells *= gridSize;
+	}
+	return cells;
+}
+
+ParticleGrid::ParticleGrid() : prefixSumSSBO(0), bucketSizesSSBO(0), sortPairsSSBO(0), particleCapacity(0) {}
+
+void ParticleGrid::init(GLuint capacity, int maxGridSize)
+{
+	particleCapacity = capacity;
+
+	// Room for one bucket per species in every cell, whether or not they're split
+	const GLuint maxBuckets = gridCellCount(maxGridSize) * MAX_SPECIES;
+	std::vector<GLuint> zeros(maxBuckets + 1, 0);
+
+	glGenBuffers(1, &prefixSumSSBO);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, prefixSumSSBO);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * (maxBuckets + 1), zeros.data(),
+	                GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT | GL_DYNAMIC_STORAGE_BIT);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, prefixSumSSBO);
+
+	glGenBuffers(1, &bucketSizesSSBO);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, bucketSizesSSBO);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * maxBuckets, zeros.data(),
+	                GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT | GL_DYNAMIC_STORAGE_BIT);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, bucketSizesSSBO);
+
+	// Keys for the deterministic build
+	glGenBuffers(1, &sortPairsSSBO);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, sortPairsSSBO);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * 2 * capacity, nullptr, 0);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void ParticleGrid::update(const GridPrograms& programs,
+                          const GridSettings& settings,
+                          const ParticlePopulation& population,
+                          GLuint particleBuffer,
+                          GLuint scratchBuffer)
+{
+	labhelper::perf::Scope s( "Update Grid" );
+	// scanBuffer() and radixSortPairs() only touch bindings 0-2, these stay put
+	const GLuint bucketCount = gridCellCount(settings.gridSize) * settings.bucketsPerCell;
+	const GLuint subcellBits = settings.mortonWithinCells ? SUBCELL_BITS : 0u;
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, particleBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, prefixSumSSBO);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, bucketSizesSSBO);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, scratchBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, sortPairsSSBO);
+	{
+		labhelper::perf::Scope s( "Calculate bucket sizes" );
+		GLuint zero = 0;
+		glClearNamedBufferSubData(bucketSizesSSBO, GL_R32UI, 0, sizeof(GLuint) * bucketCount, GL_RED_INTEGER,
+		                          GL_UNSIGNED_INT, &zero);
+
+		if(settings.builder == GRID_RADIX_SORT)
+		{
+			// Keys for every particle slot, counting the buckets on the way
+			glUseProgram(programs.sort);
+			labhelper::setUniformSlow(programs.sort, "gridSortPass", 0);
+			labhelper::setUniformSlow(programs.sort, "capacity", particleCapacity);
+			labhelper::setUniformSlow(programs.sort, "subcellBits", subcellBits);
+			labhelper::setUniformSlow(programs.sort, "gridSize", settings.gridSize);
+			labhelper::setUniformSlow(programs.sort, "bucketsPerCell", settings.bucketsPerCell);
+			glDispatchCompute(groupsFor(particleCapacity), 1, 1);
+		}
+		else
+		{
+			glUseProgram(programs.count);
+			labhelper::setUniformSlow(programs.count, "gridSize", settings.gridSize);
+			labhelper::setUniformSlow(programs.count, "bucketsPerCell", settings.bucketsPerCell);
+			dispatchParticleGroups(population);
+		}
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+
+	// On the GPU, the bucket sizes never come back
+	{
+		labhelper::perf::Scope s( "Calculate prefix sum" );
+		labhelper::scanBuffer(bucketSizesSSBO, prefixSumSSBO, bucketCount, true);
+	}
+
+	if(settings.builder == GRID_RADIX_SORT)
+	{
+		// A stable sort of the keys, and a gather of the particles in that order
+		labhelper::perf::Scope s( "Sort particles" );
+		labhelper::radixSortPairs(sortPairsSSBO, particleCapacity, sortKeyBits(settings, bucketCount));
+
+		glUseProgram(programs.sort);
+		labhelper::setUniformSlow(programs.sort, "gridSortPass", 1);
+		glDispatchCompute(groupsFor(particleCapacity), 1, 1);
+	}
+	else
+	{
+		labhelper::perf::Scope s( "Reindex particles" );
+		glUseProgram(programs.reindex);
+		labhelper::setUniformSlow(programs.reindex, "bucketsPerCell", settings.bucketsPerCell);
+		dispatchParticleGroups(population);
+	}
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+	glCopyNamedBufferSubData(scratchBuffer, particleBuffer, 0, 0, sizeof(particle) * particleCapacity);
+}
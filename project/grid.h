@@ -0,0 +1,80 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include "particle.h"
+#include "population.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// The uniform grid the neighbour searches run over, rebuilt on the GPU every
+// step. Particles are counted into buckets (a cell, or a cell and species,
+// see neighbors.glsl), the counts are scanned into where each bucket starts
+// and the particles are moved into bucket order. The grid spans the [-1, 1]
+// domain with gridSize cells along each of the SIMULATION_DIMENSIONS axes.
+///////////////////////////////////////////////////////////////////////////////
+enum GridBuilder
+{
+	GRID_ATOMIC,     // grid.comp and reindex.comp, the order within buckets varies between runs
+	GRID_RADIX_SORT, // gridSort.comp and labhelper::radixSortPairs(), bit-identical between runs
+	GRID_BUILDER_COUNT
+};
+
+extern const char* gridBuilderNames[GRID_BUILDER_COUNT];
+
+struct GridPrograms
+{
+	GLuint count;   // grid.comp
+	GLuint reindex; // reindex.comp
+	GLuint sort;    // gridSort.comp
+};
+
+struct GridSettings
+{
+	GridBuilder builder;
+	bool mortonWithinCells; // Order each bucket along a Morton curve rather than by particle id
+	GLint gridSize;
+	GLint bucketsPerCell;   // One per species when they are sorted apart, at most MAX_SPECIES
+};
+
+/**
+	* Cells in a grid with 'gridSize' along each axis.
+	*/
+int gridCellCount(int gridSize);
+
+class ParticleGrid
+{
+public:
+	ParticleGrid();
+
+	/**
+		* Creates the bucket buffers, with room for grids up to 'maxGridSize'
+		* with a bucket per species, and binds them to SSBO bindings 4 (the
+		* prefix sums) and 5 (the bucket sizes), which is where
+		* neighbors.glsl expects them. 'capacity' as in ParticlePopulation.
+		*/
+	void init(GLuint capacity, int maxGridSize);
+
+	// The prefix sums end with the total, see neighbors.glsl
+	GLuint prefixSumBuffer() const { return prefixSumSSBO; }
+	GLuint bucketSizeBuffer() const { return bucketSizesSSBO; }
+
+	/**
+		* Sorts the alive particles of 'particleBuffer' into their buckets. The
+		* reordering goes through 'scratchBuffer', which must hold 'capacity'
+		* particles and is left with the same sorted particles.
+		*/
+	void update(const GridPrograms& programs,
+	            const GridSettings& settings,
+	            const ParticlePopulation& population,
+	            GLuint particleBuffer,
+	            GLuint scratchBuffer);
+
+private:
+	GLuint prefixSumSSBO;
+	GLuint bucketSizesSSBO;
+	GLuint sortPairsSSBO; // (key, particle id) for every particle slot
+	GLuint particleCapacity;
+
+	ParticleGrid(const ParticleGrid&) = delete;
+	ParticleGrid& operator=(const ParticleGrid&) = delete;
+};
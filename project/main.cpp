@@ -6,6 +6,7 @@ extern "C" _declspec(dllexport) unsigned int NvOptimusEnablement = 0x00000001;
 #include <GL/glew.h>
 #include <cmath>
 #include <cstdlib>
+#include <cstddef>
 #include <algorithm>
 #include <chrono>
 
@@ -13,6 +14,11 @@ extern "C" _declspec(dllexport) unsigned int NvOptimusEnablement = 0x00000001;
 #include <imgui.h>
 
 #include <perf.h>
+#include <reduce.h>
+#include <scan.h>
+#include <sort.h>
+#include <random.h>
+#include <shaderpermutations.h>
 
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
@@ -21,20 +27,38 @@ using namespace glm;
 #include <Model.h>
 #include "hdr.h"
 #include "fbo.h"
+#include "particle.h"
+#include "spawn.h"
+#include "cpusim.h"
+#include "obstacle.h"
+#include "population.h"
+#include "grid.h"
+#include "snapshot.h"
+#include "trajectory.h"
+#include "simulation.h"
+#include "pacing.h"
 
 #include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <stb_image_write.h>
 
 
 ///////////////////////////////////////////////////////////////////////////////
 // Various globals
 ///////////////////////////////////////////////////////////////////////////////
 SDL_Window* g_window = nullptr;
+GLuint outputFramebuffer = 0; // The window's, or an FboInfo's when running headless
+const char* glDebugLevelNames[] = { "Off", "Async", "Synchronous" }; // labhelper::GLDebugLevel
 float currentTime = 0.0f;
 float previousTime = 0.0f;
 float deltaTime = 0.0f;
 int windowWidth, windowHeight;
 bool isPaused = false;
 
+// Idle waits, redraws and the frame rate cap, see pacing.h
+FramePacer framePacer;
+
 // Mouse input
 ivec2 g_prevMouseCoords = { -1, -1 };
 bool g_isMouseDragging = false;
@@ -54,18 +78,8 @@ GLuint vao;
 ///////////////////////////////////////////////////////////////////////////////
 // Data for the particles
 ///////////////////////////////////////////////////////////////////////////////
-struct particle {
-	vec2 position;
-	vec2 velocity;
-	uint bucketIndex;
-	uint gridIndex;
-	float density;
-	float padding;
-	vec2 grad;
-};
-
-GLuint posVBO;
 GLuint particleSSBO;
+GLuint previousParticleSSBO; // State at the start of the last step, for render interpolation
 
 
 particle* particles;
@@ -74,6 +88,10 @@ particle* particles;
 // Compute Shader stuff
 ///////////////////////////////////////////////////////////////////////////////
 GLuint computeShaderProgram;
+// particle.comp, specialized on workgroup size, neighbour traversal, kernel and whether the stir tool is active
+labhelper::ShaderPermutations particlePrograms("../project/particle.comp");
+NeighborTraversal neighborTraversal = TRAVERSAL_PER_PARTICLE; // See simulation.h
+SmoothingKernelType smoothingKernel = KERNEL_SPIKY;
 
 float visualRange = 0.25;
 float protectedRange = 0.1;
@@ -85,20 +103,32 @@ float turnFactor = 0.35;
 float minSpeed = 0.2;
 float maxSpeed = 0.3;
 float randFactor = 0.05f;
+float chaseFactor = 0.05f; // Scales the interaction matrix between species of boids
+
+// What the GPU steps: the fluid in particle.comp or the flock in boid.comp
+enum SimulationModel
+{
+	MODEL_FLUID,
+	MODEL_BOIDS,
+	MODEL_COUNT
+};
+const char* simulationModelNames[MODEL_COUNT] = { "Fluid", "Boids" };
+SimulationModel simulationModel = MODEL_FLUID;
+labhelper::ShaderPermutations boidPrograms("../project/boid.comp");
 
 ///////////////////////////////////////////////////////////////////////////////
 // Grid stuffs
 ///////////////////////////////////////////////////////////////////////////////
-GLuint prefixSumSSBO;
-GLuint* prefixSums = nullptr;
-GLuint bucketSizesSSBO;
-GLuint* bucketSizes = nullptr;
+ParticleGrid grid;
+GridPrograms gridPrograms;
 
-GLuint reorderedparticlesSSBO;
+GLuint reorderedparticlesSSBO; // Also the state at the start of the step, see particle.comp
 
-GLuint gridShaderProgram;
 GLuint prefixSumShaderProgram;
-GLuint reindexShaderProgram;
+
+// How the particles are sorted into buckets each step
+GridBuilder gridBuilder = GRID_ATOMIC;
+bool mortonWithinCells = true; // Order each bucket along a Morton curve rather than by particle id
 ///////////////////////////////////////////////////////////////////////////////
 // For blending
 ///////////////////////////////////////////////////////////////////////////////
@@ -106,8 +136,93 @@ FboInfo fbos[2];
 GLuint blendProgram;
 bool additiveBlending = true;
 
-const int NUM_PARTICLES = 20;
-const GLint gridSize = 2;
+// How particles are rasterized. Glyphs are expanded from the particle buffers in glyph.vert.
+enum ParticleGlyph
+{
+	GLYPH_POINTS,
+	GLYPH_ARROWS, // Must match the GLYPH_* defines in glyph.vert / glyph.frag
+	GLYPH_DISKS,
+	GLYPH_COUNT
+};
+const char* particleGlyphNames[GLYPH_COUNT] = { "Points", "Arrows", "Soft disks" };
+ParticleGlyph particleGlyph = GLYPH_POINTS;
+float glyphSize = 6.0f; // Radius in pixels
+GLuint glyphProgram;
+GLuint glyphVAO; // Empty, glyph.vert pulls everything from the SSBOs
+
+enum RenderMode
+{
+	RENDER_COMPUTE_TRAILS, // Accumulated by trails.comp in a packed r32ui image, resolved with one full-screen pass
+	RENDER_CLASSIC_TRAILS, // Scene rendered to fbos[0] and blended into fbos[1]
+	RENDER_FLUID_SURFACE,  // Screen-space fluid, see drawFluidSurface()
+	RENDER_MODE_COUNT
+};
+const char* renderModeNames[RENDER_MODE_COUNT] = { "Compute trails", "Classic trails", "Fluid surface" };
+RenderMode renderMode = RENDER_COMPUTE_TRAILS;
+
+const float particlePointSize = 5.0f;
+GLuint trailShaderProgram;
+GLuint trailResolveProgram;
+FboInfo trailTarget;
+bool trailsCleared = false;
+
+///////////////////////////////////////////////////////////////////////////////
+// Screen-space fluid surface
+///////////////////////////////////////////////////////////////////////////////
+FboInfo fluidDepthTarget;  // Surface height (max blended) and thickness (additive), in pixels
+FboInfo fluidFilterTarget; // Between the two filter directions
+GLuint fluidDepthProgram;
+GLuint fluidFilterProgram;
+GLuint fluidShadeProgram;
+GLuint reflectionMap = 0; // Loaded the first time the fluid path is used
+GLuint irradianceMap = 0;
+const int reflectionMapLevels = 8;
+float fluidParticleRadius = 8.0f; // Pixels
+int fluidFilterRadius = 12;       // Pixels, at most MAX_RADIUS in fluidFilter.comp
+int fluidFilterIterations = 2;
+float fluidFilterRangeSigma = 3.0f;
+vec3 fluidColor = vec3(0.15f, 0.45f, 0.85f);
+float fluidAbsorption = 0.05f;
+float fluidRoughness = 0.1f;
+float environmentMultiplier = 1.0f;
+
+///////////////////////////////////////////////////////////////////////////////
+// Density field, the particle density rasterized to a grid over [-1, 1]^2.
+// Shown as a colormap overlay and sampled by the sim for mouse interaction.
+///////////////////////////////////////////////////////////////////////////////
+labhelper::ShaderPermutations densityPrograms("../project/density.comp"); // One per smoothing kernel
+GLuint densityOverlayProgram;
+GLuint densityAccumulationTexture = 0; // Fixed point, cleared by the resolve
+GLuint densityFieldTexture = 0;
+int densityFieldResolution = 0;        // Of the current textures
+int densityResolution = 256;
+const float densityFixedPointScale = 65536.0f;
+bool showDensityField = false;
+float densityOverlayOpacity = 0.75f;
+bool densityAutoRange = true;
+float densityDisplayMax = 10.0f;
+
+bool mouseInteraction = false;
+float mouseRadius = 0.2f;
+float mouseStrength = 1.0f;
+
+// The particle buffers hold MAX_PARTICLES; how many of them are alive is only
+// known on the GPU, see population.h
+const int MAX_PARTICLES = 4096;
+int spawnCount = 20;
+// Cells per side. Their width must stay at least the smoothing radius, since
+// only the 3x3 cells around a particle are searched.
+const int MAX_GRID_SIZE = 32;
+GLint gridSize = 2;
+
+///////////////////////////////////////////////////////////////////////////////
+// Species, see SpeciesBlock in particle.h
+///////////////////////////////////////////////////////////////////////////////
+SpeciesBlock speciesBlock;
+GLuint speciesSSBO;
+int numSpecies = 1;
+bool sortBySpecies = true; // A bucket per species in each cell, see neighbors.glsl
+bool colorBySpecies = false;
 
 float kernelScalingFactor = 0.5f;
 bool gravityEnabled = false;
@@ -115,179 +230,394 @@ float gravityStrength = 0.1f;
 float smoothingRadius = 0.35f;
 //float smoothingRadius = 2.0f / (float) gridSize;
 
+// Everything random is keyed by (seed, particle id, step, stream), see labhelper/random.h
+GLuint randomSeed = 1234;
 
-void initGrid() {
-	prefixSums = new GLuint[gridSize * gridSize];
-	bucketSizes = new GLuint[gridSize * gridSize];
-	for (int i = 0; i < gridSize * gridSize; i++) {
-		prefixSums[i] = 0;
-		bucketSizes[i] = 0;
-	}
+GLuint spawnShaderProgram;
+SpawnSettings spawnSettings = { SPAWN_UNIFORM, 0, 0.1f, "../scenes/tvTestCard.jpg", 1 };
 
-	glGenBuffers(1, &bucketSizesSSBO);
+///////////////////////////////////////////////////////////////////////////////
+// Sources and sinks, and the alive count they change, see population.h
+///////////////////////////////////////////////////////////////////////////////
+ParticlePopulation population;
+PopulationSettings populationSettings;
+GLuint populationShaderProgram;
 
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, bucketSizesSSBO);
-	glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * gridSize * gridSize, bucketSizes,
-					GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT | GL_DYNAMIC_STORAGE_BIT);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, particleSSBO);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, bucketSizesSSBO);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+///////////////////////////////////////////////////////////////////////////////
+// Obstacle, a signed distance field baked from a mesh section, see obstacle.h
+///////////////////////////////////////////////////////////////////////////////
+ObstacleSettings obstacleSettings = { "", 256, 1, 0.5f, 0.3f, vec2(0.0f), OBSTACLE_BAKE_CPU };
+char obstacleMeshPath[256] = "../scenes/sphere.obj";
+const char* sliceAxisNames[3] = { "X", "Y", "Z" };
+ObstaclePrograms obstaclePrograms;
+GLuint obstacleOverlayProgram;
+GLuint obstacleFieldTexture = 0; // Nothing baked yet
+bool obstacleEnabled = false;
+bool showObstacle = true;
 
-	// printf("Starting grid:\n");
-	// for (int i = 0; i < gridSize * gridSize; i++) {
-	// 	if (i != 0 && (i) % gridSize == 0) printf("\n");
-	// 	printf("%d ", bucketSizes[i]);
-	// }
-	// printf("\n\n");
-}
+///////////////////////////////////////////////////////////////////////////////
+// Simulation scheduling
+///////////////////////////////////////////////////////////////////////////////
+float simTimestep = 1.0f / 120.0f;      // Fixed simulation step
+float minSimTimestep = 1.0f / 2000.0f;  // Lower bound for the adaptive step
+int maxSubSteps = 8;                    // Steps per frame before sim time is dropped
+const float maxFrameTime = 0.25f;       // Longer frames (hitches) are clamped to this
+bool adaptiveTimestep = true;
+float cflNumber = 0.4f;                 // Max fraction of the smoothing radius moved per step
+
+float simTime = 0.0f;
+float simAccumulator = 0.0f;
+float currentSimTimestep = simTimestep;
+float interpolationAlpha = 1.0f;
+int subStepsLastFrame = 0;
+unsigned long long simStepCount = 0;
+
+// Where the steps run. The CPU engine steps on its own thread, see cpusim.h.
+enum SimulationEngine
+{
+	ENGINE_GPU,
+	ENGINE_CPU_THREAD,
+	ENGINE_COUNT
+};
+const char* simulationEngineNames[ENGINE_COUNT] = { "GPU compute", "CPU thread" };
+SimulationEngine simulationEngine = ENGINE_GPU;
+CpuSimulation cpuSimulation;
+CpuSimParams cpuSimParamsSent; // Last sent to the sim thread, to only send changes
+
+// Completed CPU steps are written to a ring of persistently mapped slots and
+// copied into the particle buffers on the GPU, so the upload never stalls
+const int CPU_UPLOAD_SLOTS = 3;
+GLuint cpuUploadBuffer;
+particle* mappedCpuUpload = nullptr; // Each slot holds the previous state, then the current one
+GLsync cpuUploadFences[CPU_UPLOAD_SLOTS] = {};
+int cpuUploadSlot = 0;
+float cpuFrameTimestep = 1.0f; // Of the last uploaded step
+float cpuFrameAge = 0.0f;      // Since it was uploaded, for the interpolation
+// Patch the grid for the particles that changed bucket. Only faster for
+// nearly static flows, see CpuSimulation::patchBuckets().
+bool cpuIncrementalGrid = false;
+float cpuRebuildChurn = 0.01f; // Fraction of them above which it is rebuilt instead
+uint32_t cpuGridMoved = 0;      // Of the last uploaded step
+bool cpuGridRebuilt = true;
+
+// Throughput, measured in sim steps per wall-clock second
+float simStepsPerSecond = 0.0f;
+float stepRateTimer = 0.0f;
+int stepsSinceRateUpdate = 0;
 
-// TODO Maybe do this in a compute shader as well
-void calculatePrefixSum() {
-    prefixSums[0] = 0;
-    for (int i = 1; i < gridSize * gridSize; ++i) {
-        prefixSums[i] = prefixSums[i - 1] + bucketSizes[i - 1];
-    }
+///////////////////////////////////////////////////////////////////////////////
+// Simulation statistics, reduced on the GPU and read back without stalling
+///////////////////////////////////////////////////////////////////////////////
+enum StatSlot
+{
+	STAT_MAX_SPEED,
+	STAT_MASS_SPEED_SQUARED_SUM,
+	STAT_MIN_DENSITY,
+	STAT_MAX_DENSITY,
+	STAT_DENSITY_SUM,
+	STAT_MAX_CELL_COUNT,
+	STAT_ALIVE_COUNT, // Copied over as a uint
+	STAT_SLOT_COUNT
+};
 
-    // Update the GPU buffer with the new prefix sums
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, prefixSumSSBO);
+struct SimulationStats {
+	float maxSpeed;
+	float kineticEnergy;
+	float minDensity;
+	float maxDensity;
+	float meanDensity;
+	float maxCellCount;
+	float meanCellCount;
+	GLuint aliveCount;
+};
 
-    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * gridSize * gridSize, prefixSums);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+GLuint statsSSBO;
+float* mappedStats = nullptr;
+GLsync statsFence = nullptr;
+SimulationStats stats = {};
+bool logStats = true;
+float statsLogTimer = 0.0f;
 
-	// printf("Prefix sums:\n");
-	// for (int i = 0; i < gridSize * gridSize; i++) {
-	// 	if (i != 0 && (i) % gridSize == 0) printf("\n");
-	// 	printf("%d ", prefixSums[i]);
-	// }
-	// printf("\n\n");
-}
+///////////////////////////////////////////////////////////////////////////////
+// Snapshots, written in the background and restored through a compute unpack
+///////////////////////////////////////////////////////////////////////////////
+SnapshotWriter snapshotWriter;
+GLuint snapshotUnpackShaderProgram;
+char snapshotPath[256] = "snapshot.bsnap";
+bool snapshotHalfPositions = false;
+int checkpointInterval = 0; // In sim steps, 0 disables checkpointing
+unsigned long long lastCheckpointStep = 0;
 
-void reindexparticles() {
-	glUseProgram(reindexShaderProgram);
+///////////////////////////////////////////////////////////////////////////////
+// Trajectory recording, every Nth step streamed to disk for offline analysis
+///////////////////////////////////////////////////////////////////////////////
+TrajectoryWriter trajectoryWriter;
+char trajectoryPath[256] = "trajectory.btraj";
+int trajectoryStride = 10;
 
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, particleSSBO);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, prefixSumSSBO);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, bucketSizesSSBO);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, reorderedparticlesSSBO);
 
-	glDispatchCompute(NUM_PARTICLES, 1, 1);
-	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
-	
-	glCopyNamedBufferSubData(reorderedparticlesSSBO, particleSSBO, 0, 0, sizeof(particle) * NUM_PARTICLES);
+int bucketCount()
+{
+	return gridCellCount(gridSize) * bucketsPerCell(sortBySpecies, numSpecies);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Runs the bound program over the alive particles, PARTICLE_GROUP_SIZE per
+/// group, with the group count the population pass left on the GPU
+///////////////////////////////////////////////////////////////////////////////
+void dispatchParticleGroups()
+{
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, population.buffer());
+	glDispatchComputeIndirect(offsetof(PopulationBlock, particleGroups));
 }
 
 void updateGrid() {
-	labhelper::perf::Scope s( "Update Grid" );
-	{
-		labhelper::perf::Scope s( "Calculate bucket sizes" );
-		// Reset bucketSizes buffer on the GPU
-		memset(bucketSizes, 0, sizeof(GLuint) * gridSize * gridSize);
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, bucketSizesSSBO);
-		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * gridSize * gridSize, bucketSizes);
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-		
-		// Dispatch compute shader to calculate bucket sizes
-		glUseProgram(gridShaderProgram);
-		labhelper::setUniformSlow(gridShaderProgram, "gridSize", gridSize);
-		// labhelper::setUniformSlow(gridShaderProgram, "gridCellSize", 1.0f / gridSize);
-		glDispatchCompute(NUM_PARTICLES, 1, 1);
-		glMemoryBarrier(GL_ALL_BARRIER_BITS);
-
-		// Map bucketSizes buffer back to CPU
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, bucketSizesSSBO);
-		bucketSizes = (GLuint*)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, sizeof(uint) * gridSize * gridSize, GL_MAP_READ_BIT | GL_MAP_WRITE_BIT);
-		if (bucketSizes == nullptr) {
-			printf("Error: Failed to map bucketSizes buffer.\n");
-			return;
-		}
+	GridSettings settings;
+	settings.builder = gridBuilder;
+	settings.mortonWithinCells = mortonWithinCells;
+	settings.gridSize = gridSize;
+	settings.bucketsPerCell = bucketsPerCell(sortBySpecies, numSpecies);
+	grid.update(gridPrograms, settings, population, particleSSBO, reorderedparticlesSSBO);
+}
 
-		// Unmap the buffer
-		if (!glUnmapBuffer(GL_SHADER_STORAGE_BUFFER)) {
-			printf("Error: Failed to unmap bucketSizes buffer.\n");
-			return;
-		}
+// Sends the first 'count' particles, the rest of the buffer is left alone
+void updateparticleVertices(GLuint count)
+{
+	// The particle SSBO doubles as the vertex buffer
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBO);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(particle) * count, particles);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void resetSimulationClock()
+{
+	simTime = 0.0f;
+	simAccumulator = 0.0f;
+	simStepCount = 0;
+	interpolationAlpha = 1.0f;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// The settings the CPU engine steps with, see cpusim.h
+///////////////////////////////////////////////////////////////////////////////
+CpuSimParams cpuSimParams()
+{
+	CpuSimParams params;
+	// Compared bytewise against the last ones sent, so clear the padding too
+	memset(&params, 0, sizeof(params));
+	params.timestep = simTimestep;
+	params.minTimestep = minSimTimestep;
+	params.maxSubSteps = maxSubSteps;
+	params.adaptiveTimestep = adaptiveTimestep;
+	params.cflNumber = cflNumber;
+	params.smoothingRadius = smoothingRadius;
+	params.gravityEnabled = gravityEnabled;
+	params.gravityStrength = gravityStrength;
+	params.gridSize = gridSize;
+	params.bucketsPerCell = bucketsPerCell(sortBySpecies, numSpecies);
+	params.incrementalGrid = cpuIncrementalGrid;
+	params.rebuildChurn = cpuRebuildChurn;
+	params.species = speciesBlock;
+	return params;
+}
+
+// The alive ones, waiting for the GPU
+std::vector<particle> readParticles()
+{
+	std::vector<particle> result(population.readAliveCount());
+	glGetNamedBufferSubData(particleSSBO, 0, sizeof(particle) * result.size(), result.data());
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Hands the particles over between the engines. Both keep the state in
+/// particleSSBO, the CPU engine through its uploads.
+///////////////////////////////////////////////////////////////////////////////
+void setSimulationEngine(SimulationEngine engine)
+{
+	if (engine == simulationEngine)
+	{
+		return;
+	}
+	simulationEngine = engine;
+	if (engine == ENGINE_CPU_THREAD)
+	{
+		cpuSimParamsSent = cpuSimParams();
+		cpuSimulation.start(readParticles(), simStepCount, simTime, cpuSimParamsSent, isPaused);
+		cpuFrameTimestep = simTimestep;
+		cpuFrameAge = 0.0f;
+	}
+	else
+	{
+		cpuSimulation.stop();
+		simAccumulator = 0.0f;
+		interpolationAlpha = 1.0f;
 	}
+}
 
-    // Calculate prefix sum on the CPU
+// The particles were replaced on the GPU, the CPU engine has to start over from them
+void resetCpuSimulation()
+{
+	if (simulationEngine == ENGINE_CPU_THREAD)
 	{
-		labhelper::perf::Scope s( "Calculate prefix sum" );
-		calculatePrefixSum();
+		cpuSimulation.reset(readParticles(), simStepCount, simTime);
 	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Copies a step published by the sim thread into the next upload slot and
+/// from there into the particle buffers. A slot is only reused once the GPU
+/// copies out of it have completed.
+///////////////////////////////////////////////////////////////////////////////
+void uploadCpuFrame(const CpuSimFrame& frame)
+{
+	labhelper::perf::Scope s( "Upload CPU step" );
 
+	GLsync& fence = cpuUploadFences[cpuUploadSlot];
+	if (fence != nullptr)
 	{
-		labhelper::perf::Scope s( "Reindex particles" );
-		reindexparticles();
+		glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+		glDeleteSync(fence);
+		fence = nullptr;
 	}
 
-	// for (int i = 0; i < NUM_PARTICLES; i++) {
-	// 	printf("particle %d: (%.2f, %.2f) -> %d, %d\n", i, particles[i].position.x, particles[i].position.y, particles[i].gridIndex, particles[i].bucketIndex);
-	// }
-	// printf("BucketSizes:\n");
-	// for (int i = 0; i < gridSize * gridSize; i++) {
-	// 	if (i != 0 && (i) % gridSize == 0) printf("\n");
-	// 	printf("%d ", bucketSizes[i]);
-	// }
-	// printf("\n\n");
+	// The CPU engine has no sources or sinks, so this is the alive count it was started with
+	const GLsizeiptr size = sizeof(particle) * frame.particles.size();
+	particle* slot = mappedCpuUpload + cpuUploadSlot * 2 * MAX_PARTICLES;
+	memcpy(slot, frame.previous.data(), size);
+	memcpy(slot + MAX_PARTICLES, frame.particles.data(), size);
+
+	const GLintptr offset = sizeof(particle) * cpuUploadSlot * 2 * MAX_PARTICLES;
+	glCopyNamedBufferSubData(cpuUploadBuffer, previousParticleSSBO, offset, 0, size);
+	glCopyNamedBufferSubData(cpuUploadBuffer, particleSSBO, offset + sizeof(particle) * MAX_PARTICLES, 0, size);
+	// For the bucket statistics
+	glNamedBufferSubData(grid.bucketSizeBuffer(), 0, sizeof(GLuint) * frame.bucketSizes.size(), frame.bucketSizes.data());
+
+	fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	cpuUploadSlot = (cpuUploadSlot + 1) % CPU_UPLOAD_SLOTS;
 }
 
 void initializeparticles()
 {
-	float margin = 0.1f; // Margin to avoid particles being too close to the edges
-	float range = 1.0f - margin;
+	labhelper::perf::Scope s( "Spawn particles" );
 
-	particles = new particle[NUM_PARTICLES];
+	spawnSettings.seed = randomSeed;
+	bool spawned = false;
+	if (isGPUSpawnLayout(spawnSettings.layout))
+	{
+		spawnParticlesGPU(spawnShaderProgram, particleSSBO, spawnCount, spawnSettings);
+		spawned = true;
+	}
+	else if (spawnParticlesCPU(particles, spawnCount, spawnSettings))
+	{
+		updateparticleVertices(spawnCount);
+		spawned = true;
+	}
 
-	for (int i = 0; i < NUM_PARTICLES; ++i)
+	if (!spawned)
 	{
-		// Generate random position within the range [-1 + margin, 1 - margin]
-        float x = margin + static_cast<float>(rand()) / RAND_MAX * (2.0f * range) - range;
-        float y = margin + static_cast<float>(rand()) / RAND_MAX * (2.0f * range) - range;
+		// Fall back to something that can't fail
+		spawnSettings.layout = SPAWN_UNIFORM;
+		spawnParticlesGPU(spawnShaderProgram, particleSSBO, spawnCount, spawnSettings);
+	}
+	population.reset(populationShaderProgram, spawnCount);
 
-        // Add slight random perturbation
-        float perturbationX = (static_cast<float>(rand()) / RAND_MAX - 0.5f) * 0.05f;
-        float perturbationY = (static_cast<float>(rand()) / RAND_MAX - 0.5f) * 0.05f;
+	// Nothing to interpolate from yet
+	glCopyNamedBufferSubData(particleSSBO, previousParticleSSBO, 0, 0, sizeof(particle) * MAX_PARTICLES);
+	resetSimulationClock();
+	resetCpuSimulation();
+}
 
-        particles[i].position = vec2(x + perturbationX, y + perturbationY);
+bool saveSnapshot(const std::string& path)
+{
+	SnapshotHeader header;
+	// The writer trims it to the alive count once the copy has landed
+	initSnapshotHeader(header, MAX_PARTICLES, snapshotHalfPositions);
+	header.gridSize = gridSize;
+	header.step = simStepCount;
+	header.simTime = simTime;
+	header.smoothingRadius = smoothingRadius;
+	header.kernelScalingFactor = kernelScalingFactor;
+	header.gravityStrength = gravityStrength;
+	header.gravityEnabled = gravityEnabled;
+	header.seed = randomSeed;
+	header.speciesCount = GLuint(numSpecies);
+	header.nextId = population.nextId();
+	return snapshotWriter.request(particleSSBO, header, path, population.buffer());
+}
 
-        // Initialize velocity with a random direction and magnitude
-        //float angle = static_cast<float>(rand()) / RAND_MAX * 2.0f * M_PI;
-        //float speed = minSpeed + static_cast<float>(rand()) / RAND_MAX * (maxSpeed - minSpeed);
-        //particles[i].velocity = vec2(cos(angle), sin(angle)) * speed;
-		particles[i].velocity = vec2(0.0f); // Start with zero velocity
+void restoreSnapshot(const std::string& path)
+{
+	labhelper::perf::Scope s( "Load snapshot" );
 
-		// Initialize bucket index and grid index
-		particles[i].bucketIndex = 0;
-		particles[i].gridIndex = 0;
+	// Don't race the writer if it's still busy with the same file
+	snapshotWriter.finish();
 
-		// Initialize density to zero
-		particles[i].density = 0.0f;
+	SnapshotHeader header;
+	if (!loadSnapshot(path, particleSSBO, snapshotUnpackShaderProgram, MAX_PARTICLES, header))
+	{
+		return;
+	}
+	population.reset(populationShaderProgram, header.particleCount, header.nextId);
+	if (header.gridSize >= 1 && header.gridSize <= GLuint(MAX_GRID_SIZE))
+	{
+		gridSize = GLint(header.gridSize);
+	}
+	else
+	{
+		printf("Snapshot was taken with grid size %u, running with %d\n", header.gridSize, gridSize);
 	}
 
-    // // Calculate the angular spacing between particles
-    // float angleStep = 2.0f * M_PI / NUM_PARTICLES;
-	// particles = new particle[NUM_PARTICLES];
-
-    // for (int i = 0; i < NUM_PARTICLES; ++i)
-    // {
-    //     // Calculate the angle for this particle
-    //     float angle = i * angleStep;
-
-	// 	// Everything spawns in the middle
-	// 	particles[i].position = vec2(0.0f);
-
-    //     // Set the velocity to point away from the center (is already normalized due to being on identity circle)
-    //     particles[i].velocity = vec2(cos(angle), sin(angle));
-		
-	// 	particles[i].position += vec2((float) i * 0.5 / (float) NUM_PARTICLES) * particles[i].velocity;
-    // }
+	smoothingRadius = header.smoothingRadius;
+	kernelScalingFactor = header.kernelScalingFactor;
+	gravityStrength = header.gravityStrength;
+	gravityEnabled = header.gravityEnabled != 0;
+	randomSeed = header.seed;
+	numSpecies = clamp(int(header.speciesCount), 1, MAX_SPECIES);
+	spawnSettings.speciesCount = numSpecies;
+
+	glCopyNamedBufferSubData(particleSSBO, previousParticleSSBO, 0, 0, sizeof(particle) * MAX_PARTICLES);
+	resetSimulationClock();
+	simTime = header.simTime;
+	simStepCount = header.step;
+	lastCheckpointStep = simStepCount;
+	resetCpuSimulation();
 }
 
-void updateparticleVertices()
+///////////////////////////////////////////////////////////////////////////////
+/// One step of boid.comp over the alive particles, on the grid particle.comp
+/// uses, with the species interaction matrix steering species apart or
+/// together
+///////////////////////////////////////////////////////////////////////////////
+void updateBoids(float deltaTime)
 {
-	glUseProgram(shaderProgram);
-	glBindBuffer(GL_ARRAY_BUFFER, posVBO);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(particle) * NUM_PARTICLES, particles); // Update the VBO with current particle data
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	GLuint boidProgram = boidPrograms.get(simulationDefines());
+	glUseProgram(boidProgram);
+
+	labhelper::setUniformSlow(boidProgram, "deltaTime", deltaTime);
+	labhelper::setUniformSlow(boidProgram, "seed", randomSeed);
+	labhelper::setUniformSlow(boidProgram, "step", GLuint(simStepCount));
+	labhelper::setUniformSlow(boidProgram, "gridSize", gridSize);
+	labhelper::setUniformSlow(boidProgram, "bucketsPerCell", bucketsPerCell(sortBySpecies, numSpecies));
+	// The neighbour search only reaches the adjacent cells
+	labhelper::setUniformSlow(boidProgram, "visualRange", std::min(visualRange, 2.0f / (float)gridSize));
+	labhelper::setUniformSlow(boidProgram, "protectedRange", protectedRange);
+	labhelper::setUniformSlow(boidProgram, "centeringFactor", centeringFactor);
+	labhelper::setUniformSlow(boidProgram, "matchingFactor", matchingFactor);
+	labhelper::setUniformSlow(boidProgram, "avoidFactor", avoidFactor);
+	labhelper::setUniformSlow(boidProgram, "borderMargin", borderMargin);
+	labhelper::setUniformSlow(boidProgram, "turnFactor", turnFactor);
+	labhelper::setUniformSlow(boidProgram, "minSpeed", minSpeed);
+	labhelper::setUniformSlow(boidProgram, "maxSpeed", maxSpeed);
+	labhelper::setUniformSlow(boidProgram, "randFactor", randFactor);
+	labhelper::setUniformSlow(boidProgram, "chaseFactor", chaseFactor);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, particleSSBO);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, grid.prefixSumBuffer());
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, reorderedparticlesSSBO);
+
+	dispatchParticleGroups();
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
 }
 
 void updateparticlePositions(float deltaTime, bool use_GPU)
@@ -302,23 +632,37 @@ void updateparticlePositions(float deltaTime, bool use_GPU)
 				1.0f - (2.0f * (float)mousePos.y) / (float)windowHeight);
 
 			printf("%.2f, %.2f \n", (float) mouseNDC.x, (float)mouseNDC.y);
-			for (int i = 0; i < NUM_PARTICLES; i++)
+			// Only the alive particles make the round trip
+			const GLuint aliveCount = population.readAliveCount();
+			glGetNamedBufferSubData(particleSSBO, 0, sizeof(particle) * aliveCount, particles);
+			for (GLuint i = 0; i < aliveCount; i++)
 			{
 				// Move particles toward the mouse position
 				vec2 direction = normalize(mouseNDC - particles[i].position);
 				particles[i].velocity = direction * maxSpeed;
 				particles[i].position += particles[i].velocity * deltaTime;
 			}
-			updateparticleVertices();
+			updateparticleVertices(aliveCount);
 			return;
 		}
 
-		if (use_GPU) {
+		if (use_GPU && simulationModel == MODEL_BOIDS) {
+			updateBoids(deltaTime);
+		}
+		else if (use_GPU) {
+			computeShaderProgram =
+			    particlePrograms.get(
+			    particlePermutation(neighborTraversal, smoothingKernel, mouseInteraction && g_isMouseDragging,
+			                        bucketsPerCell(sortBySpecies, numSpecies)));
 			glUseProgram(computeShaderProgram);
 
 			labhelper::setUniformSlow(computeShaderProgram, "deltaTime", deltaTime);
-			labhelper::setUniformSlow(computeShaderProgram, "time", currentTime);
+			labhelper::setUniformSlow(computeShaderProgram, "time", simTime);
+			labhelper::setUniformSlow(computeShaderProgram, "seed", randomSeed);
+			labhelper::setUniformSlow(computeShaderProgram, "step", GLuint(simStepCount));
 			labhelper::setUniformSlow(computeShaderProgram, "gridSize", gridSize);
+			labhelper::setUniformSlow(computeShaderProgram, "bucketsPerCell", bucketsPerCell(sortBySpecies, numSpecies));
+			labhelper::setUniformSlow(computeShaderProgram, "numSpecies", numSpecies);
 
 			float mouseX = (2.0f * mousePos.x) / windowWidth - 1.0f;
 			float mouseY = 1.0f - (2.0f * mousePos.y) / windowHeight;
@@ -329,218 +673,914 @@ void updateparticlePositions(float deltaTime, bool use_GPU)
 			labhelper::setUniformSlow(computeShaderProgram, "smoothingRadius", smoothingRadius);
 			labhelper::setUniformSlow(computeShaderProgram, "gravityEnabled", gravityEnabled);
 			labhelper::setUniformSlow(computeShaderProgram, "gravityStrength", gravityStrength);
+			labhelper::setUniformSlow(computeShaderProgram, "mouseRadius", mouseRadius);
+			labhelper::setUniformSlow(computeShaderProgram, "mouseStrength", mouseStrength);
+			labhelper::setUniformSlow(computeShaderProgram, "obstacleEnabled", obstacleEnabled && obstacleFieldTexture != 0);
+			glActiveTexture(GL_TEXTURE1);
+			glBindTexture(GL_TEXTURE_2D, obstacleFieldTexture);
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, densityFieldTexture);
 
-			// labhelper::setUniformSlow(computeShaderProgram, "visualRange", visualRange);
-			// labhelper::setUniformSlow(computeShaderProgram, "protectedRange", protectedRange);
-			// labhelper::setUniformSlow(computeShaderProgram, "centeringFactor", centeringFactor);
-			// labhelper::setUniformSlow(computeShaderProgram, "matchingFactor", matchingFactor);
-			// labhelper::setUniformSlow(computeShaderProgram, "avoidFactor", avoidFactor);
-			// labhelper::setUniformSlow(computeShaderProgram, "borderMargin", borderMargin);
-			// labhelper::setUniformSlow(computeShaderProgram, "turnFactor", turnFactor);
-			// labhelper::setUniformSlow(computeShaderProgram, "minSpeed", minSpeed);
-			// labhelper::setUniformSlow(computeShaderProgram, "maxSpeed", maxSpeed);
-			// labhelper::setUniformSlow(computeShaderProgram, "randFactor", randFactor);
-
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBO);
 			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, particleSSBO);
-			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, prefixSumSSBO);
-
-			GLint bufMask = GL_MAP_WRITE_BIT;
-
-			// printf("Positions before shader: ");
-			// for (int i = 0; i < NUM_PARTICLES; i++) {
-			// 	printf("(%.2f, %.2f), ", particles[i].position.x, particles[i].position.y);
-			// }
-			// printf("\n");
-			
-			glDispatchCompute(NUM_PARTICLES, 1, 1);
-			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, grid.prefixSumBuffer());
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, reorderedparticlesSSBO);
 
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBO);
-			particles = (particle*) glMapBufferRange( GL_SHADER_STORAGE_BUFFER, 0, sizeof(particle) * NUM_PARTICLES, bufMask);
-			if (particles == nullptr) {
-				printf("Error: Failed to map buffer.\n");
-				return;
+			if (neighborTraversal == TRAVERSAL_TILED)
+			{
+				// A workgroup per cell, whichever are empty return right away
+				glDispatchCompute(gridSize, gridSize, 1);
 			}
-			// printf("Positions after shader: ");
-			// for (int i = 0; i < NUM_PARTICLES; i++) {
-			// 	printf("(%.2f, %.2f), ", particles[i].position.x, particles[i].position.y);			
-			// }
-			// printf("\n\n");
-
-			printf("0: Pos: (%.3f, %.3f), Density: %.3f, Gradient: (%.3f, %.3f)\n", particles[0].position.x, particles[0].position.y, particles[0].density, particles[0].grad.x, particles[0].grad.y);
-			printf("1: Pos: (%.3f, %.3f), Density: %.3f, Gradient: (%.3f, %.3f)\n", particles[1].position.x, particles[1].position.y, particles[1].density, particles[1].grad.x, particles[1].grad.y);
-			//printf("%.2f\n", mouseX);
-			
-			if (!glUnmapBuffer(GL_SHADER_STORAGE_BUFFER)) {
-				printf("Error: Failed to unmap buffer.\n");
-				return;
+			else
+			{
+				dispatchParticleGroups();
 			}
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
 		}
 		else {
-			for (int i = 0; i < NUM_PARTICLES; i++) {
+			for (int i = 0; i < MAX_PARTICLES; i++) {
 				particles[i].position += vec2(0.01f) * deltaTime;
 			}
+			updateparticleVertices(MAX_PARTICLES);
 		}
-
-		updateparticleVertices();
 	}
 }
 
-void loadShaders(bool is_reload)
+///////////////////////////////////////////////////////////////////////////////
+/// (Re)creates the density field textures when the resolution changes
+///////////////////////////////////////////////////////////////////////////////
+void resizeDensityField(int resolution)
 {
-	GLuint shader = labhelper::loadShaderProgram("../project/shader.vert", "../project/shader.frag", is_reload);
-	if(shader != 0)
+	if (resolution == densityFieldResolution)
 	{
-		shaderProgram = shader;
+		return;
 	}
+	glDeleteTextures(1, &densityAccumulationTexture);
+	glDeleteTextures(1, &densityFieldTexture);
+
+	glGenTextures(1, &densityAccumulationTexture);
+	glBindTexture(GL_TEXTURE_2D, densityAccumulationTexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32UI, resolution, resolution);
+	// Only the resolve clears it, so start from zero
+	GLuint zero = 0;
+	glClearTexImage(densityAccumulationTexture, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+	glGenTextures(1, &densityFieldTexture);
+	glBindTexture(GL_TEXTURE_2D, densityFieldTexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32F, resolution, resolution);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	float empty = 0.0f;
+	glClearTexImage(densityFieldTexture, 0, GL_RED, GL_FLOAT, &empty);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	densityFieldResolution = resolution;
+}
 
-	// shader = labhelper::loadComputeShaderProgram("../project/particle.comp", is_reload);
-	// if(shader != 0)
-	// {
-	// 	computeShaderProgram = shader;
-	// }
-	
-	shader = labhelper::loadComputeShaderProgram("../project/particle.comp", is_reload);
-	if(shader != 0)
+///////////////////////////////////////////////////////////////////////////////
+/// Splats every particle's kernel into the density grid with fixed-point
+/// atomics and resolves the sums to a float texture
+///////////////////////////////////////////////////////////////////////////////
+void rasterizeDensityField()
+{
+	labhelper::perf::Scope s( "Density field" );
+
+	resizeDensityField(densityResolution);
+
+	GLuint densityShaderProgram = densityPrograms.get(kernelPermutation(smoothingKernel));
+	glUseProgram(densityShaderProgram);
+	glBindImageTexture(0, densityAccumulationTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+	glBindImageTexture(1, densityFieldTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, particleSSBO);
+	labhelper::setUniformSlow(densityShaderProgram, "resolution", densityFieldResolution);
+	labhelper::setUniformSlow(densityShaderProgram, "smoothingRadius", smoothingRadius);
+	labhelper::setUniformSlow(densityShaderProgram, "fixedPointScale", densityFixedPointScale);
+
+	// One workgroup per particle, looping if there are more than a dispatch allows
+	labhelper::setUniformSlow(densityShaderProgram, "densityPass", 0);
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, population.buffer());
+	glDispatchComputeIndirect(offsetof(PopulationBlock, particleWorkgroups));
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+	const GLuint groups = (densityFieldResolution + 15) / 16;
+	labhelper::setUniformSlow(densityShaderProgram, "densityPass", 1);
+	glDispatchCompute(groups, groups, 1);
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Kicks off the GPU reductions for the simulation statistics. The results
+/// are picked up by pollSimulationStats() once the GPU is done, so they lag
+/// a frame or so behind.
+///////////////////////////////////////////////////////////////////////////////
+void requestSimulationStats()
+{
+	if (statsFence != nullptr)
 	{
-		computeShaderProgram = shader;
+		return; // Previous request still in flight
 	}
 
-	shader = labhelper::loadShaderProgram("../project/blend.vert", "../project/blend.frag", is_reload);
-	if(shader != 0)
+	labhelper::perf::Scope s( "Reduce stats" );
+	using labhelper::ReduceField;
+	using labhelper::ReduceOp;
+	using labhelper::ReduceTransform;
+
+	float masses[MAX_SPECIES];
+	for (int i = 0; i < MAX_SPECIES; i++)
 	{
-		blendProgram = shader;
+		masses[i] = speciesBlock.species[i].mass;
 	}
 
-	shader = labhelper::loadComputeShaderProgram("../project/grid.comp", is_reload);
-	if(shader != 0)
+	const GLuint stride = sizeof(particle);
+	const ReduceField velocity(offsetof(particle, velocity), stride, 2, ReduceTransform::Length);
+	ReduceField massSpeedSquared(offsetof(particle, velocity), stride, 2, ReduceTransform::LengthSquared);
+	massSpeedSquared.weightedBy(offsetof(particle, species), masses, MAX_SPECIES); // m * |v|^2
+	const ReduceField density(offsetof(particle, density), stride);
+	// A cell's buckets are adjacent, one per species when sorting by species, and summed into its count
+	const GLuint cellBuckets = bucketsPerCell(sortBySpecies, numSpecies);
+	const ReduceField cellCount(0, sizeof(GLuint) * cellBuckets, cellBuckets, ReduceTransform::ComponentSum, true);
+
+	// Only over the alive particles, counted on the GPU
+	const GLuint alive = population.buffer();
+	const GLuint aliveIndex = offsetof(PopulationBlock, aliveCount) / sizeof(GLuint);
+	labhelper::reduceBuffer(particleSSBO, alive, aliveIndex, MAX_PARTICLES, velocity, ReduceOp::Max, statsSSBO, STAT_MAX_SPEED);
+	labhelper::reduceBuffer(particleSSBO, alive, aliveIndex, MAX_PARTICLES, massSpeedSquared, ReduceOp::Sum, statsSSBO, STAT_MASS_SPEED_SQUARED_SUM);
+	labhelper::reduceBuffer(particleSSBO, alive, aliveIndex, MAX_PARTICLES, density, ReduceOp::Min, statsSSBO, STAT_MIN_DENSITY);
+	labhelper::reduceBuffer(particleSSBO, alive, aliveIndex, MAX_PARTICLES, density, ReduceOp::Max, statsSSBO, STAT_MAX_DENSITY);
+	labhelper::reduceBuffer(particleSSBO, alive, aliveIndex, MAX_PARTICLES, density, ReduceOp::Sum, statsSSBO, STAT_DENSITY_SUM);
+	labhelper::reduceBuffer(grid.bucketSizeBuffer(), gridCellCount(gridSize), cellCount, ReduceOp::Max, statsSSBO, STAT_MAX_CELL_COUNT);
+	// Rides along with the rest, so the count reaches the CPU without a stall
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	glCopyNamedBufferSubData(population.buffer(), statsSSBO, offsetof(PopulationBlock, aliveCount),
+	                         sizeof(float) * STAT_ALIVE_COUNT, sizeof(GLuint));
+	glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+
+	statsFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void pollSimulationStats()
+{
+	if (statsFence == nullptr)
 	{
-		gridShaderProgram = shader;
+		return;
 	}
 
-	shader = labhelper::loadComputeShaderProgram("../project/reindex.comp", is_reload);
-	if (shader != 0) {
-		reindexShaderProgram = shader;
+	GLenum status = glClientWaitSync(statsFence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+	if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+	{
+		stats.maxSpeed = mappedStats[STAT_MAX_SPEED];
+		stats.kineticEnergy = 0.5f * mappedStats[STAT_MASS_SPEED_SQUARED_SUM];
+		stats.minDensity = mappedStats[STAT_MIN_DENSITY];
+		stats.maxDensity = mappedStats[STAT_MAX_DENSITY];
+		memcpy(&stats.aliveCount, &mappedStats[STAT_ALIVE_COUNT], sizeof(GLuint));
+		stats.meanDensity = stats.aliveCount > 0 ? mappedStats[STAT_DENSITY_SUM] / stats.aliveCount : 0.0f;
+		stats.maxCellCount = mappedStats[STAT_MAX_CELL_COUNT];
+		stats.meanCellCount = float(stats.aliveCount) / float(gridCellCount(gridSize));
+		glDeleteSync(statsFence);
+		statsFence = nullptr;
 	}
+}
 
-	// shader = labhelper::loadComputeShaderProgram("../project/prefixSum.comp", is_reload);
-	// if(shader != 0)
-	// {
-	// 	prefixSumShaderProgram = shader;
-	// }
+void logSimulationStats(float frameTime)
+{
+	statsLogTimer += frameTime;
+	if (!logStats || statsLogTimer < 1.0f)
+	{
+		return;
+	}
+	statsLogTimer = 0.0f;
+	printf("step %llu: %u particles, max speed %.4f, kinetic energy %.4f, density min/max/mean %.3f/%.3f/%.3f, "
+	       "particles per cell max/mean %.0f/%.2f\n",
+	       simStepCount, stats.aliveCount, stats.maxSpeed, stats.kineticEnergy, stats.minDensity, stats.maxDensity,
+	       stats.meanDensity, stats.maxCellCount, stats.meanCellCount);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-/// This function is called once at the start of the program and never again
+/// Advances the GPU simulation by the elapsed frame time in fixed (or
+/// CFL-limited) steps and returns how many it took. Leftover time is carried
+/// to the next frame and used to interpolate the rendered positions between
+/// the last two simulation states.
 ///////////////////////////////////////////////////////////////////////////////
-void initialize()
+int stepGPUSimulation(float frameTime)
 {
-	ENSURE_INITIALIZE_ONLY_ONCE();
+	currentSimTimestep = simTimestep;
+	if (adaptiveTimestep && stats.maxSpeed > 0.0f)
+	{
+		// CFL condition: no particle may cross more than a fraction of the smoothing radius per step
+		float cflTimestep = cflNumber * smoothingRadius / stats.maxSpeed;
+		currentSimTimestep = clamp(cflTimestep, minSimTimestep, simTimestep);
+	}
 
-	///////////////////////////////////////////////////////////////////////
-	//		Load Shaders
-	///////////////////////////////////////////////////////////////////////
-	loadShaders(false);
+	simAccumulator += std::min(frameTime, maxFrameTime);
 
-	
-	initializeparticles();
+	int steps = std::min(int(simAccumulator / currentSimTimestep), maxSubSteps);
+	for (int i = 0; i < steps; i++)
+	{
+		// Sinks, compaction and the grid update all reorder the particles, so
+		// they have to come before the interpolation source is captured
+		population.update(populationShaderProgram, populationSettings, particleSSBO, reorderedparticlesSSBO,
+		                  currentSimTimestep, randomSeed, GLuint(simStepCount));
+		updateGrid();
+		if (i == steps - 1)
+		{
+			glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+			glCopyNamedBufferSubData(particleSSBO, previousParticleSSBO, 0, 0, sizeof(particle) * MAX_PARTICLES);
+		}
+		updateparticlePositions(currentSimTimestep, true);
 
-	///////////////////////////////////////////////////////////////////////
-	// Generate and bind buffers for graphics pipeline
-	///////////////////////////////////////////////////////////////////////
-	glGenBuffers(1, &posVBO);
-	glBindBuffer(GL_ARRAY_BUFFER, posVBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(particle) * NUM_PARTICLES, particles, GL_DYNAMIC_DRAW);
+		simAccumulator -= currentSimTimestep;
+		simTime += currentSimTimestep;
+		simStepCount++;
 
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
+		if (trajectoryWriter.isOpen() && simStepCount % trajectoryWriter.stepStride() == 0)
+		{
+			trajectoryWriter.record(particleSSBO, simStepCount, simTime, population.buffer());
+		}
+	}
 
-	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(particle), 0);
-	glEnableVertexAttribArray(0);
+	// Too far behind to catch up, drop the backlog instead of spiralling
+	if (steps == maxSubSteps && simAccumulator >= currentSimTimestep)
+	{
+		simAccumulator = fmodf(simAccumulator, currentSimTimestep);
+	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+	interpolationAlpha = simAccumulator / currentSimTimestep;
+	return steps;
+}
 
-	///////////////////////////////////////////////////////////////////////
-	// Generate and bind buffers for compute shaders
-	///////////////////////////////////////////////////////////////////////
-	// Positions
-	glGenBuffers(1, &particleSSBO);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBO);
-	glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(particle) * NUM_PARTICLES, particles,
-					GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT | GL_DYNAMIC_STORAGE_BIT);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, particleSSBO);
+///////////////////////////////////////////////////////////////////////////////
+/// The CPU engine's counterpart of stepGPUSimulation(): sends it the settings
+/// that changed and uploads the latest step it completed, if any. Returns the
+/// number of steps it took since the last upload.
+///////////////////////////////////////////////////////////////////////////////
+int receiveCpuSimulation(float frameTime)
+{
+	CpuSimParams params = cpuSimParams();
+	if (memcmp(&params, &cpuSimParamsSent, sizeof(params)) != 0)
+	{
+		cpuSimulation.setParams(params);
+		cpuSimParamsSent = params;
+	}
 
-	///////////////////////////////////////////////////////////////////////
-	// Generate and bind buffers for compute shaders
-	///////////////////////////////////////////////////////////////////////
-	// Grid
-	glGenBuffers(1, &prefixSumSSBO);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, prefixSumSSBO);
-	glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * gridSize * gridSize, prefixSums,
-					GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT | GL_DYNAMIC_STORAGE_BIT);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, prefixSumSSBO);
+	cpuFrameAge += frameTime;
+	const CpuSimFrame* frame = cpuSimulation.latestFrame();
+	if (frame != nullptr)
+	{
+		uploadCpuFrame(*frame);
 
-	// Reindexed particles
-	glGenBuffers(1, &reorderedparticlesSSBO);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, reorderedparticlesSSBO);
-	glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(particle) * NUM_PARTICLES, nullptr,
-					GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_DYNAMIC_STORAGE_BIT);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, reorderedparticlesSSBO);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		// Only the latest step reaches the GPU, so record that when a stride boundary was crossed
+		const unsigned long long stride = trajectoryWriter.isOpen() ? trajectoryWriter.stepStride() : 1;
+		if (trajectoryWriter.isOpen() && frame->step / stride != simStepCount / stride)
+		{
+			trajectoryWriter.record(particleSSBO, frame->step, frame->simTime, population.buffer());
+		}
 
-	// glGenBuffers(1, &bucketSizesSSBO);
-	// glBindBuffer(GL_SHADER_STORAGE_BUFFER, bucketSizesSSBO);
-	// glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(uint) * gridSize * gridSize, bucketSizes,
-	// 				GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT | GL_DYNAMIC_STORAGE_BIT);
-	// glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, particleSSBO);
-	// glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, bucketSizesSSBO);
-	// glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-	initGrid();
-
-	int w, h;
-	SDL_GetWindowSize(g_window, &w, &h);
-	for (int i = 0; i < 2; i++) {
-		fbos[i] = FboInfo();
-		fbos[i].resize(w, h);
+		int steps = int(frame->step - simStepCount);
+		simStepCount = frame->step;
+		simTime = frame->simTime;
+		currentSimTimestep = frame->timestep;
+		cpuFrameTimestep = frame->timestep;
+		cpuGridMoved = frame->movedParticles;
+		cpuGridRebuilt = frame->gridRebuilt;
+		cpuFrameAge = 0.0f;
+		interpolationAlpha = 0.0f;
+		return steps;
 	}
-	
-	glEnable(GL_DEPTH_TEST); // enable Z-buffering
-	glPointSize(5.0f);
 
-	labhelper::hideGUI();
-	
-	//glEnable(GL_CULL_FACE);  // enables backface culling
+	// Moves from the previous state to the uploaded one over the length of a step
+	interpolationAlpha = std::min(cpuFrameAge / cpuFrameTimestep, 1.0f);
+	return 0;
 }
 
-
 ///////////////////////////////////////////////////////////////////////////////
-/// This function will be called once per frame, so the code to set up
-/// the scene for rendering should go here
+/// Runs the steps for this frame on the selected engine, then everything
+/// that works on their results
 ///////////////////////////////////////////////////////////////////////////////
-void display(void)
+void advanceSimulation(float frameTime)
 {
-	labhelper::perf::Scope s( "Display" );
+	labhelper::perf::Scope s( "Simulation" );
 
-	///////////////////////////////////////////////////////////////////////////
-	// Check if window size has changed and resize buffers as needed
-	///////////////////////////////////////////////////////////////////////////
+	pollSimulationStats();
+	updateSpeciesBuffer(speciesSSBO, speciesBlock);
+
+	int steps = simulationEngine == ENGINE_CPU_THREAD ? receiveCpuSimulation(frameTime) : stepGPUSimulation(frameTime);
+	subStepsLastFrame = steps;
+
+	if (steps > 0)
 	{
-		int w, h;
-		SDL_GetWindowSize(g_window, &w, &h);
-		if(w != windowWidth || h != windowHeight)
-		{
-			windowWidth = w;
-			windowHeight = h;
-		}
+		requestSimulationStats();
+	}
 
-		for(int i = 0; i < 2; i++)
+	if (checkpointInterval > 0 && simStepCount >= lastCheckpointStep + checkpointInterval)
+	{
+		// Skipped (and retried next frame) while the previous checkpoint is still being written
+		if (saveSnapshot(snapshotPath))
 		{
-			if(fbos[i].width != w || fbos[i].height != h)
-				fbos[i].resize(w, h);
+			lastCheckpointStep = simStepCount;
 		}
 	}
+	// Sampled by the next frame's steps, so it lags the particles by a frame there
+	if (showDensityField || mouseInteraction)
+	{
+		rasterizeDensityField();
+	}
+
+	snapshotWriter.update();
+	trajectoryWriter.update();
+	logSimulationStats(frameTime);
+
+	stepsSinceRateUpdate += steps;
+	stepRateTimer += frameTime;
+	if (stepRateTimer >= 1.0f)
+	{
+		simStepsPerSecond = stepsSinceRateUpdate / stepRateTimer;
+		stepsSinceRateUpdate = 0;
+		stepRateTimer = 0.0f;
+	}
+}
+
+void loadShaders(bool is_reload)
+{
+	// A program that compiles replaces the previous one, which is deleted. On
+	// the first load that is program 0, which glDeleteProgram ignores.
+	GLuint shader = labhelper::loadShaderProgram("../project/shader.vert", "../project/shader.frag", is_reload);
+	if(shader != 0)
+	{
+		glDeleteProgram(shaderProgram);
+		shaderProgram = shader;
+	}
+
+	// shader = labhelper::loadComputeShaderProgram("../project/particle.comp", is_reload);
+	// if(shader != 0)
+	// {
+	// 	computeShaderProgram = shader;
+	// }
+	
+	// Every variant up front, so the first stir doesn't hitch on a compile
+	if (is_reload)
+	{
+		particlePrograms.reload();
+		densityPrograms.reload();
+		boidPrograms.reload();
+	}
+	else
+	{
+		for (int kernel = 0; kernel < KERNEL_TYPE_COUNT; kernel++)
+		{
+			for (int traversal = 0; traversal < TRAVERSAL_COUNT; traversal++)
+			{
+				particlePrograms.get(particlePermutation(NeighborTraversal(traversal), SmoothingKernelType(kernel), false,
+				                                         bucketsPerCell(sortBySpecies, numSpecies)));
+				particlePrograms.get(particlePermutation(NeighborTraversal(traversal), SmoothingKernelType(kernel), true,
+				                                         bucketsPerCell(sortBySpecies, numSpecies)));
+			}
+			densityPrograms.get(kernelPermutation(SmoothingKernelType(kernel)));
+		}
+		boidPrograms.get(simulationDefines());
+	}
+
+	shader = labhelper::loadShaderProgram("../project/blend.vert", "../project/blend.frag", is_reload);
+	if(shader != 0)
+	{
+		glDeleteProgram(blendProgram);
+		blendProgram = shader;
+	}
+
+	shader = labhelper::loadComputeShaderProgram("../project/grid.comp", is_reload);
+	if(shader != 0)
+	{
+		glDeleteProgram(gridPrograms.count);
+		gridPrograms.count = shader;
+	}
+
+	shader = labhelper::loadComputeShaderProgram("../project/reindex.comp", is_reload);
+	if (shader != 0) {
+		glDeleteProgram(gridPrograms.reindex);
+		gridPrograms.reindex = shader;
+	}
+
+	shader = labhelper::loadComputeShaderProgram("../project/gridSort.comp", is_reload);
+	if (shader != 0) {
+		glDeleteProgram(gridPrograms.sort);
+		gridPrograms.sort = shader;
+	}
+
+	shader = labhelper::loadComputeShaderProgram("../project/spawn.comp", is_reload);
+	if (shader != 0) {
+		glDeleteProgram(spawnShaderProgram);
+		spawnShaderProgram = shader;
+	}
+
+	shader = labhelper::loadComputeShaderProgram("../project/population.comp", is_reload);
+	if (shader != 0) {
+		glDeleteProgram(populationShaderProgram);
+		populationShaderProgram = shader;
+	}
+
+	shader = labhelper::loadShaderProgram("../project/glyph.vert", "../project/glyph.frag", is_reload);
+	if (shader != 0) {
+		glDeleteProgram(glyphProgram);
+		glyphProgram = shader;
+	}
+
+	shader = labhelper::loadShaderProgram("../project/glyph.vert", "../project/fluidDepth.frag", is_reload);
+	if (shader != 0) {
+		glDeleteProgram(fluidDepthProgram);
+		fluidDepthProgram = shader;
+	}
+
+	shader = labhelper::loadComputeShaderProgram("../project/fluidFilter.comp", is_reload);
+	if (shader != 0) {
+		glDeleteProgram(fluidFilterProgram);
+		fluidFilterProgram = shader;
+	}
+
+	shader = labhelper::loadShaderProgram("../project/blend.vert", "../project/fluidShade.frag", is_reload);
+	if (shader != 0) {
+		glDeleteProgram(fluidShadeProgram);
+		fluidShadeProgram = shader;
+	}
+
+	shader = labhelper::loadComputeShaderProgram("../project/trails.comp", is_reload);
+	if (shader != 0) {
+		glDeleteProgram(trailShaderProgram);
+		trailShaderProgram = shader;
+	}
+
+	shader = labhelper::loadShaderProgram("../project/blend.vert", "../project/trailResolve.frag", is_reload);
+	if (shader != 0) {
+		glDeleteProgram(trailResolveProgram);
+		trailResolveProgram = shader;
+	}
+
+	shader = labhelper::loadShaderProgram("../project/blend.vert", "../project/densityOverlay.frag", is_reload);
+	if (shader != 0) {
+		glDeleteProgram(densityOverlayProgram);
+		densityOverlayProgram = shader;
+	}
+
+	shader = labhelper::loadShaderProgram("../project/obstacleMask.vert", "../project/obstacleMask.frag", is_reload);
+	if (shader != 0) {
+		glDeleteProgram(obstaclePrograms.mask);
+		obstaclePrograms.mask = shader;
+	}
+
+	shader = labhelper::loadComputeShaderProgram("../project/jumpFlood.comp", is_reload);
+	if (shader != 0) {
+		glDeleteProgram(obstaclePrograms.jumpFlood);
+		obstaclePrograms.jumpFlood = shader;
+	}
+
+	shader = labhelper::loadShaderProgram("../project/blend.vert", "../project/obstacleOverlay.frag", is_reload);
+	if (shader != 0) {
+		glDeleteProgram(obstacleOverlayProgram);
+		obstacleOverlayProgram = shader;
+	}
+
+	shader = labhelper::loadComputeShaderProgram("../project/snapshotUnpack.comp", is_reload);
+	if (shader != 0) {
+		glDeleteProgram(snapshotUnpackShaderProgram);
+		snapshotUnpackShaderProgram = shader;
+	}
+
+	// shader = labhelper::loadComputeShaderProgram("../project/prefixSum.comp", is_reload);
+	// if(shader != 0)
+	// {
+	// 	prefixSumShaderProgram = shader;
+	// }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// This function is called once at the start of the program and never again
+///////////////////////////////////////////////////////////////////////////////
+void initialize()
+{
+	ENSURE_INITIALIZE_ONLY_ONCE();
+
+	///////////////////////////////////////////////////////////////////////
+	//		Load Shaders
+	///////////////////////////////////////////////////////////////////////
+	labhelper::setShaderCacheDirectory("shader_cache");
+	loadShaders(false);
+
+	particles = new particle[MAX_PARTICLES];
+
+	///////////////////////////////////////////////////////////////////////
+	// Generate and bind buffers for compute shaders
+	///////////////////////////////////////////////////////////////////////
+	// Positions
+	glGenBuffers(1, &particleSSBO);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBO);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(particle) * MAX_PARTICLES, nullptr,
+					GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT | GL_DYNAMIC_STORAGE_BIT);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, particleSSBO);
+
+	glGenBuffers(1, &previousParticleSSBO);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, previousParticleSSBO);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(particle) * MAX_PARTICLES, nullptr, 0);
+
+	// Statistics, persistently mapped for fence-based readback
+	glGenBuffers(1, &statsSSBO);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, statsSSBO);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(float) * STAT_SLOT_COUNT, nullptr,
+					GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+	mappedStats = (float*)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, sizeof(float) * STAT_SLOT_COUNT,
+					GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	snapshotWriter.init(sizeof(particle) * MAX_PARTICLES);
+
+	population.init(MAX_PARTICLES);
+	initPopulationSettings(populationSettings);
+
+	// Upload slots for the CPU engine, written straight through the mapping
+	glGenBuffers(1, &cpuUploadBuffer);
+	glBindBuffer(GL_COPY_READ_BUFFER, cpuUploadBuffer);
+	const GLsizeiptr cpuUploadSize = sizeof(particle) * MAX_PARTICLES * 2 * CPU_UPLOAD_SLOTS;
+	glBufferStorage(GL_COPY_READ_BUFFER, cpuUploadSize, nullptr,
+					GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+	mappedCpuUpload = (particle*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, cpuUploadSize,
+					GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+	///////////////////////////////////////////////////////////////////////
+	// Vertex array for rendering, reading straight from the particle buffers
+	///////////////////////////////////////////////////////////////////////
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+
+	glBindBuffer(GL_ARRAY_BUFFER, particleSSBO);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(particle), 0);
+	glEnableVertexAttribArray(0);
+
+	glBindBuffer(GL_ARRAY_BUFFER, previousParticleSSBO);
+	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(particle), 0);
+	glEnableVertexAttribArray(1);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+
+	glGenVertexArrays(1, &glyphVAO);
+
+	///////////////////////////////////////////////////////////////////////
+	// Generate and bind buffers for compute shaders
+	///////////////////////////////////////////////////////////////////////
+	// Reindexed particles
+	glGenBuffers(1, &reorderedparticlesSSBO);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, reorderedparticlesSSBO);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(particle) * MAX_PARTICLES, nullptr,
+					GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_DYNAMIC_STORAGE_BIT);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, reorderedparticlesSSBO);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	// Grid, bindings 4 and 5
+	grid.init(MAX_PARTICLES, MAX_GRID_SIZE);
+	speciesSSBO = initSpecies(speciesBlock);
+
+	initializeparticles();
+
+	// Something valid to sample before the first rasterization
+	resizeDensityField(densityResolution);
+
+	// Points are flat, so none of the targets need depth
+	if (g_window != nullptr)
+	{
+		SDL_GetWindowSize(g_window, &windowWidth, &windowHeight);
+	}
+	for (int i = 0; i < 2; i++) {
+		fbos[i] = FboInfo(FboAttachments(1, GL_RGBA16F, GL_NONE));
+		fbos[i].resize(windowWidth, windowHeight);
+	}
+	trailTarget = FboInfo(FboAttachments(1, GL_R32UI, GL_NONE));
+	trailTarget.resize(windowWidth, windowHeight);
+
+	// Sized on first use by drawFluidSurface()
+	FboAttachments fluidDepthAttachments(2, GL_R32F, GL_NONE);
+	fluidDepthAttachments.colorFormats[1] = GL_R16F;
+	fluidDepthTarget = FboInfo(fluidDepthAttachments);
+	fluidFilterTarget = FboInfo(FboAttachments(1, GL_R32F, GL_NONE));
+	
+	glEnable(GL_DEPTH_TEST); // enable Z-buffering
+	glPointSize(particlePointSize);
+
+	labhelper::hideGUI();
+	
+	//glEnable(GL_CULL_FACE);  // enables backface culling
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// Draws the particles into the bound framebuffer with the selected glyph
+///////////////////////////////////////////////////////////////////////////////
+void drawParticles(int viewportWidth, int viewportHeight)
+{
+	if (particleGlyph == GLYPH_POINTS)
+	{
+		glUseProgram(shaderProgram);
+		labhelper::setUniformSlow(shaderProgram, "minSpeed", minSpeed);
+		labhelper::setUniformSlow(shaderProgram, "maxSpeed", maxSpeed);
+		labhelper::setUniformSlow(shaderProgram, "interpolationAlpha", interpolationAlpha);
+		glBindVertexArray(vao);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, population.buffer());
+		glDrawArraysIndirect(GL_POINTS, (const void*)offsetof(PopulationBlock, points));
+		glBindVertexArray(0);
+		return;
+	}
+
+	const int verticesPerGlyph = particleGlyph == GLYPH_ARROWS ? 9 : 6;
+	glUseProgram(glyphProgram);
+	labhelper::setUniformSlow(glyphProgram, "glyphType", GLint(particleGlyph));
+	labhelper::setUniformSlow(glyphProgram, "verticesPerGlyph", verticesPerGlyph);
+	labhelper::setUniformSlow(glyphProgram, "interpolationAlpha", interpolationAlpha);
+	labhelper::setUniformSlow(glyphProgram, "glyphSize", glyphSize);
+	labhelper::setUniformSlow(glyphProgram, "viewportSize", ivec2(viewportWidth, viewportHeight));
+	labhelper::setUniformSlow(glyphProgram, "minSpeed", minSpeed);
+	labhelper::setUniformSlow(glyphProgram, "maxSpeed", maxSpeed);
+	labhelper::setUniformSlow(glyphProgram, "colorBySpecies", colorBySpecies);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, particleSSBO);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, previousParticleSSBO);
+
+	GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+	glDisable(GL_DEPTH_TEST);
+	if (particleGlyph == GLYPH_DISKS)
+	{
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	}
+
+	// Same vertex counts as verticesPerGlyph, see population.comp
+	const size_t command = particleGlyph == GLYPH_ARROWS ? offsetof(PopulationBlock, arrowGlyphs)
+	                                                     : offsetof(PopulationBlock, diskGlyphs);
+	glBindVertexArray(glyphVAO);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, population.buffer());
+	glDrawArraysIndirect(GL_TRIANGLES, (const void*)command);
+	glBindVertexArray(0);
+
+	glDisable(GL_BLEND);
+	if (depthTest)
+	{
+		glEnable(GL_DEPTH_TEST);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Trails without render targets: decay the accumulation image in place,
+/// splat the particles into it with atomics, then resolve it to the screen.
+/// Replaces the scene pass and both full-screen blends of the classic path.
+///////////////////////////////////////////////////////////////////////////////
+void drawComputeTrails()
+{
+	labhelper::perf::Scope s( "Compute trails" );
+
+	const GLuint groupsX = (windowWidth + 15) / 16;
+	const GLuint groupsY = (windowHeight + 15) / 16;
+
+	glUseProgram(trailShaderProgram);
+	GLuint trailTexture = trailTarget.colorTextureTargets[0];
+	glBindImageTexture(0, trailTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+	labhelper::setUniformSlow(trailShaderProgram, "viewportSize", ivec2(windowWidth, windowHeight));
+
+	{
+		labhelper::perf::Scope s( "Decay" );
+		// Storage from a resize is undefined, decaying it to zero clears it
+		labhelper::setUniformSlow(trailShaderProgram, "trailPass", 0);
+		labhelper::setUniformSlow(trailShaderProgram, "decayFactor",
+		                          trailsCleared ? (additiveBlending ? 0.8f : 0.85f) : 0.0f);
+		glDispatchCompute(groupsX, groupsY, 1);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		trailsCleared = true;
+	}
+	{
+		labhelper::perf::Scope s( "Splat" );
+		// Additive: old * 0.8 + new, otherwise mix(new, old, 0.85) as in blend.frag
+		labhelper::setUniformSlow(trailShaderProgram, "trailPass", 1);
+		labhelper::setUniformSlow(trailShaderProgram, "splatWeight", additiveBlending ? 1.0f : 0.15f);
+		labhelper::setUniformSlow(trailShaderProgram, "pointSize", GLint(particlePointSize));
+		labhelper::setUniformSlow(trailShaderProgram, "interpolationAlpha", interpolationAlpha);
+		labhelper::setUniformSlow(trailShaderProgram, "minSpeed", minSpeed);
+		labhelper::setUniformSlow(trailShaderProgram, "maxSpeed", maxSpeed);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, particleSSBO);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, previousParticleSSBO);
+		dispatchParticleGroups();
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	}
+	{
+		labhelper::perf::Scope s( "Resolve" );
+		glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
+		glViewport(0, 0, windowWidth, windowHeight);
+		glUseProgram(trailResolveProgram);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, trailTexture);
+		labhelper::drawFullScreenQuad();
+	}
+	if (particleGlyph != GLYPH_POINTS)
+	{
+		// The trails are splatted as points, glyphs go on top
+		labhelper::perf::Scope s( "Glyphs" );
+		drawParticles(windowWidth, windowHeight);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Screen-space fluid: splat particles as spheres into a height field, smooth
+/// it with a separable bilateral filter, then reconstruct normals and shade
+/// with the environment maps.
+///////////////////////////////////////////////////////////////////////////////
+void drawFluidSurface()
+{
+	labhelper::perf::Scope s( "Fluid surface" );
+
+	if (reflectionMap == 0)
+	{
+		std::vector<std::string> filenames;
+		for (int i = 0; i < reflectionMapLevels; i++)
+		{
+			filenames.push_back("../scenes/envmaps/001_dl_" + std::to_string(i) + ".hdr");
+		}
+		reflectionMap = labhelper::loadHdrMipmapTexture(filenames);
+		irradianceMap = labhelper::loadHdrTexture("../scenes/envmaps/001_irradiance.hdr");
+	}
+
+	// No-ops unless the window size changed
+	fluidDepthTarget.resize(windowWidth, windowHeight);
+	fluidFilterTarget.resize(windowWidth, windowHeight);
+
+	{
+		labhelper::perf::Scope s( "Depth splat" );
+		glBindFramebuffer(GL_FRAMEBUFFER, fluidDepthTarget.framebufferId);
+		glViewport(0, 0, windowWidth, windowHeight);
+		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
+
+		glUseProgram(fluidDepthProgram);
+		labhelper::setUniformSlow(fluidDepthProgram, "glyphType", GLint(GLYPH_DISKS));
+		labhelper::setUniformSlow(fluidDepthProgram, "verticesPerGlyph", 6);
+		labhelper::setUniformSlow(fluidDepthProgram, "interpolationAlpha", interpolationAlpha);
+		labhelper::setUniformSlow(fluidDepthProgram, "glyphSize", fluidParticleRadius);
+		labhelper::setUniformSlow(fluidDepthProgram, "viewportSize", ivec2(windowWidth, windowHeight));
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, particleSSBO);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, previousParticleSSBO);
+
+		GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+		glDisable(GL_DEPTH_TEST);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_ONE, GL_ONE);
+		glBlendEquationi(0, GL_MAX);
+		glBlendEquationi(1, GL_FUNC_ADD);
+
+		glBindVertexArray(glyphVAO);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, population.buffer());
+		glDrawArraysIndirect(GL_TRIANGLES, (const void*)offsetof(PopulationBlock, diskGlyphs));
+		glBindVertexArray(0);
+
+		glBlendEquation(GL_FUNC_ADD);
+		glDisable(GL_BLEND);
+		if (depthTest)
+		{
+			glEnable(GL_DEPTH_TEST);
+		}
+	}
+	{
+		labhelper::perf::Scope s( "Bilateral filter" );
+		GLuint height = fluidDepthTarget.colorTextureTargets[0];
+		GLuint intermediate = fluidFilterTarget.colorTextureTargets[0];
+
+		glUseProgram(fluidFilterProgram);
+		labhelper::setUniformSlow(fluidFilterProgram, "viewportSize", ivec2(windowWidth, windowHeight));
+		labhelper::setUniformSlow(fluidFilterProgram, "radius", clamp(fluidFilterRadius, 0, 32));
+		labhelper::setUniformSlow(fluidFilterProgram, "spatialSigma", std::max(1.0f, fluidFilterRadius / 2.0f));
+		labhelper::setUniformSlow(fluidFilterProgram, "rangeSigma", fluidFilterRangeSigma);
+
+		const GLuint tile = 256;
+		for (int i = 0; i < fluidFilterIterations; i++)
+		{
+			glBindImageTexture(0, height, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+			glBindImageTexture(1, intermediate, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+			labhelper::setUniformSlow(fluidFilterProgram, "direction", ivec2(1, 0));
+			glDispatchCompute((windowWidth + tile - 1) / tile, windowHeight, 1);
+			glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+			glBindImageTexture(0, intermediate, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+			glBindImageTexture(1, height, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+			labhelper::setUniformSlow(fluidFilterProgram, "direction", ivec2(0, 1));
+			glDispatchCompute((windowHeight + tile - 1) / tile, windowWidth, 1);
+			glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		}
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+		fluidFilterTarget.invalidate();
+	}
+	{
+		labhelper::perf::Scope s( "Shade" );
+		glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
+		glViewport(0, 0, windowWidth, windowHeight);
+		glUseProgram(fluidShadeProgram);
+		labhelper::setUniformSlow(fluidShadeProgram, "fluidColor", fluidColor);
+		labhelper::setUniformSlow(fluidShadeProgram, "absorption", fluidAbsorption);
+		labhelper::setUniformSlow(fluidShadeProgram, "environmentMultiplier", environmentMultiplier);
+		labhelper::setUniformSlow(fluidShadeProgram, "roughness", fluidRoughness);
+		labhelper::setUniformSlow(fluidShadeProgram, "reflectionLevels", float(reflectionMapLevels - 1));
+		labhelper::setUniformSlow(fluidShadeProgram, "backgroundColor", vec3(0.02f, 0.02f, 0.03f));
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, fluidDepthTarget.colorTextureTargets[0]);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, fluidDepthTarget.colorTextureTargets[1]);
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_2D, reflectionMap);
+		glActiveTexture(GL_TEXTURE3);
+		glBindTexture(GL_TEXTURE_2D, irradianceMap);
+		labhelper::drawFullScreenQuad();
+		glActiveTexture(GL_TEXTURE0);
+
+		fluidDepthTarget.invalidate();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Bakes the obstacle from the mesh in the GUI, or takes it from the cache
+///////////////////////////////////////////////////////////////////////////////
+void bakeObstacle()
+{
+	labhelper::perf::Scope s( "Bake obstacle" );
+
+	obstacleSettings.meshPath = obstacleMeshPath;
+	if (bakeObstacleField(obstacleSettings, obstaclePrograms, obstacleFieldTexture))
+	{
+		obstacleEnabled = true;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Shades the obstacle over whatever is in the default framebuffer
+///////////////////////////////////////////////////////////////////////////////
+void drawObstacleOverlay()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
+	glViewport(0, 0, windowWidth, windowHeight);
+	glUseProgram(obstacleOverlayProgram);
+	labhelper::setUniformSlow(obstacleOverlayProgram, "viewportSize", ivec2(windowWidth, windowHeight));
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, obstacleFieldTexture);
+
+	GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	labhelper::drawFullScreenQuad();
+	glDisable(GL_BLEND);
+	if (depthTest)
+	{
+		glEnable(GL_DEPTH_TEST);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Colormaps the density field over whatever is in the default framebuffer
+///////////////////////////////////////////////////////////////////////////////
+void drawDensityOverlay()
+{
+	labhelper::perf::Scope s( "Density overlay" );
+
+	glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
+	glViewport(0, 0, windowWidth, windowHeight);
+	glUseProgram(densityOverlayProgram);
+	float range = densityAutoRange && stats.maxDensity > 0.0f ? stats.maxDensity : densityDisplayMax;
+	labhelper::setUniformSlow(densityOverlayProgram, "viewportSize", ivec2(windowWidth, windowHeight));
+	labhelper::setUniformSlow(densityOverlayProgram, "maxDensity", range);
+	labhelper::setUniformSlow(densityOverlayProgram, "opacity", densityOverlayOpacity);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, densityFieldTexture);
+
+	GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	labhelper::drawFullScreenQuad();
+	glDisable(GL_BLEND);
+	if (depthTest)
+	{
+		glEnable(GL_DEPTH_TEST);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// This function will be called once per frame, so the code to set up
+/// the scene for rendering should go here
+///////////////////////////////////////////////////////////////////////////////
+void display(void)
+{
+	labhelper::perf::Scope s( "Display" );
+
+	if (renderMode == RENDER_COMPUTE_TRAILS)
+	{
+		drawComputeTrails();
+		return;
+	}
+	if (renderMode == RENDER_FLUID_SURFACE)
+	{
+		drawFluidSurface();
+		return;
+	}
 
 	///////////////////////////////////////////////////////////////////////////
 	// Draw from camera
@@ -561,13 +1601,7 @@ void display(void)
 	// Render scene
 	{
 		labhelper::perf::Scope s( "Scene" );
-		
-		glUseProgram(shaderProgram);
-		labhelper::setUniformSlow(shaderProgram, "minSpeed", minSpeed);
-		labhelper::setUniformSlow(shaderProgram, "maxSpeed", maxSpeed);
-		glBindVertexArray(vao);
-		glDrawArrays(GL_POINTS, 0, NUM_PARTICLES);
-		glBindVertexArray(0);
+		drawParticles(currentFB.width, currentFB.height);
 	}
 	{
 		labhelper::perf::Scope s( "Blending" );
@@ -592,8 +1626,11 @@ void display(void)
 		
 		labhelper::drawFullScreenQuad();
 
+		// The new frame has been folded into the trail, no need to keep it
+		currentFB.invalidate();
+
 		// Render the blended scene to default
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
 		glViewport(0, 0, windowWidth, windowHeight);
 		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -611,14 +1648,33 @@ void display(void)
 ///////////////////////////////////////////////////////////////////////////////
 /// This function is used to update the scene according to user input
 ///////////////////////////////////////////////////////////////////////////////
-bool handleEvents(void)
+void onWindowResized(int w, int h)
+{
+	windowWidth = w;
+	windowHeight = h;
+	for (int i = 0; i < 2; i++)
+	{
+		fbos[i].resize(w, h);
+	}
+	// Trails are in pixels, start them over at the new size
+	trailTarget.resize(w, h);
+	trailsCleared = false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Handles all queued events. Paused with nothing to redraw, first blocks
+/// until there is one, see FramePacer::waitForEvent().
+///////////////////////////////////////////////////////////////////////////////
+bool handleEvents()
 {
 	// check events (keyboard among other)
 	SDL_Event event;
 	bool quitEvent = false;
-	while(SDL_PollEvent(&event))
+	bool haveEvent = framePacer.waitForEvent(event, isPaused);
+	for(; haveEvent; haveEvent = SDL_PollEvent(&event) != 0)
 	{
 		labhelper::processEvent( &event );
+		framePacer.onEvent(event);
 
 		if(event.type == SDL_QUIT || (event.type == SDL_KEYUP && event.key.keysym.sym == SDLK_ESCAPE))
 		{
@@ -627,6 +1683,7 @@ bool handleEvents(void)
 		if(event.type == SDL_KEYUP && event.key.keysym.sym == SDLK_SPACE)
 		{
 			isPaused = !isPaused;
+			cpuSimulation.setPaused(isPaused);
 		}
 		if(event.type == SDL_KEYUP && event.key.keysym.sym == SDLK_g)
 		{
@@ -641,6 +1698,22 @@ bool handleEvents(void)
 		 
 		}
 		
+		if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
+		{
+			onWindowResized(event.window.data1, event.window.data2);
+		}
+
+		// Drags that start on the GUI belong to the GUI
+		if (event.type == SDL_MOUSEBUTTONDOWN && event.button.button == SDL_BUTTON_LEFT
+		    && !ImGui::GetIO().WantCaptureMouse)
+		{
+			g_isMouseDragging = true;
+		}
+		if (event.type == SDL_MOUSEBUTTONUP && event.button.button == SDL_BUTTON_LEFT)
+		{
+			g_isMouseDragging = false;
+		}
+
 		if (event.type == SDL_MOUSEMOTION)
 		{
 			mousePos.x = event.motion.x;
@@ -663,28 +1736,285 @@ void gui()
 	            ImGui::GetIO().Framerate);
 	// ----------------------------------------------------------
 
+	int debugLevel = int(labhelper::getGLDebugLevel());
+	if (ImGui::Combo("GL debug output", &debugLevel, glDebugLevelNames, 3))
+	{
+		labhelper::setGLDebugLevel(labhelper::GLDebugLevel(debugLevel));
+	}
+	labhelper::GLDebugMessageCounts debugCounts = labhelper::getGLDebugMessageCounts();
+	ImGui::Text("  %llu errors, %llu performance warnings, %llu other, %llu dropped",
+	            (unsigned long long)debugCounts.errors, (unsigned long long)debugCounts.performance,
+	            (unsigned long long)debugCounts.other, (unsigned long long)debugCounts.dropped);
+
+	int engine = simulationEngine;
+	if (ImGui::Combo("Engine", &engine, simulationEngineNames, ENGINE_COUNT))
+	{
+		setSimulationEngine(SimulationEngine(engine));
+	}
+	if (simulationEngine == ENGINE_CPU_THREAD)
+	{
+		ImGui::Text("  Stirring, obstacles, sources and sinks only act on the GPU engine");
+		ImGui::Checkbox("Incremental grid", &cpuIncrementalGrid);
+		if (cpuIncrementalGrid)
+		{
+			ImGui::SliderFloat("Rebuild above churn", &cpuRebuildChurn, 0.0f, 0.2f);
+		}
+		if (cpuGridRebuilt)
+		{
+			ImGui::Text("  Grid rebuilt last step");
+		}
+		else
+		{
+			ImGui::Text("  Grid patched last step, %u particles changed bucket", cpuGridMoved);
+		}
+	}
+	framePacer.gui(isPaused);
+	ImGui::Text("Simulation: %.1f steps/s, %d substeps last frame", simStepsPerSecond, subStepsLastFrame);
+	ImGui::Text("Step %llu, t = %.2f s, dt = %.5f s", simStepCount, simTime, currentSimTimestep);
+	ImGui::SliderFloat("Fixed timestep", &simTimestep, 1.0f / 1000.0f, 1.0f / 30.0f, "%.4f");
+	ImGui::SliderInt("Max substeps", &maxSubSteps, 1, 32);
+	ImGui::Checkbox("Adaptive timestep (CFL)", &adaptiveTimestep);
+	ImGui::SliderFloat("CFL number", &cflNumber, 0.05f, 1.0f);
+
+	ImGui::Text("Initial conditions:");
+	int layout = spawnSettings.layout;
+	ImGui::Combo("Spawn layout", &layout, spawnLayoutNames, SPAWN_LAYOUT_COUNT);
+	spawnSettings.layout = SpawnLayout(layout);
+	int seed = int(randomSeed);
+	if (ImGui::InputInt("Seed", &seed))
+	{
+		randomSeed = GLuint(seed);
+	}
+	ImGui::SliderInt("Particles", &spawnCount, 1, MAX_PARTICLES);
+	if (ImGui::Button("Respawn"))
+	{
+		initializeparticles();
+	}
+
+	ImGui::Text("Species:");
+	if (ImGui::SliderInt("Species count", &numSpecies, 1, MAX_SPECIES))
+	{
+		spawnSettings.speciesCount = numSpecies;
+		initializeparticles();
+	}
+	ImGui::Checkbox("Sort buckets by species", &sortBySpecies);
+	ImGui::Checkbox("Color by species", &colorBySpecies);
+	for (int i = 0; i < numSpecies; i++)
+	{
+		ImGui::PushID(i);
+		ImGui::Text("  Species %d", i);
+		ImGui::ColorEdit3("Color", &speciesBlock.species[i].color.x);
+		ImGui::SliderFloat("Mass", &speciesBlock.species[i].mass, 0.1f, 10.0f);
+		ImGui::SliderFloat("Gravity scale", &speciesBlock.species[i].gravityScale, -2.0f, 2.0f);
+		ImGui::PopID();
+	}
+	// Row i is how species i reacts to the others' density
+	ImGui::Text("  Interaction (row reacts to column)");
+	for (int i = 0; i < numSpecies; i++)
+	{
+		for (int j = 0; j < numSpecies; j++)
+		{
+			ImGui::PushID(i * MAX_SPECIES + j);
+			if (j > 0)
+			{
+				ImGui::SameLine();
+			}
+			ImGui::PushItemWidth(50.0f);
+			ImGui::DragFloat("##interaction", &speciesBlock.interaction[i * MAX_SPECIES + j], 0.01f, -5.0f, 5.0f, "%.2f");
+			ImGui::PopItemWidth();
+			ImGui::PopID();
+		}
+	}
+
+	ImGui::Text("Sources and sinks:");
+	if (ImGui::Button("Pipe flow"))
+	{
+		pipeFlowPreset(populationSettings);
+	}
+	ImGui::SameLine();
+	if (ImGui::Button("Clear"))
+	{
+		initPopulationSettings(populationSettings);
+	}
+	for (int i = 0; i < MAX_EMITTERS; i++)
+	{
+		Emitter& emitter = populationSettings.emitters[i];
+		ImGui::PushID(i);
+		ImGui::Checkbox("Emitter", &emitter.enabled);
+		if (emitter.enabled)
+		{
+			ImGui::SliderFloat2("Min corner", &emitter.boxMin.x, -1.0f, 1.0f);
+			ImGui::SliderFloat2("Max corner", &emitter.boxMax.x, -1.0f, 1.0f);
+			ImGui::SliderFloat2("Velocity", &emitter.velocity.x, -2.0f, 2.0f);
+			ImGui::SliderFloat("Rate (per s)", &emitter.rate, 0.0f, 2000.0f);
+			ImGui::SliderInt("Species", &emitter.species, 0, numSpecies - 1);
+		}
+		ImGui::PopID();
+	}
+	for (int i = 0; i < MAX_SINKS; i++)
+	{
+		Sink& sink = populationSettings.sinks[i];
+		ImGui::PushID(MAX_EMITTERS + i);
+		ImGui::Checkbox("Sink", &sink.enabled);
+		if (sink.enabled)
+		{
+			ImGui::SliderFloat2("Min corner", &sink.boxMin.x, -1.0f, 1.0f);
+			ImGui::SliderFloat2("Max corner", &sink.boxMax.x, -1.0f, 1.0f);
+		}
+		ImGui::PopID();
+	}
+
+	ImGui::Text("Snapshots:");
+	ImGui::InputText("Snapshot file", snapshotPath, sizeof(snapshotPath));
+	ImGui::Checkbox("fp16 positions", &snapshotHalfPositions);
+	if (ImGui::Button("Save snapshot"))
+	{
+		saveSnapshot(snapshotPath);
+	}
+	ImGui::SameLine();
+	if (ImGui::Button("Load snapshot"))
+	{
+		restoreSnapshot(snapshotPath);
+	}
+	if (snapshotWriter.isBusy())
+	{
+		ImGui::SameLine();
+		ImGui::Text("Writing...");
+	}
+	ImGui::SliderInt("Checkpoint every N steps", &checkpointInterval, 0, 10000);
+
+	ImGui::Text("Trajectory recording:");
+	if (!trajectoryWriter.isOpen())
+	{
+		ImGui::InputText("Trajectory file", trajectoryPath, sizeof(trajectoryPath));
+		ImGui::SliderInt("Record every N steps", &trajectoryStride, 1, 100);
+		if (ImGui::Button("Start recording"))
+		{
+			// Room for every slot, each frame only stores the particles alive at its step
+			trajectoryWriter.open(trajectoryPath, MAX_PARTICLES, trajectoryStride);
+		}
+	}
+	else
+	{
+		ImGui::Text("  %llu frames, %.1f MB, %llu dropped", (unsigned long long)trajectoryWriter.framesWritten(),
+		            trajectoryWriter.bytesWritten() / (1024.0f * 1024.0f),
+		            (unsigned long long)trajectoryWriter.framesDropped());
+		if (ImGui::Button("Stop recording"))
+		{
+			trajectoryWriter.close();
+		}
+	}
+
+	ImGui::Text("Statistics:");
+	ImGui::Text("  %u of %d particles alive", stats.aliveCount, MAX_PARTICLES);
+	ImGui::Text("  Max speed %.4f, kinetic energy %.4f", stats.maxSpeed, stats.kineticEnergy);
+	ImGui::Text("  Density min %.3f, max %.3f, mean %.3f", stats.minDensity, stats.maxDensity, stats.meanDensity);
+	ImGui::Text("  Particles per cell max %.0f, mean %.2f", stats.maxCellCount, stats.meanCellCount);
+	ImGui::Checkbox("Log statistics", &logStats);
+
 	ImGui::Text("Blending parameters:");
+	int mode = renderMode;
+	ImGui::Combo("Render mode", &mode, renderModeNames, RENDER_MODE_COUNT);
+	renderMode = RenderMode(mode);
 	ImGui::Checkbox("Additive blending", &additiveBlending);
+	int glyph = particleGlyph;
+	ImGui::Combo("Particle glyph", &glyph, particleGlyphNames, GLYPH_COUNT);
+	particleGlyph = ParticleGlyph(glyph);
+	ImGui::SliderFloat("Glyph size (px)", &glyphSize, 1.0f, 32.0f);
+
+	ImGui::Text("Density field:");
+	ImGui::Checkbox("Show density field", &showDensityField);
+	ImGui::SliderInt("Grid resolution", &densityResolution, 32, 1024);
+	ImGui::SliderFloat("Overlay opacity", &densityOverlayOpacity, 0.0f, 1.0f);
+	ImGui::Checkbox("Range from statistics", &densityAutoRange);
+	if (!densityAutoRange)
+	{
+		ImGui::SliderFloat("Colormap max", &densityDisplayMax, 0.01f, 100.0f, "%.2f", 2.0f);
+	}
+
+	if (renderMode == RENDER_FLUID_SURFACE)
+	{
+		ImGui::Text("Fluid surface:");
+		ImGui::SliderFloat("Particle radius (px)", &fluidParticleRadius, 1.0f, 32.0f);
+		ImGui::SliderInt("Filter radius (px)", &fluidFilterRadius, 0, 32);
+		ImGui::SliderInt("Filter iterations", &fluidFilterIterations, 0, 4);
+		ImGui::SliderFloat("Filter range sigma", &fluidFilterRangeSigma, 0.5f, 16.0f);
+		ImGui::ColorEdit3("Fluid color", &fluidColor.x);
+		ImGui::SliderFloat("Absorption", &fluidAbsorption, 0.0f, 0.5f);
+		ImGui::SliderFloat("Roughness", &fluidRoughness, 0.0f, 1.0f);
+		ImGui::SliderFloat("Environment multiplier", &environmentMultiplier, 0.0f, 5.0f);
+	}
+
+	ImGui::Text("Obstacle:");
+	ImGui::InputText("Obstacle mesh", obstacleMeshPath, sizeof(obstacleMeshPath));
+	int bakeMethod = obstacleSettings.method;
+	ImGui::Combo("Bake method", &bakeMethod, obstacleBakeMethodNames, OBSTACLE_BAKE_METHOD_COUNT);
+	obstacleSettings.method = ObstacleBakeMethod(bakeMethod);
+	ImGui::SliderInt("Field resolution", &obstacleSettings.resolution, 32, 1024);
+	ImGui::Combo("Section across", &obstacleSettings.sliceAxis, sliceAxisNames, 3);
+	ImGui::SliderFloat("Section height", &obstacleSettings.sliceHeight, 0.0f, 1.0f);
+	ImGui::SliderFloat("Obstacle size", &obstacleSettings.scale, 0.05f, 1.0f);
+	ImGui::SliderFloat2("Obstacle position", &obstacleSettings.offset.x, -1.0f, 1.0f);
+	if (ImGui::Button("Bake obstacle"))
+	{
+		bakeObstacle();
+	}
+	if (obstacleFieldTexture != 0)
+	{
+		ImGui::SameLine();
+		ImGui::Checkbox("Collide", &obstacleEnabled);
+		ImGui::SameLine();
+		ImGui::Checkbox("Show", &showObstacle);
+	}
 
 	ImGui::Text("Mouse control:");
 	ImGui::Checkbox("Follow mouse", &followMouse);
+	ImGui::Checkbox("Stir with left button", &mouseInteraction);
+	ImGui::SliderFloat("Stir radius", &mouseRadius, 0.01f, 1.0f);
+	ImGui::SliderFloat("Stir strength", &mouseStrength, -10.0f, 10.0f);
+
+	int model = simulationModel;
+	ImGui::Combo("Simulation model", &model, simulationModelNames, MODEL_COUNT);
+	simulationModel = SimulationModel(model);
 
 	ImGui::Text("particle parameters:");
 	ImGui::SliderFloat("kernelScalingFactor", &kernelScalingFactor, 0.01f, 10.0f);
 	ImGui::SliderFloat("smoothingRadius", &smoothingRadius, 0.01f, 2.0f / (float)gridSize);
+	if (ImGui::SliderInt("Grid size", &gridSize, 1, MAX_GRID_SIZE))
+	{
+		smoothingRadius = std::min(smoothingRadius, 2.0f / (float)gridSize);
+	}
+	int kernel = smoothingKernel;
+	ImGui::Combo("Smoothing kernel", &kernel, smoothingKernelNames, KERNEL_TYPE_COUNT);
+	smoothingKernel = SmoothingKernelType(kernel);
+	int traversal = neighborTraversal;
+	ImGui::Combo("Neighbour search", &traversal, neighborTraversalNames, TRAVERSAL_COUNT);
+	neighborTraversal = NeighborTraversal(traversal);
+	int builder = gridBuilder;
+	ImGui::Combo("Grid build", &builder, gridBuilderNames, GRID_BUILDER_COUNT);
+	gridBuilder = GridBuilder(builder);
+	if (gridBuilder == GRID_RADIX_SORT)
+	{
+		ImGui::Checkbox("Morton order within cells", &mortonWithinCells);
+	}
 	ImGui::Checkbox("Gravity enabled", &gravityEnabled);
 	ImGui::SliderFloat("gravityStrength", &gravityStrength, 0.0f, 1.0f);
 
-	// ImGui::SliderFloat("visualRange", &visualRange, 0.0f, 2.0f);
-	// ImGui::SliderFloat("protectedRange", &protectedRange, 0.0f, 1.0f);
-	// ImGui::SliderFloat("centeringFactor", &centeringFactor, 0.0f, 0.1f);
-	// ImGui::SliderFloat("matchingFactor", &matchingFactor, 0.0f, 0.1f);
-	// ImGui::SliderFloat("avoidFactor", &avoidFactor, 0.0f, 0.5f);
-	// ImGui::SliderFloat("borderMargin", &matchingFactor, 0.0f, 0.3f);
-	// ImGui::SliderFloat("turnFactor", &turnFactor, 0.0f, 0.5f);
-	// ImGui::SliderFloat("minSpeed", &minSpeed, 0.0f, 0.5f);
-	// ImGui::SliderFloat("maxSpeed", &maxSpeed, 0.0f, 1.0f);
-	// ImGui::SliderFloat("randFactor", &randFactor, 0.0f, 1.0f);
+	if (simulationModel == MODEL_BOIDS)
+	{
+		ImGui::Text("Boid parameters:");
+		ImGui::SliderFloat("visualRange", &visualRange, 0.0f, 2.0f / (float)gridSize);
+		ImGui::SliderFloat("protectedRange", &protectedRange, 0.0f, 1.0f);
+		ImGui::SliderFloat("centeringFactor", &centeringFactor, 0.0f, 0.1f);
+		ImGui::SliderFloat("matchingFactor", &matchingFactor, 0.0f, 0.1f);
+		ImGui::SliderFloat("avoidFactor", &avoidFactor, 0.0f, 0.5f);
+		ImGui::SliderFloat("chaseFactor", &chaseFactor, 0.0f, 0.5f);
+		ImGui::SliderFloat("borderMargin", &borderMargin, 0.0f, 0.3f);
+		ImGui::SliderFloat("turnFactor", &turnFactor, 0.0f, 0.5f);
+		ImGui::SliderFloat("minSpeed", &minSpeed, 0.0f, 0.5f);
+		ImGui::SliderFloat("maxSpeed", &maxSpeed, 0.0f, 1.0f);
+		ImGui::SliderFloat("randFactor", &randFactor, 0.0f, 1.0f);
+	}
 
 
 
@@ -694,8 +2024,238 @@ void gui()
 	labhelper::perf::drawEventsWindow();
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// The scene and the overlays, into outputFramebuffer
+///////////////////////////////////////////////////////////////////////////////
+void renderFrame()
+{
+	display();
+	if (showDensityField)
+	{
+		drawDensityOverlay();
+	}
+	if (obstacleEnabled && showObstacle && obstacleFieldTexture != 0)
+	{
+		drawObstacleOverlay();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Runs 'frames' frames of 1/60 s without a window, for CI and batch nodes.
+/// Everything renders into an offscreen target; the last frame is written to
+/// 'imagePath' if one is given.
+///////////////////////////////////////////////////////////////////////////////
+int runHeadless(int frames, const char* imagePath)
+{
+	if (!labhelper::init_headless_context())
+	{
+		return EXIT_FAILURE;
+	}
+	windowWidth = 1280;
+	windowHeight = 720;
+	initialize();
+
+	FboInfo output(FboAttachments(1, GL_RGBA8));
+	output.resize(windowWidth, windowHeight);
+	outputFramebuffer = output.framebufferId;
+
+	const float frameTime = 1.0f / 60.0f;
+	for (int i = 0; i < frames; i++)
+	{
+		advanceSimulation(frameTime);
+		renderFrame();
+		labhelper::drainGLDebugMessages();
+	}
+	glFinish();
+	pollSimulationStats();
+	printf("%d frames, %llu steps on %s: %u particles, max speed %.4f, kinetic energy %.4f, "
+	       "density min/max/mean %.3f/%.3f/%.3f\n",
+	       frames, simStepCount, labhelper::headlessBackendName(), stats.aliveCount, stats.maxSpeed, stats.kineticEnergy,
+	       stats.minDensity, stats.maxDensity, stats.meanDensity);
+
+	if (imagePath != nullptr)
+	{
+		std::vector<unsigned char> pixels(windowWidth * windowHeight * 4);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, output.framebufferId);
+		glReadPixels(0, 0, windowWidth, windowHeight, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+		// GL's rows start at the bottom
+		const int rowSize = windowWidth * 4;
+		for (int y = 0; y < windowHeight / 2; y++)
+		{
+			std::swap_ranges(pixels.begin() + y * rowSize, pixels.begin() + (y + 1) * rowSize,
+			                 pixels.begin() + (windowHeight - 1 - y) * rowSize);
+		}
+		stbi_write_png(imagePath, windowWidth, windowHeight, 4, pixels.data(), rowSize);
+	}
+
+	snapshotWriter.finish();
+	trajectoryWriter.close();
+	output.release();
+	labhelper::shutDownHeadless();
+	return EXIT_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Times particle.comp with each neighbour traversal over a sweep of grid
+/// sizes and particle counts, i.e. of particles per cell. For every setting
+/// both start from the same spawn and run 'steps' steps; only the particle
+/// pass is timed, not the grid update. The difference column is how far the
+/// two disagree on the positions after the first step.
+///////////////////////////////////////////////////////////////////////////////
+int runBenchmark(int steps)
+{
+	if (!labhelper::init_headless_context())
+	{
+		return EXIT_FAILURE;
+	}
+	windowWidth = 1280;
+	windowHeight = 720;
+	initialize();
+
+	const int gridSizes[] = { 2, 4, 8, 16, 32 };
+	const int particleCounts[] = { 1024, 2048, 4096 };
+
+	GLuint startState;
+	glGenBuffers(1, &startState);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, startState);
+	glBufferStorage(GL_COPY_WRITE_BUFFER, sizeof(particle) * MAX_PARTICLES, nullptr, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	GLuint timer;
+	glGenQueries(1, &timer);
+
+	printf("%5s %10s %9s %15s %15s %8s %10s\n", "grid", "particles", "per cell", "per particle ms",
+	       "tiled ms", "speedup", "max diff");
+	for (int grid : gridSizes)
+	{
+		for (int count : particleCounts)
+		{
+			gridSize = grid;
+			smoothingRadius = std::min(0.35f, 2.0f / (float)grid);
+			spawnCount = count;
+			initializeparticles();
+			glCopyNamedBufferSubData(particleSSBO, startState, 0, 0, sizeof(particle) * MAX_PARTICLES);
+
+			double milliseconds[TRAVERSAL_COUNT];
+			std::vector<particle> firstStep[TRAVERSAL_COUNT];
+			for (int traversal = 0; traversal < TRAVERSAL_COUNT; traversal++)
+			{
+				neighborTraversal = NeighborTraversal(traversal);
+
+				// One untimed step to compare the results, which also warms up the program
+				glCopyNamedBufferSubData(startState, particleSSBO, 0, 0, sizeof(particle) * MAX_PARTICLES);
+				updateGrid();
+				updateparticlePositions(simTimestep, true);
+				firstStep[traversal] = readParticles();
+
+				glCopyNamedBufferSubData(startState, particleSSBO, 0, 0, sizeof(particle) * MAX_PARTICLES);
+				GLuint64 total = 0;
+				for (int i = 0; i < steps; i++)
+				{
+					updateGrid();
+					glBeginQuery(GL_TIME_ELAPSED, timer);
+					updateparticlePositions(simTimestep, true);
+					glEndQuery(GL_TIME_ELAPSED);
+					GLuint64 elapsed = 0;
+					glGetQueryObjectui64v(timer, GL_QUERY_RESULT, &elapsed);
+					total += elapsed;
+				}
+				milliseconds[traversal] = double(total) / 1e6 / std::max(steps, 1);
+			}
+
+			// The atomic grid build leaves each cell's particles in whatever order the
+			// atomics landed, so the buffers are compared particle by particle, by id
+			for (int traversal = 0; traversal < TRAVERSAL_COUNT; traversal++)
+			{
+				std::sort(firstStep[traversal].begin(), firstStep[traversal].end(),
+				          [](const particle& a, const particle& b) { return a.id < b.id; });
+			}
+			float maxDifference = 0.0f;
+			for (size_t i = 0; i < firstStep[0].size() && i < firstStep[1].size(); i++)
+			{
+				maxDifference = std::max(maxDifference, length(firstStep[0][i].position - firstStep[1][i].position));
+			}
+			printf("%5d %10d %9.1f %15.4f %15.4f %7.2fx %10.2e\n", grid, count, float(count) / float(grid * grid),
+			       milliseconds[TRAVERSAL_PER_PARTICLE], milliseconds[TRAVERSAL_TILED],
+			       milliseconds[TRAVERSAL_PER_PARTICLE] / std::max(milliseconds[TRAVERSAL_TILED], 1e-9), maxDifference);
+		}
+	}
+
+	glDeleteQueries(1, &timer);
+	glDeleteBuffers(1, &startState);
+	snapshotWriter.finish();
+	trajectoryWriter.close();
+	labhelper::shutDownHeadless();
+	return EXIT_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Decodes every frame of a recorded trajectory and prints a line per frame,
+/// to check a recording without loading it into an analysis tool. Fails if a
+/// frame doesn't decode or its particles aren't in strictly increasing id
+/// order.
+///////////////////////////////////////////////////////////////////////////////
+int printTrajectoryInfo(const char* path)
+{
+	TrajectoryReader reader;
+	if (!reader.open(path))
+	{
+		return EXIT_FAILURE;
+	}
+	printf("%s: %llu frames, up to %u particles\n", path, (unsigned long long)reader.frameCount(),
+	       reader.particleCount());
+	printf("%8s %10s %10s %10s %12s %10s\n", "frame", "step", "time", "particles", "mean speed", "ids");
+
+	std::vector<uint32_t> ids;
+	std::vector<vec2> positions;
+	std::vector<vec2> velocities;
+	bool valid = true;
+	for (uint64_t frame = 0; frame < reader.frameCount(); frame++)
+	{
+		if (!reader.readFrame(frame, ids, positions, velocities))
+		{
+			fprintf(stderr, "Frame %llu of %s does not decode\n", (unsigned long long)frame, path);
+			return EXIT_FAILURE;
+		}
+		bool ordered = true;
+		for (size_t i = 1; i < ids.size(); i++)
+		{
+			ordered = ordered && ids[i - 1] < ids[i];
+		}
+		valid = valid && ordered;
+
+		float speed = 0.0f;
+		for (const vec2& velocity : velocities)
+		{
+			speed += length(velocity);
+		}
+		const TrajectoryIndexEntry& entry = reader.frame(frame);
+		printf("%8llu %10llu %10.3f %10u %12.4f %10s\n", (unsigned long long)frame, (unsigned long long)entry.step,
+		       entry.simTime, unsigned(ids.size()), velocities.empty() ? 0.0f : speed / float(velocities.size()),
+		       ordered ? "ordered" : "UNORDERED");
+	}
+	return valid ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 int main(int argc, char* argv[])
 {
+	// project --trajectory-info file.btraj
+	if (argc > 2 && strcmp(argv[1], "--trajectory-info") == 0)
+	{
+		return printTrajectoryInfo(argv[2]);
+	}
+	// project --headless [frames] [image.png]
+	if (argc > 1 && strcmp(argv[1], "--headless") == 0)
+	{
+		int frames = argc > 2 ? atoi(argv[2]) : 600;
+		return runHeadless(frames, argc > 3 ? argv[3] : nullptr);
+	}
+	// project --benchmark [steps]
+	if (argc > 1 && strcmp(argv[1], "--benchmark") == 0)
+	{
+		int steps = argc > 2 ? atoi(argv[2]) : 100;
+		return runBenchmark(steps);
+	}
+
 	g_window = labhelper::init_window_SDL("OpenGL Project");
 
 	initialize();
@@ -711,10 +2271,24 @@ int main(int argc, char* argv[])
 		currentTime = timeSinceStart.count();
 		deltaTime = currentTime - previousTime;
 
-		// check events (keyboard among other)
+		// check events (keyboard among other). Paused with nothing left to
+		// redraw, sleep until something happens rather than spinning.
 		stopRendering = handleEvents();
 
+		// Edited shaders are recompiled on the fly; ones that fail keep the old program
+		if (labhelper::shaderSourcesChanged())
+		{
+			loadShaders(true);
+			framePacer.requestRedraw();
+		}
+
 		if (isPaused)
+		{
+			// Snapshots and recordings still finish while paused
+			snapshotWriter.update();
+			trajectoryWriter.update();
+		}
+		if (!framePacer.beginFrame(isPaused))
 		{
 			continue;
 		}
@@ -722,13 +2296,14 @@ int main(int argc, char* argv[])
 		// Inform imgui of new frame
 		labhelper::newFrame( g_window );
 		
-		// Update particles
-		updateparticlePositions(deltaTime, true);
+		// Step the simulation in fixed increments of the elapsed time
+		if (!isPaused)
+		{
+			advanceSimulation(deltaTime);
+		}
 
-		updateGrid();
-		
 		// render to window
-		display();
+		renderFrame();
 
 		// Render overlay GUI.
 		gui();
@@ -738,8 +2313,16 @@ int main(int argc, char* argv[])
 
 		// Swap front and back buffer. This frame will now been displayed.
 		SDL_GL_SwapWindow(g_window);
+
+		framePacer.endFrame();
 	}
 
+	cpuSimulation.stop();
+
+	// Don't leave a half-written snapshot or an unindexed trajectory behind
+	snapshotWriter.finish();
+	trajectoryWriter.close();
+
 	// Shut down everything. This includes the window and all other subsystems.
 	labhelper::shutDown(g_window);
 	return 0;
@@ -0,0 +1,91 @@
+// Neighbour search over the particles sorted into grid buckets. A cell holds
+// bucketsPerCell buckets, one per species when sorting by species, so the
+// particles of one species in a cell are contiguous. prefixSums has a
+// trailing entry with the particle count. The grid has gridSize cells along
+// each axis, with x varying fastest, then y, then z. Typical use:
+//
+//     for (int n = 0; n < NEIGHBOR_CELLS; n++) {
+//         uint cell;
+//         if (!neighborCell(particle.gridIndex, n, cell)) continue;
+//         int start, end;
+//         cellRange(cell, start, end);
+//         for (int i = start; i < end; i++) { ... }
+//     }
+
+layout( std430, binding=4 ) readonly buffer PrefixSumsBuffer
+{
+    int prefixSums[];
+};
+
+uniform int gridSize;
+uniform int bucketsPerCell;
+
+// The 3x3 (or 3x3x3) block of cells around a particle's own
+#if SIMULATION_3D
+#define NEIGHBOR_CELLS 27
+#else
+#define NEIGHBOR_CELLS 9
+#endif
+
+// Position in cell units, [0, gridSize) on every axis. Rows run from the top
+// of the screen down, hence the flipped y.
+simvec gridCoords(simvec pos) {
+    pos.y = -pos.y;
+    pos = clamp(pos, simvec(-1.0 + 1e-6), simvec(1.0 - 1e-6));
+    return (pos + simvec(1.0)) * 0.5 * float(gridSize);
+}
+
+// Column, row (and layer) of a cell
+simivec cellCoords(uint cell) {
+#if SIMULATION_3D
+    return ivec3(int(cell) % gridSize, int(cell) / gridSize % gridSize, int(cell) / (gridSize * gridSize));
+#else
+    return ivec2(int(cell) % gridSize, int(cell) / gridSize);
+#endif
+}
+
+// The cell at 'coords', which must be on the grid
+uint cellAt(simivec coords) {
+#if SIMULATION_3D
+    return uint((coords.z * gridSize + coords.y) * gridSize + coords.x);
+#else
+    return uint(coords.y * gridSize + coords.x);
+#endif
+}
+
+uint cellOf(simvec pos) {
+    return cellAt(simivec(gridCoords(pos)));
+}
+
+// Cell n (0 to NEIGHBOR_CELLS - 1) of the block centred on 'cell', false if
+// it is off the grid
+bool neighborCell(uint cell, int n, out uint neighbor) {
+#if SIMULATION_3D
+    ivec3 coords = cellCoords(cell) + ivec3(n % 3, n / 3 % 3, n / 9) - ivec3(1);
+#else
+    ivec2 coords = cellCoords(cell) + ivec2(n % 3, n / 3) - ivec2(1);
+#endif
+    neighbor = 0u;
+    if (any(lessThan(coords, simivec(0))) || any(greaterThanEqual(coords, simivec(gridSize)))) {
+        return false;
+    }
+    neighbor = cellAt(coords);
+    return true;
+}
+
+// With one bucket per cell every species lands in bucket 0
+uint bucketOf(uint cell, uint species) {
+    return cell * uint(bucketsPerCell) + species % uint(bucketsPerCell);
+}
+
+// The particles of a bucket are [start, end) in the sorted buffer
+void bucketRange(uint bucket, out int start, out int end) {
+    start = prefixSums[bucket];
+    end = prefixSums[bucket + 1u];
+}
+
+// All buckets of a cell, i.e. every species
+void cellRange(uint cell, out int start, out int end) {
+    start = prefixSums[cell * uint(bucketsPerCell)];
+    end = prefixSums[(cell + 1u) * uint(bucketsPerCell)];
+}
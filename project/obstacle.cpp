@@ -0,0 +1,349 @@
+#include "obstacle.h"
+
+#include <Model.h>
+#include <labhelper.h>
+#include <jobs.h>
+#include "fbo.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using namespace glm;
+
+const char* obstacleBakeMethodNames[OBSTACLE_BAKE_METHOD_COUNT] = { "CPU", "GPU jump flood" };
+
+namespace
+{
+const char CACHE_MAGIC[4] = { 'B', 'S', 'D', 'F' };
+
+// Beyond the domain diagonal, for fields without any outline
+const float FAR_AWAY = 4.0f;
+
+struct Segment
+{
+	vec2 a, b;
+};
+
+uint64_t fnv1a(uint64_t hash, const void* data, size_t size)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+	for(size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// Mesh space to the domain: x and y across the section, z the (unscaled)
+// height above it
+mat4 meshToDomain(const labhelper::Model* model, const ObstacleSettings& settings)
+{
+	vec3 lo(FLT_MAX), hi(-FLT_MAX);
+	for(const vec3& p : model->m_positions)
+	{
+		lo = min(lo, p);
+		hi = max(hi, p);
+	}
+	// The two axes across the section, in x, y, z order
+	const int sectionAxes[3][2] = { { 1, 2 }, { 0, 2 }, { 0, 1 } };
+	int a = clamp(settings.sliceAxis, 0, 2);
+	int u = sectionAxes[a][0];
+	int v = sectionAxes[a][1];
+
+	vec3 center = 0.5f * (lo + hi);
+	float extent = 0.5f * std::max(hi[u] - lo[u], hi[v] - lo[v]);
+	float s = settings.scale / std::max(extent, 1e-6f);
+
+	mat4 m(0.0f);
+	m[u][0] = s;
+	m[v][1] = s;
+	m[a][2] = 1.0f;
+	m[3] = vec4(settings.offset.x - s * center[u], settings.offset.y - s * center[v],
+	            -mix(lo[a], hi[a], settings.sliceHeight), 1.0f);
+	return m;
+}
+
+std::string cachePath(const labhelper::Model* model, const ObstacleSettings& settings)
+{
+	uint64_t hash = 14695981039346656037ull;
+	hash = fnv1a(hash, model->m_positions.data(), model->m_positions.size() * sizeof(vec3));
+	const int32_t ints[3] = { settings.resolution, settings.sliceAxis, int32_t(settings.method) };
+	const float floats[4] = { settings.sliceHeight, settings.scale, settings.offset.x, settings.offset.y };
+	hash = fnv1a(hash, ints, sizeof(ints));
+	hash = fnv1a(hash, floats, sizeof(floats));
+
+	char name[40];
+	snprintf(name, sizeof(name), "obstacle_%016llx.sdf", (unsigned long long)hash);
+	return name;
+}
+
+bool readCache(const std::string& path, int resolution, std::vector<float>& field)
+{
+	FILE* file = fopen(path.c_str(), "rb");
+	if(file == nullptr)
+	{
+		return false;
+	}
+	char magic[4];
+	int32_t storedResolution = 0;
+	bool ok = fread(magic, sizeof(magic), 1, file) == 1 && memcmp(magic, CACHE_MAGIC, sizeof(magic)) == 0
+	          && fread(&storedResolution, sizeof(storedResolution), 1, file) == 1 && storedResolution == resolution
+	          && fread(field.data(), sizeof(float), field.size(), file) == field.size();
+	fclose(file);
+	return ok;
+}
+
+void writeCache(const std::string& path, int resolution, const std::vector<float>& field)
+{
+	// Written aside and renamed, so a crash never leaves half a bake behind
+	std::string temporaryPath = path + ".tmp";
+	FILE* file = fopen(temporaryPath.c_str(), "wb");
+	if(file == nullptr)
+	{
+		return;
+	}
+	int32_t storedResolution = resolution;
+	bool ok = fwrite(CACHE_MAGIC, sizeof(CACHE_MAGIC), 1, file) == 1
+	          && fwrite(&storedResolution, sizeof(storedResolution), 1, file) == 1
+	          && fwrite(field.data(), sizeof(float), field.size(), file) == field.size();
+	ok = fclose(file) == 0 && ok;
+	if(!ok || rename(temporaryPath.c_str(), path.c_str()) != 0)
+	{
+		remove(temporaryPath.c_str());
+	}
+}
+
+// Where the triangles cross z = 0. A closed mesh gives closed outlines.
+std::vector<Segment> sectionOutline(const labhelper::Model* model, const mat4& transform)
+{
+	std::vector<Segment> segments;
+	const std::vector<vec3>& positions = model->m_positions;
+	for(size_t t = 0; t + 2 < positions.size(); t += 3)
+	{
+		vec3 p[3];
+		for(int i = 0; i < 3; i++)
+		{
+			p[i] = vec3(transform * vec4(positions[t + i], 1.0f));
+		}
+		// Vertices on the plane count as above it, so a triangle crosses it on exactly 0 or 2 edges
+		vec2 crossings[2];
+		int n = 0;
+		for(int i = 0; i < 3; i++)
+		{
+			const vec3& a = p[i];
+			const vec3& b = p[(i + 1) % 3];
+			if((a.z >= 0.0f) != (b.z >= 0.0f))
+			{
+				crossings[n++] = mix(vec2(a), vec2(b), a.z / (a.z - b.z));
+			}
+		}
+		if(n == 2)
+		{
+			Segment segment = { crossings[0], crossings[1] };
+			segments.push_back(segment);
+		}
+	}
+	return segments;
+}
+
+float distanceToSegment(vec2 p, const Segment& segment)
+{
+	vec2 ab = segment.b - segment.a;
+	float t = clamp(dot(p - segment.a, ab) / std::max(dot(ab, ab), 1e-12f), 0.0f, 1.0f);
+	return length(p - (segment.a + t * ab));
+}
+
+void bakeCPU(const labhelper::Model* model, const mat4& transform, int resolution, std::vector<float>& field)
+{
+	std::vector<Segment> segments = sectionOutline(model, transform);
+	const float texelSize = 2.0f / float(resolution);
+
+	labhelper::jobs::parallelFor("Bake obstacle", resolution, 0, [&](int begin, int end) {
+		for(int y = begin; y < end; y++)
+		{
+			float py = (float(y) + 0.5f) * texelSize - 1.0f;
+
+			// Inside is an odd number of outline crossings to the right, found
+			// once per row from where the outline crosses it
+			std::vector<float> crossings;
+			for(const Segment& segment : segments)
+			{
+				if((segment.a.y > py) != (segment.b.y > py))
+				{
+					float t = (py - segment.a.y) / (segment.b.y - segment.a.y);
+					crossings.push_back(mix(segment.a.x, segment.b.x, t));
+				}
+			}
+			std::sort(crossings.begin(), crossings.end());
+
+			for(int x = 0; x < resolution; x++)
+			{
+				vec2 p((float(x) + 0.5f) * texelSize - 1.0f, py);
+				float nearest = FAR_AWAY;
+				for(const Segment& segment : segments)
+				{
+					nearest = std::min(nearest, distanceToSegment(p, segment));
+				}
+				size_t right = crossings.end() - std::upper_bound(crossings.begin(), crossings.end(), p.x);
+				field[size_t(y) * resolution + x] = (right % 2 == 1) ? -nearest : nearest;
+			}
+		}
+	});
+}
+
+void bakeJumpFlood(const labhelper::Model* model, const mat4& transform, int resolution,
+                   const ObstaclePrograms& programs, GLuint field)
+{
+	// Winding number of the mesh above the section: its triangles are
+	// flattened onto it, front faces adding one and back faces taking one
+	FboInfo mask(FboAttachments(1, GL_R16F, GL_NONE));
+	mask.resize(resolution, resolution);
+	glBindFramebuffer(GL_FRAMEBUFFER, mask.framebufferId);
+	glViewport(0, 0, resolution, resolution);
+	const float zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	glClearBufferfv(GL_COLOR, 0, zero);
+
+	GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+	GLboolean cullFace = glIsEnabled(GL_CULL_FACE);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+	glEnable(GL_CLIP_DISTANCE0);
+
+	glUseProgram(programs.mask);
+	labhelper::setUniformSlow(programs.mask, "meshToDomain", transform);
+	glBindVertexArray(model->m_vaob);
+	glDrawArrays(GL_TRIANGLES, 0, GLsizei(model->m_positions.size()));
+	glBindVertexArray(0);
+
+	glDisable(GL_CLIP_DISTANCE0);
+	glDisable(GL_BLEND);
+	if(depthTest)
+	{
+		glEnable(GL_DEPTH_TEST);
+	}
+	if(cullFace)
+	{
+		glEnable(GL_CULL_FACE);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	// Nearest edge texel of every texel, ping-ponged between the flood steps
+	GLuint seeds[2];
+	glGenTextures(2, seeds);
+	for(int i = 0; i < 2; i++)
+	{
+		glBindTexture(GL_TEXTURE_2D, seeds[i]);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG32I, resolution, resolution);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glUseProgram(programs.jumpFlood);
+	labhelper::setUniformSlow(programs.jumpFlood, "resolution", resolution);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, mask.colorTextureTargets[0]);
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	const GLuint groups = (resolution + 15) / 16;
+
+	int current = 0;
+	glBindImageTexture(0, seeds[1], 0, GL_FALSE, 0, GL_READ_ONLY, GL_RG32I);
+	glBindImageTexture(1, seeds[current], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG32I);
+	labhelper::setUniformSlow(programs.jumpFlood, "jumpFloodPass", 0);
+	glDispatchCompute(groups, groups, 1);
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+	// Halving steps from the largest power of two below the resolution, and
+	// a final extra step of one that catches most of the misses
+	int largestStep = 1;
+	while(largestStep * 2 < resolution)
+	{
+		largestStep *= 2;
+	}
+	std::vector<int> steps;
+	for(int step = largestStep; step >= 1; step /= 2)
+	{
+		steps.push_back(step);
+	}
+	steps.push_back(1);
+
+	labhelper::setUniformSlow(programs.jumpFlood, "jumpFloodPass", 1);
+	for(int step : steps)
+	{
+		glBindImageTexture(0, seeds[current], 0, GL_FALSE, 0, GL_READ_ONLY, GL_RG32I);
+		glBindImageTexture(1, seeds[1 - current], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG32I);
+		labhelper::setUniformSlow(programs.jumpFlood, "stepSize", step);
+		glDispatchCompute(groups, groups, 1);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		current = 1 - current;
+	}
+
+	glBindImageTexture(0, seeds[current], 0, GL_FALSE, 0, GL_READ_ONLY, GL_RG32I);
+	glBindImageTexture(2, field, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+	labhelper::setUniformSlow(programs.jumpFlood, "jumpFloodPass", 2);
+	glDispatchCompute(groups, groups, 1);
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+	glDeleteTextures(2, seeds);
+	mask.release();
+}
+
+void createFieldTexture(GLuint& field, int resolution)
+{
+	glDeleteTextures(1, &field);
+	glGenTextures(1, &field);
+	glBindTexture(GL_TEXTURE_2D, field);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32F, resolution, resolution);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+} // namespace
+
+bool bakeObstacleField(const ObstacleSettings& settings, const ObstaclePrograms& programs, GLuint& field)
+{
+	// loadModelFromOBJ() exits on a missing file
+	FILE* probe = fopen(settings.meshPath.c_str(), "r");
+	if(probe == nullptr)
+	{
+		labhelper::non_fatal_error("Could not open " + settings.meshPath, "Obstacle");
+		return false;
+	}
+	fclose(probe);
+
+	labhelper::Model* model = labhelper::loadModelFromOBJ(settings.meshPath);
+	const int resolution = settings.resolution;
+	const mat4 transform = meshToDomain(model, settings);
+	const std::string path = cachePath(model, settings);
+
+	createFieldTexture(field, resolution);
+	std::vector<float> values(size_t(resolution) * resolution);
+	if(readCache(path, resolution, values))
+	{
+		glTextureSubImage2D(field, 0, 0, 0, resolution, resolution, GL_RED, GL_FLOAT, values.data());
+	}
+	else
+	{
+		if(settings.method == OBSTACLE_BAKE_JUMP_FLOOD)
+		{
+			bakeJumpFlood(model, transform, resolution, programs, field);
+			glGetTextureImage(field, 0, GL_RED, GL_FLOAT, GLsizei(values.size() * sizeof(float)), values.data());
+		}
+		else
+		{
+			bakeCPU(model, transform, resolution, values);
+			glTextureSubImage2D(field, 0, 0, 0, resolution, resolution, GL_RED, GL_FLOAT, values.data());
+		}
+		writeCache(path, resolution, values);
+	}
+
+	labhelper::freeModel(model);
+	return true;
+}
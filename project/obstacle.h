@@ -0,0 +1,44 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <string>
+
+///////////////////////////////////////////////////////////////////////////////
+// Obstacles, baked from a cross-section of an .obj mesh into a 2D signed
+// distance field over the [-1, 1] domain (negative inside). particle.comp
+// samples it to push particles out and reflect their velocities. Bakes are
+// cached on disk, keyed by a hash of the mesh and the settings.
+///////////////////////////////////////////////////////////////////////////////
+enum ObstacleBakeMethod
+{
+	OBSTACLE_BAKE_CPU,        // Exact distance to the section outline, across all cores
+	OBSTACLE_BAKE_JUMP_FLOOD, // Rasterized on the GPU and flooded by jumpFlood.comp, within a texel
+	OBSTACLE_BAKE_METHOD_COUNT
+};
+
+extern const char* obstacleBakeMethodNames[OBSTACLE_BAKE_METHOD_COUNT];
+
+struct ObstacleSettings
+{
+	std::string meshPath;
+	int resolution;            // Texels along each side of the field
+	int sliceAxis;             // Mesh axis the section is taken across, 0-2
+	float sliceHeight;         // Position of the section along it, 0-1 over the mesh bounds
+	float scale;               // Half the larger extent of the section in the domain
+	glm::vec2 offset;          // Where the mesh centre lands in the domain
+	ObstacleBakeMethod method;
+};
+
+struct ObstaclePrograms
+{
+	GLuint mask;      // obstacleMask.vert / obstacleMask.frag
+	GLuint jumpFlood; // jumpFlood.comp
+};
+
+/**
+	* Bakes the obstacle into 'field', an r32f texture that is (re)created at
+	* settings.resolution. Returns false, leaving 'field' alone, if the mesh
+	* can't be loaded.
+	*/
+bool bakeObstacleField(const ObstacleSettings& settings, const ObstaclePrograms& programs, GLuint& field);
@@ -0,0 +1,11 @@
+#version 420
+
+precision highp float;
+
+layout(location = 0) out float winding;
+
+void main()
+{
+	// Summed by additive blending, non-zero inside a closed mesh
+	winding = gl_FrontFacing ? 1.0 : -1.0;
+}
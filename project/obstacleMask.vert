@@ -0,0 +1,15 @@
+#version 420
+
+// Flattens the obstacle mesh onto the section for the jump flood bake, see
+// bakeJumpFlood() in obstacle.cpp
+layout(location = 0) in vec3 position;
+
+uniform mat4 meshToDomain;
+
+void main()
+{
+	vec4 p = meshToDomain * vec4(position, 1.0);
+	// Only the part of the mesh above the section
+	gl_ClipDistance[0] = p.z;
+	gl_Position = vec4(p.xy, 0.0, 1.0);
+}
@@ -0,0 +1,18 @@
+#version 430
+
+precision highp float;
+
+// Draws the obstacle field from obstacle.cpp: its inside shaded and its
+// outline traced where the distance crosses zero
+layout(binding = 0) uniform sampler2D obstacleField;
+layout(location = 0) out vec4 fragmentColor;
+
+uniform ivec2 viewportSize;
+
+void main() {
+    vec2 uv = gl_FragCoord.xy / vec2(viewportSize);
+    float d = texture(obstacleField, uv).x;
+    float outline = 1.0 - smoothstep(0.0, 1.5 * fwidth(d), abs(d));
+    float fill = d < 0.0 ? 0.6 : 0.0;
+    fragmentColor = vec4(mix(vec3(0.35), vec3(0.9), outline), max(fill, outline));
+}
@@ -0,0 +1,87 @@
+#include "pacing.h"
+
+#include <imgui.h>
+
+#include <algorithm>
+#include <thread>
+
+namespace
+{
+const int hiddenFrameRate = 60;  // Minimized windows don't vsync, cap them instead
+const int idleWaitMs = 100;
+const int redrawsAfterEvent = 3; // ImGui takes a couple of frames to settle after input
+} // namespace
+
+FramePacer::FramePacer() : targetFrameRate(0), vsyncEnabled(true), pendingRedraws(1), windowVisible(true)
+{
+}
+
+bool FramePacer::waitForEvent(SDL_Event& event, bool isPaused)
+{
+	if (isPaused && pendingRedraws == 0)
+	{
+		return SDL_WaitEventTimeout(&event, idleWaitMs) != 0;
+	}
+	return SDL_PollEvent(&event) != 0;
+}
+
+void FramePacer::onEvent(const SDL_Event& event)
+{
+	pendingRedraws = redrawsAfterEvent;
+
+	if (event.type == SDL_WINDOWEVENT
+	    && (event.window.event == SDL_WINDOWEVENT_MINIMIZED || event.window.event == SDL_WINDOWEVENT_HIDDEN))
+	{
+		windowVisible = false;
+	}
+	if (event.type == SDL_WINDOWEVENT
+	    && (event.window.event == SDL_WINDOWEVENT_RESTORED || event.window.event == SDL_WINDOWEVENT_SHOWN))
+	{
+		windowVisible = true;
+	}
+}
+
+bool FramePacer::beginFrame(bool isPaused)
+{
+	if (isPaused && pendingRedraws == 0)
+	{
+		return false;
+	}
+	pendingRedraws = std::max(pendingRedraws - 1, 0);
+	return true;
+}
+
+// Deadlines advance by whole periods, so the average rate holds even when
+// individual sleeps overshoot
+void FramePacer::endFrame()
+{
+	const int rate = windowVisible ? targetFrameRate : hiddenFrameRate;
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (rate <= 0)
+	{
+		nextFrameDeadline = now;
+		return;
+	}
+	nextFrameDeadline += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+	    std::chrono::duration<double>(1.0 / rate));
+	if (nextFrameDeadline < now)
+	{
+		// Fell behind (or the cap was just turned on), don't try to catch up
+		nextFrameDeadline = now;
+		return;
+	}
+	std::this_thread::sleep_until(nextFrameDeadline);
+}
+
+void FramePacer::gui(bool isPaused)
+{
+	if (isPaused)
+	{
+		ImGui::Text("Paused (space to resume), only redrawing on input");
+	}
+	ImGui::SliderInt("Frame rate cap (0 = off)", &targetFrameRate, 0, 240);
+	if (ImGui::Checkbox("Vsync", &vsyncEnabled))
+	{
+		SDL_GL_SetSwapInterval(vsyncEnabled ? 1 : 0);
+	}
+}
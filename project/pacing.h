@@ -0,0 +1,53 @@
+#pragma once
+
+#include <SDL.h>
+
+#include <chrono>
+
+///////////////////////////////////////////////////////////////////////////////
+// Frame pacing for the windowed main loops of both apps. While paused, the
+// loop sleeps in SDL until an event comes in and only redraws for it; the
+// timeout keeps the shader watcher and the background writers going. Running,
+// frames can be capped below vsync, and minimized windows (which don't vsync)
+// always are. A loop goes:
+//
+//     handle events, starting with waitForEvent() and passing each to onEvent()
+//     if (!pacer.beginFrame(isPaused)) continue;
+//     draw and swap
+//     pacer.endFrame();
+///////////////////////////////////////////////////////////////////////////////
+class FramePacer
+{
+public:
+	FramePacer();
+
+	/**
+		* The first event of the frame. Paused with nothing left to redraw, this
+		* blocks until one arrives or the idle timeout runs out, otherwise it
+		* only polls. Returns false if there is none, like SDL_PollEvent().
+		*/
+	bool waitForEvent(SDL_Event& event, bool isPaused);
+
+	// Every handled event, schedules the redraws it needs and tracks visibility
+	void onEvent(const SDL_Event& event);
+
+	// For changes that are not events, e.g. a shader reload
+	void requestRedraw() { pendingRedraws = 1; }
+
+	// False if the frame can be skipped, i.e. paused with nothing to redraw
+	bool beginFrame(bool isPaused);
+
+	// Sleeps off what is left of the frame under the frame rate cap
+	void endFrame();
+
+	// The frame rate cap and vsync controls
+	void gui(bool isPaused);
+
+	int targetFrameRate; // Frames per second, 0 leaves it to vsync
+	bool vsyncEnabled;
+
+private:
+	int pendingRedraws;
+	bool windowVisible;
+	std::chrono::steady_clock::time_point nextFrameDeadline;
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+
+///////////////////////////////////////////////////////////////////////////////
+// Dimensions, fixed at compile time. project3d builds the same modules with
+// SIMULATION_3D set, and hands it to the shaders along with the rest of their
+// defines; common.glsl defaults to 2D just like this.
+///////////////////////////////////////////////////////////////////////////////
+#ifndef SIMULATION_3D
+#define SIMULATION_3D 0
+#endif
+
+#if SIMULATION_3D
+const int SIMULATION_DIMENSIONS = 3;
+#else
+const int SIMULATION_DIMENSIONS = 2;
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Particle layout, shared with the ParticleData struct in the compute shaders
+// (std430, so keep it a multiple of 16 bytes)
+///////////////////////////////////////////////////////////////////////////////
+#if SIMULATION_3D
+// A vec3 is 16 byte aligned in std430, so each one shares its 16 bytes with
+// a scalar and nothing is wasted but the tail
+struct particle {
+	glm::vec3 position;
+	uint32_t bucketIndex;
+	glm::vec3 velocity;
+	uint32_t gridIndex;
+	glm::vec3 grad;
+	float density;
+	uint32_t species;    // Index into SpeciesBlock::species
+	uint32_t id;         // Set at spawn or emission and kept for life, see ParticlePopulation
+	uint32_t padding[2]; // std430 rounds the struct up to its alignment
+};
+static_assert(sizeof(particle) == 64, "particle must match the std430 ParticleData");
+#else
+struct particle {
+	glm::vec2 position;
+	glm::vec2 velocity;
+	uint32_t bucketIndex;
+	uint32_t gridIndex;
+	float density;
+	uint32_t species; // Index into SpeciesBlock::species
+	glm::vec2 grad;
+	uint32_t id;      // Set at spawn or emission and kept for life, see ParticlePopulation
+	uint32_t padding; // std430 rounds the struct up to its 8 byte alignment
+};
+static_assert(sizeof(particle) == 48, "particle must match the std430 ParticleData");
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Species, shared with SpeciesParams and the species buffer in common.glsl
+///////////////////////////////////////////////////////////////////////////////
+const int MAX_SPECIES = 4;
+
+struct SpeciesParams {
+	glm::vec4 color;
+	float mass;
+	float gravityScale;
+	float padding[2];
+};
+
+struct SpeciesBlock {
+	SpeciesParams species[MAX_SPECIES];
+	// How strongly a particle is pushed away from (positive) or pulled into
+	// (negative) another species' density, [self * MAX_SPECIES + other]
+	float interaction[MAX_SPECIES * MAX_SPECIES];
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// The alive count and the indirect commands derived from it, shared with the
+// population buffer in common.glsl (written by population.comp)
+///////////////////////////////////////////////////////////////////////////////
+struct DispatchIndirectCommand {
+	uint32_t groupsX, groupsY, groupsZ;
+};
+
+struct DrawArraysIndirectCommand {
+	uint32_t count, instanceCount, first, baseInstance;
+};
+
+struct PopulationBlock {
+	uint32_t aliveCount;
+	DispatchIndirectCommand particleGroups;     // PARTICLE_GROUP_SIZE particles per group
+	DispatchIndirectCommand particleWorkgroups; // A group per particle, as many as a dispatch allows
+	DrawArraysIndirectCommand points;
+	DrawArraysIndirectCommand arrowGlyphs;      // See glyph.vert
+	DrawArraysIndirectCommand diskGlyphs;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Random streams, keep independent uses of labhelper::random apart
+///////////////////////////////////////////////////////////////////////////////
+const uint32_t RANDOM_STREAM_INIT = 0;
+const uint32_t RANDOM_STREAM_JITTER = 1;   // boid.comp
+const uint32_t RANDOM_STREAM_POISSON = 2;
+const uint32_t RANDOM_STREAM_EMIT = 3;     // population.comp
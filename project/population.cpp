@@ -0,0 +1,218 @@
+#include "population.h"
+
+#include <labhelper.h>
+#include <perf.h>
+#include <scan.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+using namespace glm;
+
+namespace
+{
+// Must match the pass constants in population.comp
+const int POPULATION_MARK = 0;
+const int POPULATION_COMPACT = 1;
+const int POPULATION_EMIT = 2;
+const int POPULATION_FINALIZE = 3;
+
+const GLuint PARTICLE_GROUP_SIZE = 256; // As in common.glsl
+
+GLuint groupsFor(GLuint count)
+{
+	return (count + PARTICLE_GROUP_SIZE - 1) / PARTICLE_GROUP_SIZE;
+}
+} // namespace
+
+void initPopulationSettings(PopulationSettings& settings)
+{
+	for(int i = 0; i < MAX_EMITTERS; i++)
+	{
+		Emitter& emitter = settings.emitters[i];
+		emitter.enabled = false;
+		emitter.boxMin = vec2(-0.1f, 0.7f);
+		emitter.boxMax = vec2(0.1f, 0.9f);
+		emitter.velocity = vec2(0.0f, -0.5f);
+		emitter.rate = 100.0f;
+		emitter.species = 0;
+		emitter.pending = 0.0f;
+	}
+	for(int i = 0; i < MAX_SINKS; i++)
+	{
+		Sink& sink = settings.sinks[i];
+		sink.enabled = false;
+		sink.boxMin = vec2(-0.1f, -1.0f);
+		sink.boxMax = vec2(0.1f, -0.8f);
+	}
+}
+
+void pipeFlowPreset(PopulationSettings& settings)
+{
+	initPopulationSettings(settings);
+
+	Emitter& inlet = settings.emitters[0];
+	inlet.enabled = true;
+	inlet.boxMin = vec2(-0.98f, -0.4f);
+	inlet.boxMax = vec2(-0.9f, 0.4f);
+	inlet.velocity = vec2(0.6f, 0.0f);
+	inlet.rate = 400.0f;
+
+	// The walls keep particles within 0.99, so the outlet reaches a bit past that
+	Sink& outlet = settings.sinks[0];
+	outlet.enabled = true;
+	outlet.boxMin = vec2(0.9f, -1.0f);
+	outlet.boxMax = vec2(1.0f, 1.0f);
+}
+
+ParticlePopulation::ParticlePopulation()
+    : populationBuffer(0), survivorBuffer(0), particleCapacity(0), nextParticleId(0)
+{
+}
+
+void ParticlePopulation::init(GLuint capacity)
+{
+	particleCapacity = capacity;
+
+	PopulationBlock empty;
+	memset(&empty, 0, sizeof(empty));
+	glGenBuffers(1, &populationBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, populationBuffer);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(PopulationBlock), &empty, GL_DYNAMIC_STORAGE_BIT);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, populationBuffer);
+
+	glGenBuffers(1, &survivorBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, survivorBuffer);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * (capacity + 1), nullptr, 0);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void ParticlePopulation::reset(GLuint populationProgram, GLuint aliveCount, GLuint firstUnusedId)
+{
+	aliveCount = std::min(aliveCount, particleCapacity);
+	nextParticleId = std::max(aliveCount, firstUnusedId);
+	glNamedBufferSubData(populationBuffer, offsetof(PopulationBlock, aliveCount), sizeof(GLuint), &aliveCount);
+	finalize(populationProgram, 0);
+}
+
+void ParticlePopulation::finalize(GLuint populationProgram, GLuint emitted)
+{
+	glUseProgram(populationProgram);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, populationBuffer);
+	labhelper::setUniformSlow(populationProgram, "populationPass", POPULATION_FINALIZE);
+	labhelper::setUniformSlow(populationProgram, "capacity", particleCapacity);
+	labhelper::setUniformSlow(populationProgram, "totalEmitted", emitted);
+	glDispatchCompute(1, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+}
+
+void ParticlePopulation::update(GLuint populationProgram,
+                                PopulationSettings& settings,
+                                GLuint particleBuffer,
+                                GLuint scratchBuffer,
+                                float deltaTime,
+                                GLuint seed,
+                                GLuint step)
+{
+	vec4 sinkBoxes[MAX_SINKS];
+	int sinkCount = 0;
+	for(int i = 0; i < MAX_SINKS; i++)
+	{
+		const Sink& sink = settings.sinks[i];
+		if(sink.enabled)
+		{
+			sinkBoxes[sinkCount++] = vec4(sink.boxMin, sink.boxMax);
+		}
+	}
+
+	GLuint emitCounts[MAX_EMITTERS];
+	GLuint totalEmitted = 0;
+	for(int i = 0; i < MAX_EMITTERS; i++)
+	{
+		Emitter& emitter = settings.emitters[i];
+		emitCounts[i] = 0;
+		if(!emitter.enabled)
+		{
+			emitter.pending = 0.0f;
+			continue;
+		}
+		// Whatever doesn't fit is dropped on the GPU, the CPU doesn't know how full it is
+		emitter.pending += std::max(emitter.rate, 0.0f) * deltaTime;
+		float whole = std::floor(emitter.pending);
+		emitter.pending -= whole;
+		emitCounts[i] = GLuint(std::min(whole, float(particleCapacity)));
+		totalEmitted += emitCounts[i];
+	}
+
+	if(sinkCount == 0 && totalEmitted == 0)
+	{
+		return; // The count and commands from the last change still hold
+	}
+	labhelper::perf::Scope s( "Sources and sinks" );
+
+	const GLuint capacity = particleCapacity;
+	glUseProgram(populationProgram);
+	labhelper::setUniformSlow(populationProgram, "capacity", capacity);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, particleBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, populationBuffer);
+
+	if(sinkCount > 0)
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, survivorBuffer);
+		labhelper::setUniformSlow(populationProgram, "populationPass", POPULATION_MARK);
+		labhelper::setUniformSlow(populationProgram, "sinkCount", sinkCount);
+		labhelper::setUniformSlow(populationProgram, "sinks", GLuint(sinkCount), sinkBoxes);
+		glDispatchCompute(groupsFor(capacity), 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		labhelper::scanBuffer(survivorBuffer, survivorBuffer, capacity, true);
+
+		glUseProgram(populationProgram);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, scratchBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, survivorBuffer);
+		labhelper::setUniformSlow(populationProgram, "populationPass", POPULATION_COMPACT);
+		glDispatchCompute(groupsFor(capacity), 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+		glCopyNamedBufferSubData(scratchBuffer, particleBuffer, 0, 0, sizeof(particle) * capacity);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+
+	if(totalEmitted > 0)
+	{
+		labhelper::setUniformSlow(populationProgram, "populationPass", POPULATION_EMIT);
+		labhelper::setUniformSlow(populationProgram, "seed", seed);
+		labhelper::setUniformSlow(populationProgram, "step", step);
+		labhelper::setUniformSlow(populationProgram, "firstId", nextParticleId);
+		GLuint firstEmitted = 0;
+		for(int i = 0; i < MAX_EMITTERS; i++)
+		{
+			if(emitCounts[i] == 0)
+			{
+				continue;
+			}
+			const Emitter& emitter = settings.emitters[i];
+			labhelper::setUniformSlow(populationProgram, "emitCount", emitCounts[i]);
+			labhelper::setUniformSlow(populationProgram, "firstEmitted", firstEmitted);
+			labhelper::setUniformSlow(populationProgram, "emitterBox", vec4(emitter.boxMin, emitter.boxMax));
+			labhelper::setUniformSlow(populationProgram, "emitterVelocity", emitter.velocity);
+			labhelper::setUniformSlow(populationProgram, "emitterSpecies", GLuint(std::max(emitter.species, 0)));
+			glDispatchCompute(groupsFor(emitCounts[i]), 1, 1);
+			firstEmitted += emitCounts[i];
+		}
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		// Ids of the ones past capacity go unused, which is harmless
+		nextParticleId += totalEmitted;
+	}
+
+	finalize(populationProgram, totalEmitted);
+}
+
+GLuint ParticlePopulation::readAliveCount() const
+{
+	GLuint aliveCount = 0;
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	glGetNamedBufferSubData(populationBuffer, offsetof(PopulationBlock, aliveCount), sizeof(GLuint), &aliveCount);
+	return aliveCount;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "particle.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Sources and sinks, for inflow/outflow scenarios. The particle buffers are
+// sized for a fixed capacity, of which the first aliveCount are alive; that
+// count only exists on the GPU (see PopulationBlock). Each step population.comp
+// drops what is inside a sink, compacts the survivors with a scan and appends
+// what the emitters spawn. Per-particle passes and draws read their sizes from
+// the indirect commands it leaves in the population buffer, so the CPU never
+// needs to know how many particles there are.
+//
+// Every particle keeps the id it was given for life: a spawn numbers them
+// from 0 and emitted ones continue from there, so ids are never reused
+// within a run. Buffer order says nothing about identity, the grid build
+// and compaction reorder the particles every step.
+///////////////////////////////////////////////////////////////////////////////
+const int MAX_EMITTERS = 4;
+const int MAX_SINKS = 4; // Must match population.comp
+
+struct Emitter
+{
+	bool enabled;
+	glm::vec2 boxMin;   // New particles are spread uniformly over the box
+	glm::vec2 boxMax;
+	glm::vec2 velocity;
+	float rate;         // Particles per simulated second
+	int species;
+	float pending;      // Fraction of a particle carried over to the next step
+};
+
+struct Sink
+{
+	bool enabled;
+	glm::vec2 boxMin;
+	glm::vec2 boxMax;
+};
+
+struct PopulationSettings
+{
+	Emitter emitters[MAX_EMITTERS];
+	Sink sinks[MAX_SINKS];
+};
+
+/**
+	* Everything disabled, with boxes that are a sensible start once enabled.
+	*/
+void initPopulationSettings(PopulationSettings& settings);
+
+/**
+	* Flow through a channel along x: an inlet at the left wall feeding an
+	* outlet at the right one. Replaces the first emitter and sink, disables
+	* the others.
+	*/
+void pipeFlowPreset(PopulationSettings& settings);
+
+class ParticlePopulation
+{
+public:
+	ParticlePopulation();
+
+	/**
+		* Creates the population buffer and binds it to SSBO binding 9, which
+		* is where common.glsl expects it.
+		*/
+	void init(GLuint capacity);
+
+	// Also the source of the indirect commands, offsets as in PopulationBlock
+	GLuint buffer() const { return populationBuffer; }
+	GLuint capacity() const { return particleCapacity; }
+
+	/**
+		* Sets the alive count after the particles were replaced wholesale, by a
+		* spawn or a snapshot, and rebuilds the indirect commands for it. Their
+		* ids must be below 'firstUnusedId', or below aliveCount if that is
+		* larger (a spawn numbers them 0 to aliveCount - 1); emitted particles
+		* continue from there.
+		*/
+	void reset(GLuint populationProgram, GLuint aliveCount, GLuint firstUnusedId = 0);
+
+	// What the next emitted particle will be numbered, e.g. for a snapshot
+	GLuint nextId() const { return nextParticleId; }
+
+	/**
+		* Runs the sinks and emitters for one step of 'deltaTime'. The emitters'
+		* fractional particles are carried in 'settings'. 'scratchBuffer' must
+		* hold 'capacity' particles; the compaction goes through it.
+		*/
+	void update(GLuint populationProgram,
+	            PopulationSettings& settings,
+	            GLuint particleBuffer,
+	            GLuint scratchBuffer,
+	            float deltaTime,
+	            GLuint seed,
+	            GLuint step);
+
+	/**
+		* Reads the alive count back, waiting for the GPU. Only for handing the
+		* particles to the CPU, never in the frame loop.
+		*/
+	GLuint readAliveCount() const;
+
+private:
+	void finalize(GLuint populationProgram, GLuint emitted);
+
+	GLuint populationBuffer;
+	GLuint survivorBuffer; // capacity + 1 uints, see population.comp
+	GLuint particleCapacity;
+	GLuint nextParticleId; // Given to the next emitted particle
+
+	ParticlePopulation(const ParticlePopulation&) = delete;
+	ParticlePopulation& operator=(const ParticlePopulation&) = delete;
+};
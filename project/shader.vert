@@ -1,11 +1,16 @@
 #version 430
 
 layout(location = 0) in vec4 boid;
+layout(location = 1) in vec4 previousBoid;
+
+uniform float interpolationAlpha = 1.0;
 
 out vec2 boidSpeed;
 
 void main()
 {
-	gl_Position = vec4(boid[0], boid[1], 0.0, 1.0);
+	// Blend between the last two simulation states to hide the fixed timestep
+	vec2 position = mix(previousBoid.xy, boid.xy, interpolationAlpha);
+	gl_Position = vec4(position, 0.0, 1.0);
 	boidSpeed = vec2(boid[2], boid[3]);
 }
@@ -0,0 +1,74 @@
+#include "simulation.h"
+
+#include <string>
+#include <utility>
+
+using namespace glm;
+
+const char* neighborTraversalNames[TRAVERSAL_COUNT] = { "Per particle", "Tiled per cell" };
+const char* smoothingKernelNames[KERNEL_TYPE_COUNT] = { "Spiky", "Cubic spline" };
+
+GLuint initSpecies(SpeciesBlock& speciesBlock)
+{
+	const vec3 colors[MAX_SPECIES] = { vec3(0.2f, 0.6f, 1.0f), vec3(1.0f, 0.4f, 0.2f), vec3(0.3f, 0.9f, 0.3f),
+	                                   vec3(0.9f, 0.8f, 0.2f) };
+	for (int i = 0; i < MAX_SPECIES; i++) {
+		speciesBlock.species[i].color = vec4(colors[i], 1.0f);
+		speciesBlock.species[i].mass = 1.0f;
+		speciesBlock.species[i].gravityScale = 1.0f;
+		speciesBlock.species[i].padding[0] = speciesBlock.species[i].padding[1] = 0.0f;
+	}
+	for (int i = 0; i < MAX_SPECIES * MAX_SPECIES; i++) {
+		speciesBlock.interaction[i] = 1.0f;
+	}
+
+	GLuint speciesBuffer;
+	glGenBuffers(1, &speciesBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, speciesBuffer);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(SpeciesBlock), &speciesBlock, GL_DYNAMIC_STORAGE_BIT);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, speciesBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	return speciesBuffer;
+}
+
+void updateSpeciesBuffer(GLuint speciesBuffer, const SpeciesBlock& speciesBlock)
+{
+	glNamedBufferSubData(speciesBuffer, 0, sizeof(SpeciesBlock), &speciesBlock);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, speciesBuffer);
+}
+
+int bucketsPerCell(bool sortBySpecies, int numSpecies)
+{
+	return sortBySpecies && numSpecies > 1 ? numSpecies : 1;
+}
+
+labhelper::ShaderDefines simulationDefines()
+{
+	labhelper::ShaderDefines defines;
+#if SIMULATION_3D
+	defines.push_back(std::make_pair(std::string("SIMULATION_3D"), std::string("1")));
+#endif
+	return defines;
+}
+
+labhelper::ShaderDefines kernelPermutation(SmoothingKernelType kernel)
+{
+	labhelper::ShaderDefines defines = simulationDefines();
+	defines.push_back(std::make_pair(std::string("KERNEL_TYPE"), std::to_string(int(kernel))));
+	return defines;
+}
+
+labhelper::ShaderDefines particlePermutation(NeighborTraversal traversal,
+                                             SmoothingKernelType kernel,
+                                             bool stirring,
+                                             int cellBuckets)
+{
+	const bool tiled = traversal == TRAVERSAL_TILED;
+	labhelper::ShaderDefines defines = kernelPermutation(kernel);
+	defines.push_back(std::make_pair(std::string("WORKGROUP_SIZE"),
+	                                 std::to_string(tiled ? tiledWorkgroupSize : particleWorkgroupSize)));
+	defines.push_back(std::make_pair(std::string("NEIGHBOR_TRAVERSAL"), std::to_string(int(traversal))));
+	defines.push_back(std::make_pair(std::string("MOUSE_INTERACTION"), std::string(stirring ? "1" : "0")));
+	defines.push_back(std::make_pair(std::string("SPECIES_SORTED"), std::string(cellBuckets > 1 ? "1" : "0")));
+	return defines;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <labhelper.h>
+
+#include "particle.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// The simulation settings the 2D and 3D apps have in common: how particle.comp
+// is specialized, the default species and the buckets they are sorted into.
+// Compiled into each app with its own SIMULATION_3D, see particle.h.
+///////////////////////////////////////////////////////////////////////////////
+
+// How particle.comp finds neighbours, see the TRAVERSAL_* defines there
+enum NeighborTraversal
+{
+	TRAVERSAL_PER_PARTICLE, // An invocation per particle, neighbours read from the buffer
+	TRAVERSAL_TILED,        // A workgroup per cell, neighbours staged in shared memory
+	TRAVERSAL_COUNT
+};
+
+extern const char* neighborTraversalNames[TRAVERSAL_COUNT];
+
+// The density kernel, see KERNEL_TYPE in common.glsl. The CPU engine always uses the spiky one.
+enum SmoothingKernelType
+{
+	KERNEL_SPIKY,
+	KERNEL_CUBIC_SPLINE,
+	KERNEL_TYPE_COUNT
+};
+
+extern const char* smoothingKernelNames[KERNEL_TYPE_COUNT];
+
+const int particleWorkgroupSize = 256; // PARTICLE_GROUP_SIZE in common.glsl, the indirect dispatch is sized for it
+const int tiledWorkgroupSize = 64;     // Invocations per cell, and particles per shared memory tile
+
+/**
+	* Distinct colours, unit mass and gravity, every pair repelling equally.
+	* Creates the species buffer from 'speciesBlock' and binds it to SSBO
+	* binding 8, where common.glsl expects it.
+	*/
+GLuint initSpecies(SpeciesBlock& speciesBlock);
+
+// Picks up GUI edits, it's small enough to send every frame
+void updateSpeciesBuffer(GLuint speciesBuffer, const SpeciesBlock& speciesBlock);
+
+// Buckets in each grid cell, one per species when sorting by species
+int bucketsPerCell(bool sortBySpecies, int numSpecies);
+
+// What every program is compiled with so it sees the same dimensions as the host code
+labhelper::ShaderDefines simulationDefines();
+
+// density.comp, and the start of every particle.comp permutation
+labhelper::ShaderDefines kernelPermutation(SmoothingKernelType kernel);
+
+// particle.comp, specialized on workgroup size, neighbour traversal, kernel,
+// bucket layout and whether the stir tool is active
+labhelper::ShaderDefines particlePermutation(NeighborTraversal traversal,
+                                             SmoothingKernelType kernel,
+                                             bool stirring,
+                                             int cellBuckets);
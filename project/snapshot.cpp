@@ -0,0 +1,399 @@
+#include "snapshot.h"
+#include "particle.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <labhelper.h>
+#include <jobs.h>
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+const uint64_t COLUMN_ALIGNMENT = 64;
+const uint32_t WRITE_CHUNK = 64 * 1024; // Particles converted per fwrite
+
+uint64_t alignUp(uint64_t offset)
+{
+	return (offset + COLUMN_ALIGNMENT - 1) / COLUMN_ALIGNMENT * COLUMN_ALIGNMENT;
+}
+
+// Read-only memory mapping of a whole file
+struct MappedFile
+{
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#else
+	int fd = -1;
+#endif
+
+	bool open(const std::string& path)
+	{
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		                   FILE_ATTRIBUTE_NORMAL, nullptr);
+		if(file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER fileSize;
+		GetFileSizeEx(file, &fileSize);
+		size = size_t(fileSize.QuadPart);
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if(mapping == nullptr)
+			return false;
+		data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+		fd = ::open(path.c_str(), O_RDONLY);
+		if(fd < 0)
+			return false;
+		struct stat st;
+		fstat(fd, &st);
+		size = size_t(st.st_size);
+		void* ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		data = ptr == MAP_FAILED ? nullptr : static_cast<const uint8_t*>(ptr);
+#endif
+		return data != nullptr;
+	}
+
+	~MappedFile()
+	{
+#ifdef _WIN32
+		if(data != nullptr)
+			UnmapViewOfFile(data);
+		if(mapping != nullptr)
+			CloseHandle(mapping);
+		if(file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+#else
+		if(data != nullptr)
+			munmap(const_cast<uint8_t*>(data), size);
+		if(fd >= 0)
+			close(fd);
+#endif
+	}
+};
+
+// Pads the file with zeros up to 'offset'
+void seekTo(FILE* file, uint64_t offset)
+{
+	static const char zeros[COLUMN_ALIGNMENT] = {};
+	uint64_t position = uint64_t(ftell(file));
+	if(offset > position)
+	{
+		fwrite(zeros, 1, size_t(offset - position), file);
+	}
+}
+
+// Converts and writes one column in chunks. 'convert' writes element i to dst.
+template <typename Convert>
+void writeColumn(FILE* file, uint64_t offset, uint32_t count, size_t elementSize, Convert convert)
+{
+	seekTo(file, offset);
+	std::vector<uint8_t> chunk(WRITE_CHUNK * elementSize);
+	for(uint32_t begin = 0; begin < count; begin += WRITE_CHUNK)
+	{
+		uint32_t end = std::min(count, begin + WRITE_CHUNK);
+		for(uint32_t i = begin; i < end; i++)
+		{
+			convert(i, &chunk[(i - begin) * elementSize]);
+		}
+		fwrite(chunk.data(), elementSize, end - begin, file);
+	}
+}
+} // namespace
+
+void initSnapshotHeader(SnapshotHeader& header, uint32_t particleCount, bool fp16Positions)
+{
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "BOIDSNAP", 8);
+	header.version = SNAPSHOT_VERSION;
+	header.flags = fp16Positions ? SNAPSHOT_FP16_POSITIONS : 0;
+	layoutSnapshotColumns(header, particleCount);
+}
+
+void layoutSnapshotColumns(SnapshotHeader& header, uint32_t particleCount)
+{
+	header.particleCount = particleCount;
+
+	const bool fp16Positions = (header.flags & SNAPSHOT_FP16_POSITIONS) != 0;
+	uint64_t positionSize = fp16Positions ? sizeof(uint32_t) : sizeof(glm::vec2);
+	header.positionOffset = alignUp(sizeof(SnapshotHeader));
+	header.velocityOffset = alignUp(header.positionOffset + positionSize * particleCount);
+	header.densityOffset = alignUp(header.velocityOffset + sizeof(glm::vec2) * particleCount);
+	header.speciesOffset = alignUp(header.densityOffset + sizeof(float) * particleCount);
+	header.idOffset = alignUp(header.speciesOffset + sizeof(uint32_t) * particleCount);
+	header.fileSize = header.idOffset + sizeof(uint32_t) * particleCount;
+}
+
+SnapshotWriter::SnapshotWriter()
+    : stagingBuffer(0), stagingSize(0), mappedStaging(nullptr), copyFence(nullptr), pendingCount(false), writing(false)
+{
+}
+
+SnapshotWriter::~SnapshotWriter()
+{
+	if(writeJob)
+	{
+		labhelper::jobs::wait(writeJob);
+		writeJob.reset();
+	}
+}
+
+void SnapshotWriter::init(GLsizeiptr particleBufferSize)
+{
+	stagingSize = particleBufferSize;
+	glGenBuffers(1, &stagingBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, stagingBuffer);
+	GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	const GLsizeiptr size = stagingSize + sizeof(uint32_t);
+	glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags | GL_CLIENT_STORAGE_BIT);
+	mappedStaging = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+bool SnapshotWriter::isBusy() const
+{
+	return copyFence != nullptr || writing;
+}
+
+bool SnapshotWriter::request(GLuint particleBuffer, const SnapshotHeader& header, const std::string& path, GLuint countBuffer)
+{
+	if(isBusy())
+	{
+		return false;
+	}
+	if(writeJob)
+	{
+		labhelper::jobs::wait(writeJob);
+		writeJob.reset();
+	}
+
+	GLsizeiptr size = sizeof(particle) * header.particleCount;
+	if(size > stagingSize)
+	{
+		labhelper::non_fatal_error("Snapshot larger than the staging buffer", "Snapshot");
+		return false;
+	}
+
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	glCopyNamedBufferSubData(particleBuffer, stagingBuffer, 0, 0, size);
+	if(countBuffer != 0)
+	{
+		glCopyNamedBufferSubData(countBuffer, stagingBuffer, 0, stagingSize, sizeof(uint32_t));
+	}
+	glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+	copyFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	pendingHeader = header;
+	pendingPath = path;
+	pendingCount = countBuffer != 0;
+	return true;
+}
+
+void SnapshotWriter::update()
+{
+	if(copyFence == nullptr)
+	{
+		return;
+	}
+
+	GLenum status = glClientWaitSync(copyFence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+	if(status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+	{
+		glDeleteSync(copyFence);
+		copyFence = nullptr;
+		if(pendingCount)
+		{
+			uint32_t count;
+			memcpy(&count, static_cast<const char*>(mappedStaging) + stagingSize, sizeof(count));
+			// Only the columns move, the simulation fields stay as requested
+			layoutSnapshotColumns(pendingHeader, std::min(count, pendingHeader.particleCount));
+		}
+		writing = true;
+		writeJob = labhelper::jobs::submit("Write snapshot", [this]() { write(); });
+	}
+}
+
+void SnapshotWriter::finish()
+{
+	if(copyFence != nullptr)
+	{
+		glClientWaitSync(copyFence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		update();
+	}
+	if(writeJob)
+	{
+		labhelper::jobs::wait(writeJob);
+		writeJob.reset();
+	}
+}
+
+void SnapshotWriter::write()
+{
+	const particle* particles = static_cast<const particle*>(mappedStaging);
+	const SnapshotHeader& header = pendingHeader;
+	const uint32_t count = header.particleCount;
+
+	// Write next to the target and rename at the end, so a crash mid-write
+	// never leaves a truncated checkpoint behind
+	std::string tmpPath = pendingPath + ".tmp";
+	FILE* file = fopen(tmpPath.c_str(), "wb");
+	if(file == nullptr)
+	{
+		fprintf(stderr, "Snapshot: could not open %s for writing\n", tmpPath.c_str());
+		writing = false;
+		return;
+	}
+
+	fwrite(&header, sizeof(header), 1, file);
+
+	if(header.flags & SNAPSHOT_FP16_POSITIONS)
+	{
+		writeColumn(file, header.positionOffset, count, sizeof(uint32_t), [&](uint32_t i, uint8_t* dst) {
+			uint32_t packed = glm::packHalf2x16(particles[i].position);
+			memcpy(dst, &packed, sizeof(packed));
+		});
+	}
+	else
+	{
+		writeColumn(file, header.positionOffset, count, sizeof(glm::vec2), [&](uint32_t i, uint8_t* dst) {
+			memcpy(dst, &particles[i].position, sizeof(glm::vec2));
+		});
+	}
+	writeColumn(file, header.velocityOffset, count, sizeof(glm::vec2), [&](uint32_t i, uint8_t* dst) {
+		memcpy(dst, &particles[i].velocity, sizeof(glm::vec2));
+	});
+	writeColumn(file, header.densityOffset, count, sizeof(float), [&](uint32_t i, uint8_t* dst) {
+		memcpy(dst, &particles[i].density, sizeof(float));
+	});
+	writeColumn(file, header.speciesOffset, count, sizeof(uint32_t), [&](uint32_t i, uint8_t* dst) {
+		memcpy(dst, &particles[i].species, sizeof(uint32_t));
+	});
+	writeColumn(file, header.idOffset, count, sizeof(uint32_t), [&](uint32_t i, uint8_t* dst) {
+		memcpy(dst, &particles[i].id, sizeof(uint32_t));
+	});
+
+	bool ok = ferror(file) == 0;
+	fclose(file);
+	if(ok)
+	{
+		remove(pendingPath.c_str());
+		ok = rename(tmpPath.c_str(), pendingPath.c_str()) == 0;
+	}
+	if(!ok)
+	{
+		fprintf(stderr, "Snapshot: failed to write %s\n", pendingPath.c_str());
+	}
+
+	writing = false;
+}
+
+bool loadSnapshot(const std::string& path,
+                  GLuint particleBuffer,
+                  GLuint unpackProgram,
+                  uint32_t maxParticleCount,
+                  SnapshotHeader& header)
+{
+	MappedFile file;
+	if(!file.open(path))
+	{
+		labhelper::non_fatal_error("Could not open snapshot " + path, "Snapshot");
+		return false;
+	}
+	if(file.size < sizeof(SnapshotHeader))
+	{
+		labhelper::non_fatal_error(path + " is not a snapshot", "Snapshot");
+		return false;
+	}
+
+	memcpy(&header, file.data, sizeof(SnapshotHeader));
+	if(memcmp(header.magic, "BOIDSNAP", 8) != 0 || header.version != SNAPSHOT_VERSION)
+	{
+		labhelper::non_fatal_error(path + " is not a version " + std::to_string(SNAPSHOT_VERSION) + " snapshot",
+		                           "Snapshot");
+		return false;
+	}
+	if(header.fileSize > file.size)
+	{
+		labhelper::non_fatal_error(path + " is truncated", "Snapshot");
+		return false;
+	}
+	// Nothing to upload, and zero-sized buffer storage is an error
+	if(header.particleCount == 0)
+	{
+		labhelper::non_fatal_error(path + " holds no particles", "Snapshot");
+		return false;
+	}
+	if(header.particleCount > maxParticleCount)
+	{
+		labhelper::non_fatal_error(path + " holds " + std::to_string(header.particleCount)
+		                               + " particles, the simulation has room for " + std::to_string(maxParticleCount),
+		                           "Snapshot");
+		return false;
+	}
+	// The columns are read below, so they must be where the count puts them
+	SnapshotHeader expected = header;
+	layoutSnapshotColumns(expected, header.particleCount);
+	if(memcmp(&expected, &header, sizeof(SnapshotHeader)) != 0)
+	{
+		labhelper::non_fatal_error(path + " has a corrupt column layout", "Snapshot");
+		return false;
+	}
+	// Species index the species buffer on the GPU
+	const uint8_t* speciesColumn = file.data + header.speciesOffset;
+	for(uint32_t i = 0; i < header.particleCount; i++)
+	{
+		uint32_t species;
+		memcpy(&species, speciesColumn + sizeof(uint32_t) * i, sizeof(species));
+		if(species >= uint32_t(MAX_SPECIES))
+		{
+			labhelper::non_fatal_error(path + " has a particle of species " + std::to_string(species)
+			                               + ", the simulation has species 0 to " + std::to_string(MAX_SPECIES - 1),
+			                           "Snapshot");
+			return false;
+		}
+	}
+
+	// Upload the columns as they are in the mapping, the shader does the unpacking
+	GLuint columnBuffer;
+	glGenBuffers(1, &columnBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, columnBuffer);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, GLsizeiptr(header.fileSize - header.positionOffset),
+	                file.data + header.positionOffset, 0);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glUseProgram(unpackProgram);
+	labhelper::setUniformSlow(unpackProgram, "count", GLint(header.particleCount));
+	labhelper::setUniformSlow(unpackProgram, "velocityOffset",
+	                          GLint((header.velocityOffset - header.positionOffset) / sizeof(uint32_t)));
+	labhelper::setUniformSlow(unpackProgram, "densityOffset",
+	                          GLint((header.densityOffset - header.positionOffset) / sizeof(uint32_t)));
+	labhelper::setUniformSlow(unpackProgram, "speciesOffset",
+	                          GLint((header.speciesOffset - header.positionOffset) / sizeof(uint32_t)));
+	labhelper::setUniformSlow(unpackProgram, "idOffset",
+	                          GLint((header.idOffset - header.positionOffset) / sizeof(uint32_t)));
+	labhelper::setUniformSlow(unpackProgram, "halfPositions", (header.flags & SNAPSHOT_FP16_POSITIONS) != 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, columnBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, particleBuffer);
+	glDispatchCompute((header.particleCount + 1023) / 1024, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	glDeleteBuffers(1, &columnBuffer);
+	return true;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include <jobs.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Snapshot files: a fixed header followed by one column per particle field
+// (structure of arrays), each column 64-byte aligned. Positions can be stored
+// as fp16 to halve the largest column. Bucket/grid indices and gradients are
+// not stored, the next grid update and step recompute them. Ids are, so a
+// particle keeps its identity across a save and restore, see population.h.
+///////////////////////////////////////////////////////////////////////////////
+const uint32_t SNAPSHOT_VERSION = 3; // 2: species column and count, 3: id column and next id
+const uint32_t SNAPSHOT_FP16_POSITIONS = 1 << 0;
+
+struct SnapshotHeader
+{
+	char magic[8]; // "BOIDSNAP"
+	uint32_t version;
+	uint32_t flags;
+	uint32_t particleCount;
+	uint32_t gridSize;
+	uint64_t step;
+	float simTime;
+	float smoothingRadius;
+	float kernelScalingFactor;
+	float gravityStrength;
+	uint32_t gravityEnabled;
+	uint32_t seed;
+	uint32_t speciesCount;
+	uint32_t nextId; // Given to the next emitted particle, past every stored id
+	// Byte offsets of the columns from the start of the file
+	uint64_t positionOffset;
+	uint64_t velocityOffset;
+	uint64_t densityOffset;
+	uint64_t speciesOffset;
+	uint64_t idOffset;
+	uint64_t fileSize;
+};
+
+/**
+	* Writes snapshots without stalling the frame loop: the particle buffer is
+	* copied into a persistently mapped staging buffer on the GPU, and once its
+	* fence has signalled a job converts and writes it out.
+	*/
+class SnapshotWriter
+{
+public:
+	SnapshotWriter();
+	~SnapshotWriter();
+
+	void init(GLsizeiptr particleBufferSize);
+
+	/**
+		* Starts a snapshot of the first header.particleCount particles. With a
+		* 'countBuffer', its first uint (copied along on the GPU) trims that
+		* further once the copy has landed. Returns false (and does nothing) if
+		* the previous one is still being written.
+		*/
+	bool request(GLuint particleBuffer, const SnapshotHeader& header, const std::string& path, GLuint countBuffer = 0);
+
+	/**
+		* Call once per frame, hands finished GPU copies to the writer thread.
+		*/
+	void update();
+
+	bool isBusy() const;
+
+	/**
+		* Blocks until any pending snapshot has been written.
+		*/
+	void finish();
+
+private:
+	void write();
+
+	GLuint stagingBuffer;
+	GLsizeiptr stagingSize; // For the particles, the count goes after them
+	const void* mappedStaging;
+	GLsync copyFence;
+
+	SnapshotHeader pendingHeader;
+	std::string pendingPath;
+	bool pendingCount;
+	labhelper::jobs::JobHandle writeJob;
+	std::atomic<bool> writing;
+
+	SnapshotWriter(const SnapshotWriter&) = delete;
+	SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+};
+
+/**
+	* Fills in the magic, version, flags and column layout of a header for
+	* 'particleCount' particles. The simulation fields are left to the caller.
+	*/
+void initSnapshotHeader(SnapshotHeader& header, uint32_t particleCount, bool fp16Positions);
+
+/**
+	* Sets the particle count and recomputes the column offsets and file size
+	* for it, keeping the flags and simulation fields.
+	*/
+void layoutSnapshotColumns(SnapshotHeader& header, uint32_t particleCount);
+
+/**
+	* Maps the file and uploads its columns directly from the mapping to the
+	* GPU, where unpackProgram (snapshotUnpack.comp) scatters them into
+	* particleBuffer. Returns false if the file is missing or damaged, holds
+	* no particles or more than 'maxParticleCount', or has a species the
+	* simulation doesn't (MAX_SPECIES or above).
+	*/
+bool loadSnapshot(const std::string& path,
+                  GLuint particleBuffer,
+                  GLuint unpackProgram,
+                  uint32_t maxParticleCount,
+                  SnapshotHeader& header);
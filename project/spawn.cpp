@@ -0,0 +1,244 @@
+#include "spawn.h"
+
+#include <labhelper.h>
+#include <jobs.h>
+#include <random.h>
+#include <stb_image.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <utility>
+#include <vector>
+
+using namespace glm;
+
+const char* spawnLayoutNames[SPAWN_LAYOUT_COUNT] = {
+	"Uniform", "Dam break", "Ring", "Explosion", "Poisson disk", "Image"
+};
+
+#if !SIMULATION_3D
+namespace
+{
+particle makeParticle(vec2 position, uint32_t species)
+{
+	particle p;
+	p.position = position;
+	p.velocity = vec2(0.0f);
+	p.bucketIndex = 0;
+	p.gridIndex = 0;
+	p.density = 0.0f;
+	p.species = species;
+	p.grad = vec2(0.0f);
+	p.id = 0; // Numbered by spawnParticlesCPU()
+	p.padding = 0;
+	return p;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Parallel dart throwing (Wei 2008). Cells are r/sqrt(2) wide, so each holds
+// at most one sample and conflicts reach two cells away. Cells three apart
+// can therefore be filled concurrently without seeing each other's writes;
+// the 3x3 phases are swept a few times to get close to a maximal sampling.
+///////////////////////////////////////////////////////////////////////////////
+void spawnPoissonDisk(particle* particles, int count, const SpawnSettings& settings)
+{
+	const float range = 1.0f - settings.margin;
+	const float extent = 2.0f * range;
+	// Maximal Poisson disk sets hold about 0.69 / r^2 samples per unit area,
+	// pick r a little smaller so there are enough to choose from
+	const float radius = 0.9f * sqrtf(0.69f * extent * extent / float(count));
+	const float cellSize = radius / sqrtf(2.0f);
+	const int cells = std::max(1, int(ceilf(extent / cellSize)));
+	const int rounds = 4;
+	const int attempts = 4;
+
+	std::vector<vec2> samples(cells * cells);
+	std::vector<char> occupied(cells * cells, 0);
+
+	for(int round = 0; round < rounds; round++)
+	{
+		for(int phase = 0; phase < 9; phase++)
+		{
+			int phaseX = phase % 3;
+			int phaseY = phase / 3;
+			int phaseCellsX = (cells - phaseX + 2) / 3;
+			int phaseCellsY = (cells - phaseY + 2) / 3;
+
+			labhelper::jobs::parallelFor("Poisson disk", phaseCellsX * phaseCellsY, 0, [&](int begin, int end) {
+				for(int k = begin; k < end; k++)
+				{
+					int cellX = phaseX + 3 * (k % phaseCellsX);
+					int cellY = phaseY + 3 * (k / phaseCellsX);
+					int cellIndex = cellY * cells + cellX;
+					if(occupied[cellIndex])
+					{
+						continue;
+					}
+
+					for(int attempt = 0; attempt < attempts; attempt++)
+					{
+						vec4 r = labhelper::random::uniform4(settings.seed, cellIndex, round * attempts + attempt,
+						                                     RANDOM_STREAM_POISSON);
+						vec2 candidate = vec2(-range) + (vec2(cellX, cellY) + vec2(r.x, r.y)) * cellSize;
+						if(candidate.x > range || candidate.y > range)
+						{
+							continue;
+						}
+
+						bool conflict = false;
+						for(int y = std::max(0, cellY - 2); y <= std::min(cells - 1, cellY + 2) && !conflict; y++)
+						{
+							for(int x = std::max(0, cellX - 2); x <= std::min(cells - 1, cellX + 2); x++)
+							{
+								int neighbor = y * cells + x;
+								if(occupied[neighbor] && distance(samples[neighbor], candidate) < radius)
+								{
+									conflict = true;
+									break;
+								}
+							}
+						}
+
+						if(!conflict)
+						{
+							samples[cellIndex] = candidate;
+							occupied[cellIndex] = 1;
+							break;
+						}
+					}
+				}
+			});
+		}
+	}
+
+	// Keep a random (but seed-determined) subset so the cut doesn't follow the cell order
+	std::vector<std::pair<uint32_t, int>> order;
+	for(int i = 0; i < cells * cells; i++)
+	{
+		if(occupied[i])
+		{
+			uvec4 key = labhelper::random::philox4x32(uvec4(i, 0, RANDOM_STREAM_POISSON, 1), uvec2(settings.seed, 0));
+			order.push_back(std::make_pair(key.x, i));
+		}
+	}
+	std::sort(order.begin(), order.end());
+
+	int numSamples = std::min(count, int(order.size()));
+	if(numSamples < count)
+	{
+		printf("Poisson disk: only %d of %d particles placed, the rest are uniform\n", numSamples, count);
+	}
+
+	labhelper::jobs::parallelFor("Poisson disk fill", count, 0, [&](int begin, int end) {
+		for(int i = begin; i < end; i++)
+		{
+			if(i < numSamples)
+			{
+				particles[i] = makeParticle(samples[order[i].second], i % settings.speciesCount);
+			}
+			else
+			{
+				vec4 r = labhelper::random::uniform4(settings.seed, i, 0, RANDOM_STREAM_INIT);
+				particles[i] = makeParticle(vec2(-range) + vec2(r.x, r.y) * extent, i % settings.speciesCount);
+			}
+		}
+	});
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Rejection sampling against the image luminance, bright areas get more
+// particles. Each particle draws its own darts, so this is trivially parallel.
+///////////////////////////////////////////////////////////////////////////////
+bool spawnFromImage(particle* particles, int count, const SpawnSettings& settings)
+{
+	int width, height, components;
+	unsigned char* image = stbi_load(settings.imagePath.c_str(), &width, &height, &components, STBI_rgb_alpha);
+	if(image == nullptr)
+	{
+		labhelper::non_fatal_error("Failed to load spawn image: " + settings.imagePath, "Spawn");
+		return false;
+	}
+
+	const float range = 1.0f - settings.margin;
+	const int maxAttempts = 64;
+
+	labhelper::jobs::parallelFor("Spawn from image", count, 0, [&](int begin, int end) {
+		for(int i = begin; i < end; i++)
+		{
+			vec4 r;
+			for(int attempt = 0; attempt < maxAttempts; attempt++)
+			{
+				r = labhelper::random::uniform4(settings.seed, i, attempt, RANDOM_STREAM_INIT);
+				int x = std::min(width - 1, int(r.x * width));
+				int y = std::min(height - 1, int(r.y * height));
+				const unsigned char* texel = image + 4 * (y * width + x);
+				float luminance = (0.2126f * texel[0] + 0.7152f * texel[1] + 0.0722f * texel[2]) / 255.0f;
+				float weight = luminance * texel[3] / 255.0f;
+				if(r.z < weight)
+				{
+					break;
+				}
+			}
+			particles[i] = makeParticle(vec2(-range) + vec2(r.x, r.y) * (2.0f * range), i % settings.speciesCount);
+		}
+	});
+
+	stbi_image_free(image);
+	return true;
+}
+} // namespace
+#endif
+
+bool isGPUSpawnLayout(SpawnLayout layout)
+{
+	return layout <= SPAWN_EXPLOSION;
+}
+
+void spawnParticlesGPU(GLuint spawnProgram, GLuint particleBuffer, int count, const SpawnSettings& settings)
+{
+	glUseProgram(spawnProgram);
+	labhelper::setUniformSlow(spawnProgram, "layoutType", GLint(settings.layout));
+	labhelper::setUniformSlow(spawnProgram, "count", GLint(count));
+	labhelper::setUniformSlow(spawnProgram, "seed", settings.seed);
+	labhelper::setUniformSlow(spawnProgram, "margin", settings.margin);
+	labhelper::setUniformSlow(spawnProgram, "speciesCount", GLint(settings.speciesCount));
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, particleBuffer);
+	glDispatchCompute((count + 1023) / 1024, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+}
+
+bool spawnParticlesCPU(particle* particles, int count, const SpawnSettings& settings)
+{
+#if SIMULATION_3D
+	// Both layouts are planar
+	(void)particles;
+	(void)count;
+	(void)settings;
+	return false;
+#else
+	bool spawned = false;
+	switch(settings.layout)
+	{
+	case SPAWN_POISSON_DISK:
+		spawnPoissonDisk(particles, count, settings);
+		spawned = true;
+		break;
+	case SPAWN_IMAGE:
+		spawned = spawnFromImage(particles, count, settings);
+		break;
+	default:
+		break;
+	}
+	if(spawned)
+	{
+		// Like spawn.comp, ids are the initial indices
+		for(int i = 0; i < count; i++)
+		{
+			particles[i].id = uint32_t(i);
+		}
+	}
+	return spawned;
+#endif
+}
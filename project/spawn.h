@@ -0,0 +1,50 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <string>
+
+#include "particle.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Initial conditions. The analytic layouts are generated by spawn.comp
+// straight into the particle buffer; the ones that need neighbour queries or
+// an image are built on the CPU across all cores and uploaded once.
+///////////////////////////////////////////////////////////////////////////////
+enum SpawnLayout
+{
+	// GPU (must match the constants in spawn.comp)
+	SPAWN_UNIFORM,
+	SPAWN_DAM_BREAK,
+	SPAWN_RING,
+	SPAWN_EXPLOSION,
+	// CPU
+	SPAWN_POISSON_DISK,
+	SPAWN_IMAGE,
+	SPAWN_LAYOUT_COUNT
+};
+
+extern const char* spawnLayoutNames[SPAWN_LAYOUT_COUNT];
+
+struct SpawnSettings
+{
+	SpawnLayout layout;
+	GLuint seed;
+	float margin;          // Distance kept from the [-1, 1] walls
+	std::string imagePath; // Density source for SPAWN_IMAGE
+	int speciesCount;      // Species are handed out round-robin by particle index
+};
+
+bool isGPUSpawnLayout(SpawnLayout layout);
+
+/**
+	* Fills the first 'count' particles of 'particleBuffer' on the GPU. Only for
+	* layouts where isGPUSpawnLayout() is true.
+	*/
+void spawnParticlesGPU(GLuint spawnProgram, GLuint particleBuffer, int count, const SpawnSettings& settings);
+
+/**
+	* Fills 'particles' on the CPU. Returns false if the layout could not be
+	* generated (e.g. the image failed to load). The CPU layouts are 2D only,
+	* with SIMULATION_3D this always fails.
+	*/
+bool spawnParticlesCPU(particle* particles, int count, const SpawnSettings& settings);
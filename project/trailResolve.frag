@@ -0,0 +1,13 @@
+#version 430
+
+precision highp float;
+
+// Packed 10-bit RGB written by trails.comp
+layout(binding = 0) uniform usampler2D trailTexture;
+layout(location = 0) out vec4 fragmentColor;
+
+void main() {
+    uint value = texelFetch(trailTexture, ivec2(gl_FragCoord.xy), 0).x;
+    uvec3 color = uvec3(value & 0x3FFu, (value >> 10) & 0x3FFu, (value >> 20) & 0x3FFu);
+    fragmentColor = vec4(vec3(color) / 1023.0, 1.0);
+}
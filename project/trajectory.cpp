@@ -0,0 +1,501 @@
+#include "trajectory.h"
+
+#include <compress.h>
+#include <labhelper.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+bool seekTo(FILE* file, uint64_t offset)
+{
+#ifdef _WIN32
+	return _fseeki64(file, int64_t(offset), SEEK_SET) == 0;
+#else
+	return fseeko(file, off_t(offset), SEEK_SET) == 0;
+#endif
+}
+} // namespace
+
+///////////////////////////////////////////////////////////////////////////////
+// Writer
+///////////////////////////////////////////////////////////////////////////////
+TrajectoryWriter::TrajectoryWriter()
+    : nextSlot(0), pendingSlot(0), file(nullptr), stagingSize(0), previousCount(0), stopping(false), written(0),
+      dropped(0), fileOffset(0)
+{
+	for(int i = 0; i < RING_SIZE; i++)
+	{
+		slots[i].buffer = 0;
+		slots[i].mapped = nullptr;
+		slots[i].fence = nullptr;
+		slots[i].state = SLOT_FREE;
+	}
+}
+
+TrajectoryWriter::~TrajectoryWriter()
+{
+	if(worker.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			stopping = true;
+		}
+		queueCondition.notify_one();
+		worker.join();
+	}
+	if(file != nullptr)
+	{
+		fclose(file);
+	}
+}
+
+bool TrajectoryWriter::open(const std::string& path, uint32_t particleCount, uint32_t stepStride, uint32_t keyframeInterval)
+{
+	if(isOpen())
+	{
+		close();
+	}
+
+	file = fopen(path.c_str(), "wb");
+	if(file == nullptr)
+	{
+		labhelper::non_fatal_error("Could not open " + path + " for writing", "Trajectory");
+		return false;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "BOIDTRAJ", 8);
+	header.version = TRAJECTORY_VERSION;
+	header.particleCount = particleCount;
+	header.stepStride = stepStride > 0 ? stepStride : 1;
+	header.keyframeInterval = keyframeInterval > 0 ? keyframeInterval : 1;
+	fwrite(&header, sizeof(header), 1, file);
+	fileOffset = sizeof(header);
+
+	index.clear();
+	previousCount = 0;
+	written = 0;
+	dropped = 0;
+
+	size_t words = size_t(TRAJECTORY_COLUMNS) * particleCount;
+	order.resize(particleCount);
+	current.resize(words);
+	previous.resize(words);
+	shuffled.resize(words * sizeof(uint32_t));
+	compressed.resize(labhelper::lz4CompressBound(shuffled.size()));
+
+	stagingSize = sizeof(particle) * particleCount;
+	const GLsizeiptr size = stagingSize + sizeof(uint32_t);
+	GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	for(int i = 0; i < RING_SIZE; i++)
+	{
+		glGenBuffers(1, &slots[i].buffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, slots[i].buffer);
+		glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags | GL_CLIENT_STORAGE_BIT);
+		slots[i].mapped = static_cast<const particle*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags));
+		slots[i].state = SLOT_FREE;
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	nextSlot = 0;
+	pendingSlot = 0;
+
+	stopping = false;
+	worker = std::thread(&TrajectoryWriter::workerLoop, this);
+	return true;
+}
+
+bool TrajectoryWriter::isOpen() const
+{
+	return file != nullptr;
+}
+
+uint32_t TrajectoryWriter::stepStride() const
+{
+	return header.stepStride;
+}
+
+bool TrajectoryWriter::record(GLuint particleBuffer, uint64_t step, float simTime, GLuint countBuffer)
+{
+	Slot& slot = slots[nextSlot];
+	if(slot.state != SLOT_FREE)
+	{
+		dropped++;
+		return false;
+	}
+
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	glCopyNamedBufferSubData(particleBuffer, slot.buffer, 0, 0, stagingSize);
+	if(countBuffer != 0)
+	{
+		glCopyNamedBufferSubData(countBuffer, slot.buffer, 0, stagingSize, sizeof(uint32_t));
+	}
+	glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot.step = step;
+	slot.simTime = simTime;
+	slot.counted = countBuffer != 0;
+	slot.state = SLOT_COPYING;
+
+	nextSlot = (nextSlot + 1) % RING_SIZE;
+	return true;
+}
+
+void TrajectoryWriter::update()
+{
+	// Hand slots over strictly in recording order, the deltas depend on it
+	while(slots[pendingSlot].state == SLOT_COPYING)
+	{
+		Slot& slot = slots[pendingSlot];
+		GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		{
+			break;
+		}
+		glDeleteSync(slot.fence);
+		slot.fence = nullptr;
+		slot.state = SLOT_QUEUED;
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			queue.push_back(pendingSlot);
+		}
+		queueCondition.notify_one();
+		pendingSlot = (pendingSlot + 1) % RING_SIZE;
+	}
+}
+
+void TrajectoryWriter::close()
+{
+	if(!isOpen())
+	{
+		return;
+	}
+
+	// Drain the copies still in flight
+	while(slots[pendingSlot].state == SLOT_COPYING)
+	{
+		glClientWaitSync(slots[pendingSlot].fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		update();
+	}
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		stopping = true;
+	}
+	queueCondition.notify_one();
+	worker.join();
+
+	header.indexOffset = fileOffset;
+	header.frameCount = index.size();
+	fwrite(index.data(), sizeof(TrajectoryIndexEntry), index.size(), file);
+	seekTo(file, 0);
+	fwrite(&header, sizeof(header), 1, file);
+	fclose(file);
+	file = nullptr;
+
+	for(int i = 0; i < RING_SIZE; i++)
+	{
+		glDeleteBuffers(1, &slots[i].buffer);
+		slots[i].buffer = 0;
+		slots[i].mapped = nullptr;
+	}
+}
+
+uint64_t TrajectoryWriter::framesWritten() const
+{
+	return written;
+}
+
+uint64_t TrajectoryWriter::framesDropped() const
+{
+	return dropped;
+}
+
+uint64_t TrajectoryWriter::bytesWritten() const
+{
+	return fileOffset;
+}
+
+void TrajectoryWriter::workerLoop()
+{
+	for(;;)
+	{
+		int slotIndex;
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			queueCondition.wait(lock, [this]() { return stopping || !queue.empty(); });
+			if(queue.empty())
+			{
+				return;
+			}
+			slotIndex = queue.front();
+			queue.pop_front();
+		}
+
+		encode(slots[slotIndex]);
+		slots[slotIndex].state = SLOT_FREE;
+	}
+}
+
+void TrajectoryWriter::encode(const Slot& slot)
+{
+	uint32_t count = header.particleCount;
+	if(slot.counted)
+	{
+		uint32_t alive;
+		memcpy(&alive, reinterpret_cast<const char*>(slot.mapped) + stagingSize, sizeof(alive));
+		count = std::min(alive, count);
+	}
+	// Deltas only line up between frames of the same size
+	const bool keyframe = index.size() % header.keyframeInterval == 0 || count != previousCount;
+	previousCount = count;
+
+	// Buffer order changes every step, id order only when particles come or go
+	const particle* particles = slot.mapped;
+	for(uint32_t i = 0; i < count; i++)
+	{
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.begin() + count,
+	          [particles](uint32_t a, uint32_t b) { return particles[a].id < particles[b].id; });
+
+	// Gather the columns out of the particle structs
+	uint32_t* columns[TRAJECTORY_COLUMNS];
+	for(uint32_t c = 0; c < TRAJECTORY_COLUMNS; c++)
+	{
+		columns[c] = &current[size_t(c) * count];
+	}
+	for(uint32_t i = 0; i < count; i++)
+	{
+		const particle& p = particles[order[i]];
+		columns[0][i] = p.id;
+		memcpy(&columns[1][i], &p.position.x, sizeof(uint32_t));
+		memcpy(&columns[2][i], &p.position.y, sizeof(uint32_t));
+		memcpy(&columns[3][i], &p.velocity.x, sizeof(uint32_t));
+		memcpy(&columns[4][i], &p.velocity.y, sizeof(uint32_t));
+	}
+
+	// Delta against the previous frame in place of it, the current one is kept for the next
+	const size_t words = size_t(TRAJECTORY_COLUMNS) * count;
+	if(!keyframe)
+	{
+		for(size_t i = 0; i < words; i++)
+		{
+			uint32_t value = current[i];
+			current[i] = value - previous[i];
+			previous[i] = value;
+		}
+	}
+	else
+	{
+		std::copy(current.begin(), current.begin() + words, previous.begin());
+	}
+
+	const size_t rawSize = words * sizeof(uint32_t);
+	labhelper::byteShuffle(reinterpret_cast<const uint8_t*>(current.data()), words, sizeof(uint32_t), shuffled.data());
+	size_t compressedSize = labhelper::lz4Compress(shuffled.data(), rawSize, compressed.data());
+
+	TrajectoryFrameHeader frameHeader;
+	frameHeader.step = slot.step;
+	frameHeader.simTime = slot.simTime;
+	frameHeader.flags = keyframe ? TRAJECTORY_KEYFRAME : 0;
+	frameHeader.rawSize = uint32_t(rawSize);
+	frameHeader.compressedSize = uint32_t(compressedSize);
+	frameHeader.particleCount = count;
+	frameHeader.reserved = 0;
+
+	TrajectoryIndexEntry entry;
+	entry.step = slot.step;
+	entry.offset = fileOffset;
+	entry.simTime = slot.simTime;
+	entry.flags = frameHeader.flags;
+	index.push_back(entry);
+
+	fwrite(&frameHeader, sizeof(frameHeader), 1, file);
+	fwrite(compressed.data(), 1, compressedSize, file);
+	fileOffset += sizeof(frameHeader) + compressedSize;
+	written++;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Reader
+///////////////////////////////////////////////////////////////////////////////
+TrajectoryReader::TrajectoryReader() : file(nullptr), decodedCount(0), decodedFrame(-1)
+{
+}
+
+TrajectoryReader::~TrajectoryReader()
+{
+	close();
+}
+
+bool TrajectoryReader::open(const std::string& path)
+{
+	close();
+
+	file = fopen(path.c_str(), "rb");
+	if(file == nullptr)
+	{
+		labhelper::non_fatal_error("Could not open trajectory " + path, "Trajectory");
+		return false;
+	}
+	if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, "BOIDTRAJ", 8) != 0
+	   || header.version != TRAJECTORY_VERSION)
+	{
+		labhelper::non_fatal_error(path + " is not a version " + std::to_string(TRAJECTORY_VERSION) + " trajectory",
+		                           "Trajectory");
+		close();
+		return false;
+	}
+
+	if(header.indexOffset != 0)
+	{
+		index.resize(size_t(header.frameCount));
+		seekTo(file, header.indexOffset);
+		if(fread(index.data(), sizeof(TrajectoryIndexEntry), index.size(), file) != index.size())
+		{
+			labhelper::non_fatal_error(path + " has a truncated index", "Trajectory");
+			close();
+			return false;
+		}
+	}
+	else
+	{
+		// Not closed properly, walk the chunks and keep the complete ones
+		uint64_t offset = sizeof(header);
+		TrajectoryFrameHeader frameHeader;
+		while(seekTo(file, offset) && fread(&frameHeader, sizeof(frameHeader), 1, file) == 1)
+		{
+			uint64_t next = offset + sizeof(frameHeader) + frameHeader.compressedSize;
+			if(!seekTo(file, next - 1) || fgetc(file) == EOF)
+			{
+				break;
+			}
+			TrajectoryIndexEntry entry;
+			entry.step = frameHeader.step;
+			entry.offset = offset;
+			entry.simTime = frameHeader.simTime;
+			entry.flags = frameHeader.flags;
+			index.push_back(entry);
+			offset = next;
+		}
+	}
+
+	size_t words = size_t(TRAJECTORY_COLUMNS) * header.particleCount;
+	decoded.resize(words);
+	delta.resize(words);
+	shuffled.resize(words * sizeof(uint32_t));
+	return true;
+}
+
+void TrajectoryReader::close()
+{
+	if(file != nullptr)
+	{
+		fclose(file);
+		file = nullptr;
+	}
+	index.clear();
+	decodedFrame = -1;
+}
+
+uint32_t TrajectoryReader::particleCount() const
+{
+	return header.particleCount;
+}
+
+uint64_t TrajectoryReader::frameCount() const
+{
+	return index.size();
+}
+
+const TrajectoryIndexEntry& TrajectoryReader::frame(uint64_t frame) const
+{
+	return index[size_t(frame)];
+}
+
+bool TrajectoryReader::decodeFrame(uint64_t frame)
+{
+	const TrajectoryIndexEntry& entry = index[size_t(frame)];
+	TrajectoryFrameHeader frameHeader;
+	if(!seekTo(file, entry.offset) || fread(&frameHeader, sizeof(frameHeader), 1, file) != 1
+	   || frameHeader.particleCount > header.particleCount
+	   || frameHeader.rawSize != TRAJECTORY_COLUMNS * sizeof(uint32_t) * frameHeader.particleCount)
+	{
+		return false;
+	}
+	const bool keyframe = (frameHeader.flags & TRAJECTORY_KEYFRAME) != 0;
+	if(!keyframe && frameHeader.particleCount != decodedCount)
+	{
+		return false;
+	}
+	const size_t words = size_t(TRAJECTORY_COLUMNS) * frameHeader.particleCount;
+	compressed.resize(frameHeader.compressedSize);
+	if(fread(compressed.data(), 1, compressed.size(), file) != compressed.size()
+	   || labhelper::lz4Decompress(compressed.data(), compressed.size(), shuffled.data(), frameHeader.rawSize)
+	          != frameHeader.rawSize)
+	{
+		return false;
+	}
+
+	if(keyframe)
+	{
+		labhelper::byteUnshuffle(shuffled.data(), words, sizeof(uint32_t), reinterpret_cast<uint8_t*>(decoded.data()));
+		decodedCount = frameHeader.particleCount;
+	}
+	else
+	{
+		labhelper::byteUnshuffle(shuffled.data(), words, sizeof(uint32_t), reinterpret_cast<uint8_t*>(delta.data()));
+		for(size_t i = 0; i < words; i++)
+		{
+			decoded[i] += delta[i];
+		}
+	}
+	decodedFrame = int64_t(frame);
+	return true;
+}
+
+bool TrajectoryReader::readFrame(uint64_t frame,
+                                 std::vector<uint32_t>& ids,
+                                 std::vector<glm::vec2>& positions,
+                                 std::vector<glm::vec2>& velocities)
+{
+	if(file == nullptr || frame >= index.size())
+	{
+		return false;
+	}
+
+	uint64_t keyframe = frame;
+	while(keyframe > 0 && !(index[size_t(keyframe)].flags & TRAJECTORY_KEYFRAME))
+	{
+		keyframe--;
+	}
+
+	// Continue from what is already decoded if it lies on the way
+	uint64_t first = keyframe;
+	if(decodedFrame >= int64_t(keyframe) && decodedFrame <= int64_t(frame))
+	{
+		first = uint64_t(decodedFrame) + 1;
+	}
+	for(uint64_t f = first; f <= frame; f++)
+	{
+		if(!decodeFrame(f))
+		{
+			decodedFrame = -1;
+			return false;
+		}
+	}
+
+	const uint32_t count = decodedCount;
+	ids.assign(decoded.begin(), decoded.begin() + count);
+	positions.resize(count);
+	velocities.resize(count);
+	for(uint32_t i = 0; i < count; i++)
+	{
+		memcpy(&positions[i].x, &decoded[size_t(count) + i], sizeof(float));
+		memcpy(&positions[i].y, &decoded[size_t(2) * count + i], sizeof(float));
+		memcpy(&velocities[i].x, &decoded[size_t(3) * count + i], sizeof(float));
+		memcpy(&velocities[i].y, &decoded[size_t(4) * count + i], sizeof(float));
+	}
+	return true;
+}
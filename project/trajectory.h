@@ -0,0 +1,198 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "particle.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Trajectory files: a header, then one compressed chunk per recorded frame,
+// then an index of all chunks so readers can seek to any frame.
+//
+// A frame holds the particles alive at its step as five 32-bit columns: the
+// particle id (see ParticlePopulation), then position and velocity (x, y, vx,
+// vy). Particles are sorted by id, not left in buffer order, which the grid
+// build and sink compaction shuffle every step; so while no particle is
+// added or removed, row i is the same particle in every frame and a reader
+// can follow it by its id. Every column word is stored as the wrapping
+// difference to the previous frame, except on keyframes and where the count
+// changed, then byte shuffled and LZ4 compressed.
+///////////////////////////////////////////////////////////////////////////////
+const uint32_t TRAJECTORY_VERSION = 3; // 2: per-frame particle count, 3: id column
+const uint32_t TRAJECTORY_KEYFRAME = 1 << 0;
+const uint32_t TRAJECTORY_COLUMNS = 5;
+
+struct TrajectoryHeader
+{
+	char magic[8]; // "BOIDTRAJ"
+	uint32_t version;
+	uint32_t particleCount;    // Capacity, no frame holds more
+	uint32_t stepStride;       // Sim steps between recorded frames
+	uint32_t keyframeInterval; // Frames between keyframes
+	uint64_t indexOffset;      // 0 until the writer is closed
+	uint64_t frameCount;
+};
+
+struct TrajectoryFrameHeader
+{
+	uint64_t step;
+	float simTime;
+	uint32_t flags;
+	uint32_t rawSize;
+	uint32_t compressedSize;
+	uint32_t particleCount; // Alive at this step
+	uint32_t reserved;
+};
+
+struct TrajectoryIndexEntry
+{
+	uint64_t step;
+	uint64_t offset; // Of the frame header, from the start of the file
+	float simTime;
+	uint32_t flags;
+};
+
+/**
+	* Records every stepStride-th step without stalling the simulation. Each
+	* recorded step is copied on the GPU into one of a ring of persistently
+	* mapped staging buffers and fenced; once the fence has signalled, a worker
+	* thread encodes and appends it. If the worker falls behind and the ring is
+	* full, frames are dropped rather than waited for.
+	*/
+class TrajectoryWriter
+{
+public:
+	TrajectoryWriter();
+	~TrajectoryWriter();
+
+	bool open(const std::string& path, uint32_t particleCount, uint32_t stepStride, uint32_t keyframeInterval = 32);
+	bool isOpen() const;
+	uint32_t stepStride() const;
+
+	/**
+		* Queues a readback of 'particleBuffer'. With a 'countBuffer', its first
+		* uint (copied along on the GPU) is how many of them the frame holds,
+		* as in SnapshotWriter::request(). Returns false if every staging
+		* buffer is still in use, in which case the frame is counted as dropped.
+		*/
+	bool record(GLuint particleBuffer, uint64_t step, float simTime, GLuint countBuffer = 0);
+
+	/**
+		* Call once per frame, hands finished GPU copies to the writer thread.
+		*/
+	void update();
+
+	/**
+		* Writes out everything still in flight, appends the index and closes the file.
+		*/
+	void close();
+
+	uint64_t framesWritten() const;
+	uint64_t framesDropped() const;
+	uint64_t bytesWritten() const;
+
+private:
+	enum SlotState
+	{
+		SLOT_FREE,
+		SLOT_COPYING,
+		SLOT_QUEUED
+	};
+
+	struct Slot
+	{
+		GLuint buffer;
+		const particle* mapped;
+		GLsync fence;
+		uint64_t step;
+		float simTime;
+		bool counted; // The alive count follows the particles
+		std::atomic<int> state;
+	};
+
+	static const int RING_SIZE = 3;
+
+	void workerLoop();
+	void encode(const Slot& slot);
+
+	Slot slots[RING_SIZE];
+	int nextSlot;    // Next slot to record into
+	int pendingSlot; // Oldest slot whose copy may still be in flight
+
+	FILE* file;
+	TrajectoryHeader header;
+	GLsizeiptr stagingSize; // For the particles, the count goes after them
+	std::vector<TrajectoryIndexEntry> index;
+	uint32_t previousCount;
+	std::vector<uint32_t> order; // Staging indices, sorted by particle id
+	std::vector<uint32_t> current;
+	std::vector<uint32_t> previous;
+	std::vector<uint8_t> shuffled;
+	std::vector<uint8_t> compressed;
+
+	std::thread worker;
+	std::mutex queueMutex;
+	std::condition_variable queueCondition;
+	std::deque<int> queue;
+	bool stopping;
+
+	std::atomic<uint64_t> written;
+	std::atomic<uint64_t> dropped;
+	std::atomic<uint64_t> fileOffset;
+
+	TrajectoryWriter(const TrajectoryWriter&) = delete;
+	TrajectoryWriter& operator=(const TrajectoryWriter&) = delete;
+};
+
+/**
+	* Random access to the frames of a trajectory file. Seeking decodes forward
+	* from the nearest keyframe; reading frames in order decodes each only once.
+	* Files whose writer never closed them are indexed by scanning the chunks.
+	*/
+class TrajectoryReader
+{
+public:
+	TrajectoryReader();
+	~TrajectoryReader();
+
+	bool open(const std::string& path);
+	void close();
+
+	// The capacity, readFrame() returns how many are in each frame
+	uint32_t particleCount() const;
+	uint64_t frameCount() const;
+	const TrajectoryIndexEntry& frame(uint64_t frame) const;
+
+	/**
+		* Decodes a frame's particles in id order, ids.size() of them.
+		*/
+	bool readFrame(uint64_t frame,
+	               std::vector<uint32_t>& ids,
+	               std::vector<glm::vec2>& positions,
+	               std::vector<glm::vec2>& velocities);
+
+private:
+	bool decodeFrame(uint64_t frame);
+
+	FILE* file;
+	TrajectoryHeader header;
+	std::vector<TrajectoryIndexEntry> index;
+	std::vector<uint32_t> decoded;
+	uint32_t decodedCount;
+	std::vector<uint32_t> delta;
+	std::vector<uint8_t> shuffled;
+	std::vector<uint8_t> compressed;
+	int64_t decodedFrame;
+
+	TrajectoryReader(const TrajectoryReader&) = delete;
+	TrajectoryReader& operator=(const TrajectoryReader&) = delete;
+};
@@ -0,0 +1,19 @@
+#version 430
+
+// required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
+precision highp float;
+
+// Set by labhelper::render() from the .mtl
+uniform vec3 material_color;
+uniform vec3 lightDirection; // Towards the light, in world space
+
+in vec3 normal;
+
+layout(location = 0) out vec4 fragmentColor;
+
+void main()
+{
+    // Only the far walls are drawn, and those are seen from inside
+    float diffuse = max(dot(-normalize(normal), lightDirection), 0.0);
+    fragmentColor = vec4(material_color * (0.3 + 0.7 * diffuse), 1.0);
+}
@@ -0,0 +1,14 @@
+#version 430
+
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 normalIn;
+
+uniform mat4 modelViewProjectionMatrix;
+
+out vec3 normal;
+
+void main()
+{
+    gl_Position = modelViewProjectionMatrix * vec4(position, 1.0);
+    normal = normalIn;
+}
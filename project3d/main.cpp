@@ -0,0 +1,711 @@
+#ifdef _WIN32
+extern "C" _declspec(dllexport) unsigned int NvOptimusEnablement = 0x00000001;
+#endif
+
+#include <GL/glew.h>
+#include <cmath>
+#include <cstdlib>
+#include <cstddef>
+#include <algorithm>
+#include <chrono>
+
+#include <labhelper.h>
+#include <imgui.h>
+
+#include <perf.h>
+#include <shaderpermutations.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtx/transform.hpp>
+using namespace glm;
+
+#include <Model.h>
+#include "fbo.h"
+#include "particle.h"
+#include "spawn.h"
+#include "population.h"
+#include "grid.h"
+#include "simulation.h"
+#include "pacing.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <stb_image_write.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// The 3D build of the simulation. The grid, SPH and population passes are
+// the ones in ../project, compiled with SIMULATION_3D (see particle.h); this
+// only drives them and renders the particles as spheres inside the box they
+// are confined to. The CPU engine, obstacles, stirring and the 2D render
+// modes have no 3D counterpart.
+///////////////////////////////////////////////////////////////////////////////
+#if !SIMULATION_3D
+#error project3d must be built with SIMULATION_3D=1
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Various globals
+///////////////////////////////////////////////////////////////////////////////
+SDL_Window* g_window = nullptr;
+GLuint outputFramebuffer = 0; // The window's, or an FboInfo's when running headless
+float currentTime = 0.0f;
+float previousTime = 0.0f;
+float deltaTime = 0.0f;
+int windowWidth, windowHeight;
+bool isPaused = false;
+FramePacer framePacer; // Idle waits, redraws and the frame rate cap, see pacing.h
+
+///////////////////////////////////////////////////////////////////////////////
+// Orbit camera around the centre of the box, dragged with the left button
+// and zoomed with the wheel
+///////////////////////////////////////////////////////////////////////////////
+float cameraYaw = 0.6f;
+float cameraPitch = 0.35f;
+float cameraDistance = 4.5f;
+const float cameraFieldOfView = 45.0f;
+bool g_isMouseDragging = false;
+
+///////////////////////////////////////////////////////////////////////////////
+// Shader programs
+///////////////////////////////////////////////////////////////////////////////
+GLuint sphereProgram;    // Particles as sphere impostors
+GLuint containerProgram; // The walls of the box
+
+///////////////////////////////////////////////////////////////////////////////
+// Rendering
+///////////////////////////////////////////////////////////////////////////////
+GLuint emptyVAO; // The sphere impostors read the particle buffers directly
+labhelper::Model* containerModel = nullptr;
+bool showContainer = true;
+float particleRadius = 0.02f;
+float minSpeed = 0.2f;
+float maxSpeed = 0.3f;
+const vec3 lightDirection = normalize(vec3(0.4f, 1.0f, 0.6f)); // Towards the light
+
+///////////////////////////////////////////////////////////////////////////////
+// Data for the particles
+///////////////////////////////////////////////////////////////////////////////
+GLuint particleSSBO;
+GLuint previousParticleSSBO;   // State at the start of the last step, for render interpolation
+GLuint reorderedparticlesSSBO; // Also the state at the start of the step, see particle.comp
+
+// The particle buffers hold MAX_PARTICLES; how many of them are alive is only
+// known on the GPU, see population.h
+const int MAX_PARTICLES = 16384;
+int spawnCount = 4000;
+
+///////////////////////////////////////////////////////////////////////////////
+// Compute Shader stuff
+///////////////////////////////////////////////////////////////////////////////
+// particle.comp, specialized on workgroup size, neighbour traversal and smoothing kernel
+labhelper::ShaderPermutations particlePrograms("../project/particle.comp");
+NeighborTraversal neighborTraversal = TRAVERSAL_PER_PARTICLE; // See simulation.h
+SmoothingKernelType smoothingKernel = KERNEL_SPIKY;
+
+///////////////////////////////////////////////////////////////////////////////
+// Grid, see grid.h. Cells per side; their width must stay at least the
+// smoothing radius, since only the 3x3x3 cells around a particle are searched.
+///////////////////////////////////////////////////////////////////////////////
+const int MAX_GRID_SIZE = 32;
+GLint gridSize = 8;
+ParticleGrid grid;
+GridPrograms gridPrograms;
+GridBuilder gridBuilder = GRID_ATOMIC;
+bool mortonWithinCells = true;
+
+///////////////////////////////////////////////////////////////////////////////
+// Species, see SpeciesBlock in particle.h
+///////////////////////////////////////////////////////////////////////////////
+SpeciesBlock speciesBlock;
+GLuint speciesSSBO;
+int numSpecies = 1;
+bool sortBySpecies = true; // A bucket per species in each cell, see neighbors.glsl
+bool colorBySpecies = false;
+
+float kernelScalingFactor = 0.5f;
+bool gravityEnabled = true;
+float gravityStrength = 0.1f;
+float smoothingRadius = 0.25f;
+
+// Everything random is keyed by (seed, particle id, step, stream), see labhelper/random.h
+GLuint randomSeed = 1234;
+
+GLuint spawnShaderProgram;
+SpawnSettings spawnSettings = { SPAWN_DAM_BREAK, 0, 0.1f, "", 1 };
+
+///////////////////////////////////////////////////////////////////////////////
+// Sources and sinks, and the alive count they change, see population.h.
+// Their boxes span the whole depth of the domain.
+///////////////////////////////////////////////////////////////////////////////
+ParticlePopulation population;
+PopulationSettings populationSettings;
+GLuint populationShaderProgram;
+
+///////////////////////////////////////////////////////////////////////////////
+// Simulation scheduling, a fixed step as in the 2D build
+///////////////////////////////////////////////////////////////////////////////
+float simTimestep = 1.0f / 120.0f;
+int maxSubSteps = 8;              // Steps per frame before sim time is dropped
+const float maxFrameTime = 0.25f; // Longer frames (hitches) are clamped to this
+
+float simTime = 0.0f;
+float simAccumulator = 0.0f;
+float interpolationAlpha = 1.0f;
+int subStepsLastFrame = 0;
+unsigned long long simStepCount = 0;
+
+void updateGrid()
+{
+	GridSettings settings;
+	settings.builder = gridBuilder;
+	settings.mortonWithinCells = mortonWithinCells;
+	settings.gridSize = gridSize;
+	settings.bucketsPerCell = bucketsPerCell(sortBySpecies, numSpecies);
+	grid.update(gridPrograms, settings, population, particleSSBO, reorderedparticlesSSBO);
+}
+
+void initializeparticles()
+{
+	labhelper::perf::Scope s( "Spawn particles" );
+
+	// Only the analytic layouts have 3D versions, see spawn.comp
+	if (!isGPUSpawnLayout(spawnSettings.layout))
+	{
+		spawnSettings.layout = SPAWN_UNIFORM;
+	}
+	spawnSettings.seed = randomSeed;
+	spawnParticlesGPU(spawnShaderProgram, particleSSBO, spawnCount, spawnSettings);
+	population.reset(populationShaderProgram, spawnCount);
+
+	// Nothing to interpolate from yet
+	glCopyNamedBufferSubData(particleSSBO, previousParticleSSBO, 0, 0, sizeof(particle) * MAX_PARTICLES);
+	simTime = 0.0f;
+	simAccumulator = 0.0f;
+	simStepCount = 0;
+	interpolationAlpha = 1.0f;
+}
+
+void updateparticlePositions(float deltaTime)
+{
+	labhelper::perf::Scope s( "Update particles" );
+
+	// No stir tool in 3D
+	GLuint program = particlePrograms.get(
+	    particlePermutation(neighborTraversal, smoothingKernel, false, bucketsPerCell(sortBySpecies, numSpecies)));
+	glUseProgram(program);
+	labhelper::setUniformSlow(program, "deltaTime", deltaTime);
+	labhelper::setUniformSlow(program, "time", simTime);
+	labhelper::setUniformSlow(program, "gridSize", gridSize);
+	labhelper::setUniformSlow(program, "bucketsPerCell", bucketsPerCell(sortBySpecies, numSpecies));
+	labhelper::setUniformSlow(program, "numSpecies", numSpecies);
+	labhelper::setUniformSlow(program, "kernelScalingFactor", kernelScalingFactor);
+	labhelper::setUniformSlow(program, "smoothingRadius", smoothingRadius);
+	labhelper::setUniformSlow(program, "gravityEnabled", gravityEnabled);
+	labhelper::setUniformSlow(program, "gravityStrength", gravityStrength);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, particleSSBO);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, grid.prefixSumBuffer());
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, reorderedparticlesSSBO);
+
+	if (neighborTraversal == TRAVERSAL_TILED)
+	{
+		// A workgroup per cell, whichever are empty return right away
+		glDispatchCompute(gridSize, gridSize, gridSize);
+	}
+	else
+	{
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, population.buffer());
+		glDispatchComputeIndirect(offsetof(PopulationBlock, particleGroups));
+	}
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Runs the fixed steps the elapsed time calls for, as stepGPUSimulation()
+/// in the 2D build does
+///////////////////////////////////////////////////////////////////////////////
+void advanceSimulation(float frameTime)
+{
+	labhelper::perf::Scope s( "Simulation" );
+	updateSpeciesBuffer(speciesSSBO, speciesBlock);
+
+	simAccumulator += std::min(frameTime, maxFrameTime);
+	int steps = std::min(int(simAccumulator / simTimestep), maxSubSteps);
+	for (int i = 0; i < steps; i++)
+	{
+		// Sinks, compaction and the grid update all reorder the particles, so
+		// they have to come before the interpolation source is captured
+		population.update(populationShaderProgram, populationSettings, particleSSBO, reorderedparticlesSSBO,
+		                  simTimestep, randomSeed, GLuint(simStepCount));
+		updateGrid();
+		if (i == steps - 1)
+		{
+			glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+			glCopyNamedBufferSubData(particleSSBO, previousParticleSSBO, 0, 0, sizeof(particle) * MAX_PARTICLES);
+		}
+		updateparticlePositions(simTimestep);
+
+		simAccumulator -= simTimestep;
+		simTime += simTimestep;
+		simStepCount++;
+	}
+
+	// Too far behind to catch up, drop the backlog instead of spiralling
+	if (steps == maxSubSteps && simAccumulator >= simTimestep)
+	{
+		simAccumulator = fmodf(simAccumulator, simTimestep);
+	}
+	interpolationAlpha = simAccumulator / simTimestep;
+	subStepsLastFrame = steps;
+}
+
+void loadShaders(bool is_reload)
+{
+	// A program that compiles replaces the previous one, which is deleted. On
+	// the first load that is program 0, which glDeleteProgram ignores.
+	const labhelper::ShaderDefines defines = simulationDefines();
+
+	if (is_reload)
+	{
+		particlePrograms.reload();
+	}
+	else
+	{
+		// Every variant up front, so switching doesn't hitch on a compile
+		for (int kernel = 0; kernel < KERNEL_TYPE_COUNT; kernel++)
+		{
+			for (int traversal = 0; traversal < TRAVERSAL_COUNT; traversal++)
+			{
+				particlePrograms.get(particlePermutation(NeighborTraversal(traversal), SmoothingKernelType(kernel), false,
+				                                         bucketsPerCell(sortBySpecies, numSpecies)));
+			}
+		}
+	}
+
+	GLuint shader = labhelper::loadShaderProgram("../project3d/sphere.vert", "../project3d/sphere.frag", defines,
+	                                             is_reload);
+	if (shader != 0) {
+		glDeleteProgram(sphereProgram);
+		sphereProgram = shader;
+	}
+
+	shader = labhelper::loadShaderProgram("../project3d/container.vert", "../project3d/container.frag", is_reload);
+	if (shader != 0) {
+		glDeleteProgram(containerProgram);
+		containerProgram = shader;
+	}
+
+	shader = labhelper::loadComputeShaderProgram("../project/grid.comp", defines, is_reload);
+	if (shader != 0) {
+		glDeleteProgram(gridPrograms.count);
+		gridPrograms.count = shader;
+	}
+
+	shader = labhelper::loadComputeShaderProgram("../project/reindex.comp", defines, is_reload);
+	if (shader != 0) {
+		glDeleteProgram(gridPrograms.reindex);
+		gridPrograms.reindex = shader;
+	}
+
+	shader = labhelper::loadComputeShaderProgram("../project/gridSort.comp", defines, is_reload);
+	if (shader != 0) {
+		glDeleteProgram(gridPrograms.sort);
+		gridPrograms.sort = shader;
+	}
+
+	shader = labhelper::loadComputeShaderProgram("../project/spawn.comp", defines, is_reload);
+	if (shader != 0) {
+		glDeleteProgram(spawnShaderProgram);
+		spawnShaderProgram = shader;
+	}
+
+	shader = labhelper::loadComputeShaderProgram("../project/population.comp", defines, is_reload);
+	if (shader != 0) {
+		glDeleteProgram(populationShaderProgram);
+		populationShaderProgram = shader;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// This function is called once at the start of the program and never again
+///////////////////////////////////////////////////////////////////////////////
+void initialize()
+{
+	ENSURE_INITIALIZE_ONLY_ONCE();
+
+	labhelper::setShaderCacheDirectory("shader_cache");
+	loadShaders(false);
+
+	///////////////////////////////////////////////////////////////////////
+	// Generate and bind buffers for compute shaders
+	///////////////////////////////////////////////////////////////////////
+	glGenBuffers(1, &particleSSBO);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBO);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(particle) * MAX_PARTICLES, nullptr, GL_DYNAMIC_STORAGE_BIT);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, particleSSBO);
+
+	glGenBuffers(1, &previousParticleSSBO);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, previousParticleSSBO);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(particle) * MAX_PARTICLES, nullptr, 0);
+
+	glGenBuffers(1, &reorderedparticlesSSBO);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, reorderedparticlesSSBO);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(particle) * MAX_PARTICLES, nullptr, GL_DYNAMIC_STORAGE_BIT);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, reorderedparticlesSSBO);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	population.init(MAX_PARTICLES);
+	initPopulationSettings(populationSettings);
+
+	// Grid, bindings 4 and 5
+	grid.init(MAX_PARTICLES, MAX_GRID_SIZE);
+	speciesSSBO = initSpecies(speciesBlock);
+
+	initializeparticles();
+
+	///////////////////////////////////////////////////////////////////////
+	// Rendering
+	///////////////////////////////////////////////////////////////////////
+	glGenVertexArrays(1, &emptyVAO);
+	containerModel = labhelper::loadModelFromOBJ("../scenes/container.obj");
+
+	if (g_window != nullptr)
+	{
+		SDL_GetWindowSize(g_window, &windowWidth, &windowHeight);
+	}
+
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_PROGRAM_POINT_SIZE);
+
+	labhelper::hideGUI();
+}
+
+mat4 viewMatrix()
+{
+	vec3 direction = vec3(cosf(cameraPitch) * sinf(cameraYaw), sinf(cameraPitch), cosf(cameraPitch) * cosf(cameraYaw));
+	return lookAt(cameraDistance * direction, vec3(0.0f), vec3(0.0f, 1.0f, 0.0f));
+}
+
+mat4 projectionMatrix()
+{
+	return perspective(radians(cameraFieldOfView), float(windowWidth) / float(std::max(windowHeight, 1)), 0.05f,
+	                   100.0f);
+}
+
+void display(void)
+{
+	labhelper::perf::Scope s( "Display" );
+
+	glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
+	glViewport(0, 0, windowWidth, windowHeight);
+	glClearColor(0.05f, 0.05f, 0.07f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	const mat4 view = viewMatrix();
+	const mat4 projection = projectionMatrix();
+
+	if (showContainer)
+	{
+		// The walls facing away from the camera, so the box never hides its contents
+		labhelper::perf::Scope s( "Container" );
+		glUseProgram(containerProgram);
+		labhelper::setUniformSlow(containerProgram, "modelViewProjectionMatrix", projection * view);
+		labhelper::setUniformSlow(containerProgram, "lightDirection", lightDirection);
+		glEnable(GL_CULL_FACE);
+		glCullFace(GL_FRONT);
+		labhelper::render(containerModel);
+		glCullFace(GL_BACK);
+		glDisable(GL_CULL_FACE);
+	}
+
+	{
+		labhelper::perf::Scope s( "Particles" );
+		glUseProgram(sphereProgram);
+		labhelper::setUniformSlow(sphereProgram, "viewMatrix", view);
+		labhelper::setUniformSlow(sphereProgram, "projectionMatrix", projection);
+		labhelper::setUniformSlow(sphereProgram, "interpolationAlpha", interpolationAlpha);
+		labhelper::setUniformSlow(sphereProgram, "particleRadius", particleRadius);
+		labhelper::setUniformSlow(sphereProgram, "viewportHeight", float(windowHeight));
+		labhelper::setUniformSlow(sphereProgram, "minSpeed", minSpeed);
+		labhelper::setUniformSlow(sphereProgram, "maxSpeed", maxSpeed);
+		labhelper::setUniformSlow(sphereProgram, "colorBySpecies", colorBySpecies);
+		labhelper::setUniformSlow(sphereProgram, "viewSpaceLightDirection", vec3(view * vec4(lightDirection, 0.0f)));
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, particleSSBO);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, previousParticleSSBO);
+
+		glBindVertexArray(emptyVAO);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, population.buffer());
+		glDrawArraysIndirect(GL_POINTS, (const void*)offsetof(PopulationBlock, points));
+		glBindVertexArray(0);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Handles all queued events, returns true when it is time to quit. Paused
+/// with nothing to redraw, first blocks until there is one, see
+/// FramePacer::waitForEvent().
+///////////////////////////////////////////////////////////////////////////////
+bool handleEvents()
+{
+	SDL_Event event;
+	bool quitEvent = false;
+	bool haveEvent = framePacer.waitForEvent(event, isPaused);
+	for(; haveEvent; haveEvent = SDL_PollEvent(&event) != 0)
+	{
+		labhelper::processEvent( &event );
+		framePacer.onEvent(event);
+
+		if(event.type == SDL_QUIT || (event.type == SDL_KEYUP && event.key.keysym.sym == SDLK_ESCAPE))
+		{
+			quitEvent = true;
+		}
+		if(event.type == SDL_KEYUP && event.key.keysym.sym == SDLK_SPACE)
+		{
+			isPaused = !isPaused;
+		}
+		if(event.type == SDL_KEYUP && event.key.keysym.sym == SDLK_g)
+		{
+			if ( labhelper::isGUIvisible() )
+			{
+				labhelper::hideGUI();
+			}
+			else
+			{
+				labhelper::showGUI();
+			}
+		}
+
+		if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
+		{
+			windowWidth = event.window.data1;
+			windowHeight = event.window.data2;
+		}
+
+		// Drags and scrolls over the GUI belong to the GUI
+		if (event.type == SDL_MOUSEBUTTONDOWN && event.button.button == SDL_BUTTON_LEFT
+		    && !ImGui::GetIO().WantCaptureMouse)
+		{
+			g_isMouseDragging = true;
+		}
+		if (event.type == SDL_MOUSEBUTTONUP && event.button.button == SDL_BUTTON_LEFT)
+		{
+			g_isMouseDragging = false;
+		}
+		if (event.type == SDL_MOUSEMOTION && g_isMouseDragging)
+		{
+			const float rotationSpeed = 0.005f;
+			cameraYaw -= rotationSpeed * event.motion.xrel;
+			cameraPitch = clamp(cameraPitch + rotationSpeed * event.motion.yrel, -1.5f, 1.5f);
+		}
+		if (event.type == SDL_MOUSEWHEEL && !ImGui::GetIO().WantCaptureMouse)
+		{
+			cameraDistance = clamp(cameraDistance * powf(0.9f, float(event.wheel.y)), 1.5f, 20.0f);
+		}
+	}
+	return quitEvent;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// This function is to hold the general GUI logic
+///////////////////////////////////////////////////////////////////////////////
+void gui()
+{
+	ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate,
+	            ImGui::GetIO().Framerate);
+	ImGui::Text("Step %llu, t = %.2f s, %d substeps last frame", simStepCount, simTime, subStepsLastFrame);
+	ImGui::SliderFloat("Fixed timestep", &simTimestep, 1.0f / 1000.0f, 1.0f / 30.0f, "%.4f");
+	ImGui::SliderInt("Max substeps", &maxSubSteps, 1, 32);
+	framePacer.gui(isPaused);
+
+	ImGui::Text("Initial conditions:");
+	// Only the layouts spawn.comp generates, which come first
+	int layout = spawnSettings.layout;
+	ImGui::Combo("Spawn layout", &layout, spawnLayoutNames, SPAWN_EXPLOSION + 1);
+	spawnSettings.layout = SpawnLayout(layout);
+	int seed = int(randomSeed);
+	if (ImGui::InputInt("Seed", &seed))
+	{
+		randomSeed = GLuint(seed);
+	}
+	ImGui::SliderInt("Particles", &spawnCount, 1, MAX_PARTICLES);
+	if (ImGui::Button("Respawn"))
+	{
+		initializeparticles();
+	}
+	ImGui::SameLine();
+	if (ImGui::Button("Pipe flow"))
+	{
+		pipeFlowPreset(populationSettings);
+	}
+	ImGui::SameLine();
+	if (ImGui::Button("No sources or sinks"))
+	{
+		initPopulationSettings(populationSettings);
+	}
+
+	ImGui::Text("Species:");
+	if (ImGui::SliderInt("Species count", &numSpecies, 1, MAX_SPECIES))
+	{
+		spawnSettings.speciesCount = numSpecies;
+		initializeparticles();
+	}
+	ImGui::Checkbox("Sort buckets by species", &sortBySpecies);
+	ImGui::Checkbox("Color by species", &colorBySpecies);
+	for (int i = 0; i < numSpecies; i++)
+	{
+		ImGui::PushID(i);
+		ImGui::Text("  Species %d", i);
+		ImGui::ColorEdit3("Color", &speciesBlock.species[i].color.x);
+		ImGui::SliderFloat("Mass", &speciesBlock.species[i].mass, 0.1f, 10.0f);
+		ImGui::SliderFloat("Gravity scale", &speciesBlock.species[i].gravityScale, -2.0f, 2.0f);
+		ImGui::PopID();
+	}
+
+	ImGui::Text("particle parameters:");
+	ImGui::SliderFloat("kernelScalingFactor", &kernelScalingFactor, 0.01f, 10.0f);
+	ImGui::SliderFloat("smoothingRadius", &smoothingRadius, 0.01f, 2.0f / (float)gridSize);
+	if (ImGui::SliderInt("Grid size", &gridSize, 1, MAX_GRID_SIZE))
+	{
+		smoothingRadius = std::min(smoothingRadius, 2.0f / (float)gridSize);
+	}
+	int kernel = smoothingKernel;
+	ImGui::Combo("Smoothing kernel", &kernel, smoothingKernelNames, KERNEL_TYPE_COUNT);
+	smoothingKernel = SmoothingKernelType(kernel);
+	int traversal = neighborTraversal;
+	ImGui::Combo("Neighbour search", &traversal, neighborTraversalNames, TRAVERSAL_COUNT);
+	neighborTraversal = NeighborTraversal(traversal);
+	int builder = gridBuilder;
+	ImGui::Combo("Grid build", &builder, gridBuilderNames, GRID_BUILDER_COUNT);
+	gridBuilder = GridBuilder(builder);
+	if (gridBuilder == GRID_RADIX_SORT)
+	{
+		ImGui::Checkbox("Morton order within cells", &mortonWithinCells);
+	}
+	ImGui::Checkbox("Gravity enabled", &gravityEnabled);
+	ImGui::SliderFloat("gravityStrength", &gravityStrength, 0.0f, 1.0f);
+
+	ImGui::Text("Rendering:");
+	ImGui::SliderFloat("Particle radius", &particleRadius, 0.002f, 0.1f);
+	ImGui::Checkbox("Show container", &showContainer);
+
+	labhelper::perf::drawEventsWindow();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Runs 'frames' frames of 1/60 s without a window, for CI and batch nodes.
+/// The last frame is written to 'imagePath' if one is given.
+///////////////////////////////////////////////////////////////////////////////
+int runHeadless(int frames, const char* imagePath)
+{
+	if (!labhelper::init_headless_context())
+	{
+		return EXIT_FAILURE;
+	}
+	windowWidth = 1280;
+	windowHeight = 720;
+	initialize();
+
+	FboInfo output(FboAttachments(1, GL_RGBA8));
+	output.resize(windowWidth, windowHeight);
+	outputFramebuffer = output.framebufferId;
+
+	const float frameTime = 1.0f / 60.0f;
+	for (int i = 0; i < frames; i++)
+	{
+		advanceSimulation(frameTime);
+		display();
+		labhelper::drainGLDebugMessages();
+	}
+	glFinish();
+	printf("%d frames, %llu steps on %s: %u particles\n", frames, simStepCount, labhelper::headlessBackendName(),
+	       population.readAliveCount());
+
+	if (imagePath != nullptr)
+	{
+		std::vector<unsigned char> pixels(windowWidth * windowHeight * 4);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, output.framebufferId);
+		glReadPixels(0, 0, windowWidth, windowHeight, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+		// GL's rows start at the bottom
+		const int rowSize = windowWidth * 4;
+		for (int y = 0; y < windowHeight / 2; y++)
+		{
+			std::swap_ranges(pixels.begin() + y * rowSize, pixels.begin() + (y + 1) * rowSize,
+			                 pixels.begin() + (windowHeight - 1 - y) * rowSize);
+		}
+		stbi_write_png(imagePath, windowWidth, windowHeight, 4, pixels.data(), rowSize);
+	}
+
+	output.release();
+	labhelper::freeModel(containerModel);
+	labhelper::shutDownHeadless();
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[])
+{
+	// project3d --headless [frames] [image.png]
+	if (argc > 1 && strcmp(argv[1], "--headless") == 0)
+	{
+		int frames = argc > 2 ? atoi(argv[2]) : 600;
+		return runHeadless(frames, argc > 3 ? argv[3] : nullptr);
+	}
+
+	g_window = labhelper::init_window_SDL("OpenGL Project 3D");
+
+	initialize();
+
+	bool stopRendering = false;
+	auto startTime = std::chrono::system_clock::now();
+
+	while(!stopRendering)
+	{
+		//update currentTime
+		std::chrono::duration<float> timeSinceStart = std::chrono::system_clock::now() - startTime;
+		previousTime = currentTime;
+		currentTime = timeSinceStart.count();
+		deltaTime = currentTime - previousTime;
+
+		stopRendering = handleEvents();
+
+		// Edited shaders are recompiled on the fly; ones that fail keep the old program
+		if (labhelper::shaderSourcesChanged())
+		{
+			loadShaders(true);
+			framePacer.requestRedraw();
+		}
+
+		// Paused with nothing new to show, leave the last frame up
+		if (!framePacer.beginFrame(isPaused))
+		{
+			continue;
+		}
+
+		// Inform imgui of new frame
+		labhelper::newFrame( g_window );
+
+		if (!isPaused)
+		{
+			advanceSimulation(deltaTime);
+		}
+
+		display();
+
+		// Render overlay GUI.
+		gui();
+
+		// Finish the frame and render the GUI
+		labhelper::finishFrame();
+
+		// Swap front and back buffer. This frame will now been displayed.
+		SDL_GL_SwapWindow(g_window);
+
+		framePacer.endFrame();
+	}
+
+	labhelper::freeModel(containerModel);
+
+	// Shut down everything. This includes the window and all other subsystems.
+	labhelper::shutDown(g_window);
+	return 0;
+}
@@ -0,0 +1,33 @@
+#version 430
+
+// required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
+precision highp float;
+
+uniform mat4 projectionMatrix;
+uniform float particleRadius;
+uniform vec3 viewSpaceLightDirection; // Towards the light
+
+flat in vec3 viewCenter;
+flat in vec3 color;
+
+layout(location = 0) out vec4 fragmentColor;
+
+void main()
+{
+    // The sprite's corners are at +-1, gl_PointCoord runs down the screen
+    vec2 local = gl_PointCoord * 2.0 - 1.0;
+    local.y = -local.y;
+    float radiusSquared = dot(local, local);
+    if (radiusSquared > 1.0) {
+        discard;
+    }
+
+    // The front of the sphere, taken as seen head on, which holds for the
+    // small spheres this draws
+    vec3 normal = vec3(local, sqrt(1.0 - radiusSquared));
+    vec4 clipPosition = projectionMatrix * vec4(viewCenter + normal * particleRadius, 1.0);
+    gl_FragDepth = 0.5 * clipPosition.z / clipPosition.w + 0.5;
+
+    float diffuse = max(dot(normal, viewSpaceLightDirection), 0.0);
+    fragmentColor = vec4(color * (0.25 + 0.75 * diffuse), 1.0);
+}
@@ -0,0 +1,49 @@
+#version 430
+
+// Particles as sphere impostors, straight from the particle buffers: a point
+// sprite per particle, as large as the sphere's projection, which
+// sphere.frag turns into the sphere.
+#include "../project/common.glsl"
+
+layout( std430, binding=3 ) readonly buffer ParticleBuffer
+{
+    ParticleData particles[];
+};
+
+layout( std430, binding=7 ) readonly buffer PreviousParticleBuffer
+{
+    ParticleData previousParticles[];
+};
+
+uniform mat4 viewMatrix;
+uniform mat4 projectionMatrix;
+uniform float interpolationAlpha = 1.0;
+uniform float particleRadius;  // In the simulation domain
+uniform float viewportHeight;
+uniform float minSpeed;
+uniform float maxSpeed;
+uniform bool colorBySpecies;
+
+flat out vec3 viewCenter;
+flat out vec3 color;
+
+void main()
+{
+    ParticleData particle = particles[gl_VertexID];
+    vec3 position = mix(previousParticles[gl_VertexID].pos, particle.pos, interpolationAlpha);
+
+    vec4 viewPosition = viewMatrix * vec4(position, 1.0);
+    viewCenter = viewPosition.xyz;
+    gl_Position = projectionMatrix * viewPosition;
+    // projectionMatrix[1][1] maps view space heights at unit depth to NDC,
+    // which span the viewport twice over
+    gl_PointSize = viewportHeight * projectionMatrix[1][1] * particleRadius / max(-viewPosition.z, 1e-3);
+
+    if (colorBySpecies) {
+        color = speciesParams[particle.species].color.rgb;
+    } else {
+        // Green to red with speed, as in the 2D view
+        float t = clamp((length(particle.vel) - minSpeed) / (maxSpeed - minSpeed), 0.0, 1.0);
+        color = vec3(t, 1.0 - t, 0.0);
+    }
+}